@@ -35,7 +35,12 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <pcap.h>
+#include <velodyne_driver/pcap_index.h>
+#include <velodyne_driver/pcap_reader.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <vector>
 
 #include <rclcpp/rclcpp.hpp>
 #include <velodyne_msgs/msg/velodyne_packet.hpp>
@@ -65,11 +70,66 @@ namespace velodyne_driver
     virtual int getPacket(velodyne_msgs::msg::VelodynePacket *pkt,
                           const double time_offset) = 0;
 
+    /** @brief Read up to max_packets Velodyne packets in one call.
+     *
+     * Sources which cannot batch fall back to reading a single
+     * packet with getPacket().
+     *
+     * @param pkts points to an array of at least max_packets messages
+     * @param max_packets capacity of the pkts array
+     * @param num_packets set to the number of packets read
+     *
+     * @returns 0 if at least one packet was read,
+     *          -1 if end of file
+     *          > 0 if no packet could be read
+     */
+    virtual int getPackets(velodyne_msgs::msg::VelodynePacket *pkts,
+                           size_t max_packets, size_t *num_packets,
+                           const double time_offset);
+
+    /** @brief Descriptor an event loop can wait on for new packets.
+     *
+     * @returns -1 if the source cannot be polled
+     */
+    virtual int fileDescriptor() const {return -1;}
+
+    /** @brief Have getPackets() return at once when no packet is
+     *  available, instead of waiting for one.  Ignored by sources
+     *  without a file descriptor.
+     */
+    virtual void setNonBlocking(bool nonblocking) {(void) nonblocking;}
+
+    /** @brief Receive counters, cumulative since the input was opened.
+     *
+     * Safe to read from another thread than the one reading packets.
+     */
+    uint64_t packetsReceived() const {return packets_received_.load(std::memory_order_relaxed);}
+    uint64_t bytesReceived() const {return bytes_received_.load(std::memory_order_relaxed);}
+    uint64_t kernelDrops() const {return kernel_drops_.load(std::memory_order_relaxed);}
+    uint64_t packetsRejected() const {return packets_rejected_.load(std::memory_order_relaxed);}
+    uint64_t filterRejects() const {return filter_rejects_.load(std::memory_order_relaxed);}
+
+    /** @brief True if the kernel filter rejects foreign and malformed
+     *  datagrams; these count as filter rejects, not kernel drops.
+     */
+    bool kernelFilter() const {return kernel_filter_;}
+
   protected:
+    void countPackets(uint64_t packets, uint64_t bytes);
+    void countRejected(uint64_t packets);
+    void countFilterRejected(uint64_t packets);
+
     rclcpp::Node * node_ptr_;
     uint16_t port_;
     std::string devip_str_;
     bool sensor_timestamp_;
+
+    std::atomic<uint64_t> packets_received_;
+    std::atomic<uint64_t> bytes_received_;
+    std::atomic<uint64_t> kernel_drops_;  ///< datagrams the kernel dropped
+    std::atomic<uint64_t> packets_rejected_; ///< wrong size or sender
+    std::atomic<uint64_t> filter_rejects_;   ///< wrong size or sender, by the kernel filter
+    bool kernel_filter_;                  ///< kernel filters wrong size or sender
   };
 
   /** @brief Live Velodyne input from socket. */
@@ -83,11 +143,46 @@ namespace velodyne_driver
     virtual int getPacket(velodyne_msgs::msg::VelodynePacket *pkt,
                           const double time_offset);
 
+    virtual int getPackets(velodyne_msgs::msg::VelodynePacket *pkts,
+                           size_t max_packets, size_t *num_packets,
+                           const double time_offset);
+
+    virtual int fileDescriptor() const {return sockfd_;}
+    virtual void setNonBlocking(bool nonblocking) {nonblocking_ = nonblocking;}
+
     void setDeviceIP( const std::string& ip );
 
   private:
+    int waitForInput();
+    void attachFilter();
+    void resizeBatch(size_t max_packets);
+    void parseControlMessages(size_t slot);
+    bool acceptDatagram(size_t slot, size_t nbytes);
+    void splitGroSegments(velodyne_msgs::msg::VelodynePacket *pkts,
+                          size_t max_packets, size_t *num_packets,
+                          const double time_offset);
+    void stampPacket(velodyne_msgs::msg::VelodynePacket *pkt,
+                     int64_t receive_time, const double time_offset);
+
     int sockfd_;
     in_addr devip_;
+    bool nonblocking_;                    ///< return instead of waiting for input
+    bool udp_gro_;                        ///< let the kernel coalesce datagrams
+    bool kernel_timestamp_;               ///< stamp packets with kernel arrival time
+
+    // recvmmsg() state, one slot per datagram
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovecs_;
+    std::vector<sockaddr_in> sender_addresses_;
+    std::vector<uint8_t> control_;        ///< ancillary data, per slot
+    std::vector<uint8_t> gro_buffer_;     ///< coalesced payloads, per slot
+    std::vector<size_t> gro_segment_size_;
+    std::vector<int64_t> receive_times_;  ///< arrival time (ns), per slot
+
+    // coalesced datagrams received but not yet handed out
+    size_t gro_slot_;
+    size_t gro_slots_;
+    size_t gro_offset_;
   };
 
 
@@ -109,18 +204,52 @@ namespace velodyne_driver
 
     virtual int getPacket(velodyne_msgs::msg::VelodynePacket *pkt,
                           const double time_offset);
+
+    virtual int getPackets(velodyne_msgs::msg::VelodynePacket *pkts,
+                           size_t max_packets, size_t *num_packets,
+                           const double time_offset);
+
     void setDeviceIP( const std::string& ip );
   private:
-    rclcpp::Time last_packet_receive_time_;
-    rclcpp::Time last_packet_stamp_;
+    void extendIndex(size_t scans, int64_t stamp);
+    void finishIndex();
+    void seekWindowStart();
+    void loadCache();
+    bool rewind();
+    int nextPacket(PcapPacket *found, bool batch_started);
+    int64_t packetDeadline(int64_t stamp);
+
     std::string filename_;
-    pcap_t *pcap_;
-    bpf_program pcap_packet_filter_;
-    char errbuf_[PCAP_ERRBUF_SIZE];
+    PcapFilter filter_;
+    std::unique_ptr<PcapReader> reader_;
+    PcapMemoryReader *cache_;           ///< reader_, when replaying from memory
     bool empty_;
     bool read_once_;
     bool read_fast_;
     double repeat_delay_;
+    double rate_;                       ///< replay speed, 1.0 is real time
+
+    // packet read but not yet returned, due at pending_deadline_
+    PcapPacket pending_;
+    bool have_pending_;
+    int64_t pending_deadline_;
+
+    // capture time pacing_stamp_base_ is replayed at monotonic clock
+    // time pacing_clock_base_
+    bool pacing_started_;
+    int64_t pacing_stamp_base_;
+    int64_t pacing_clock_base_;
+    int64_t pacing_last_stamp_;
+
+    // replay window, located through the scan index
+    PcapIndex index_;
+    bool use_index_;
+    double start_time_;
+    double end_time_;
+    int start_scan_;
+    bool have_window_;
+    uint64_t window_start_;             ///< file offset of the first scan
+    int64_t window_end_;                ///< capture time, 0 for end of file
   };
 
 } // velodyne_driver namespace
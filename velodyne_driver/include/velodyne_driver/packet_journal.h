@@ -0,0 +1,136 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Recorder of the raw Velodyne packets received by the driver.
+ *
+ *  The journal is a series of nanosecond pcap files with one IPv4/UDP
+ *  datagram per packet, so InputPCAP, tcpdump and Wireshark read its
+ *  segments directly.
+ */
+
+#ifndef __VELODYNE_PACKET_JOURNAL_H
+#define __VELODYNE_PACKET_JOURNAL_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <velodyne_msgs/msg/velodyne_packet.hpp>
+
+namespace velodyne_driver
+{
+  /** @brief Asynchronous, segment-rotated pcap recorder.
+   *
+   * record() only copies the packets into preallocated buffers; a
+   * writer thread writes the full ones with O_DIRECT, so the
+   * receiving thread never waits on the disk.  When the disk falls
+   * behind and no buffer is free, packets are dropped and counted
+   * instead.
+   *
+   * Segments are named <prefix>-NNNNN.pcap, never overwrite existing
+   * files, and are preallocated to the segment size, then trimmed
+   * when closed.  On file systems that cannot preallocate the
+   * segments grow as they are written instead.
+   */
+  class PacketJournal
+  {
+  public:
+    /**
+     * @param prefix path and name of the segment files
+     * @param segment_size bytes per segment
+     * @param buffers number of 1 MiB write buffers
+     * @param source sender address written to the records
+     * @param port UDP destination port written to the records
+     */
+    PacketJournal(const std::string &prefix, uint64_t segment_size,
+                  size_t buffers, in_addr source, uint16_t port);
+    ~PacketJournal();
+
+    /** @returns false if the first segment could not be created */
+    bool open();
+
+    /** @brief Append packets, from a single thread.
+     *
+     * @param time_offset seconds to take off the packet stamps, so
+     *                    replay adds it only once
+     */
+    void record(const velodyne_msgs::msg::VelodynePacket *pkts, size_t num_packets,
+                double time_offset);
+
+    /** @brief Counters, safe to read from any thread. */
+    uint64_t packetsRecorded() const {return packets_recorded_.load(std::memory_order_relaxed);}
+    uint64_t packetsDropped() const {return packets_dropped_.load(std::memory_order_relaxed);}
+    uint64_t bytesWritten() const {return bytes_written_.load(std::memory_order_relaxed);}
+    uint64_t segments() const {return segments_.load(std::memory_order_relaxed);}
+    bool preallocating() const {return preallocate_.load(std::memory_order_relaxed);}
+
+    /** @returns the last error met, empty if none */
+    std::string error() const;
+
+  private:
+    struct Buffer
+    {
+      uint8_t *data;
+      size_t length;
+      bool last;                // ends its segment
+    };
+
+    void setError(const std::string &error);
+    bool takeBuffer();
+    void append(const uint8_t *bytes, size_t length);
+    void submit(bool last);
+    void startSegment();
+    bool openSegment();
+    void closeSegment(uint64_t length);
+    void writerLoop();
+
+    std::string prefix_;
+    uint64_t segment_size_;
+    in_addr source_;
+    uint16_t port_;
+
+    // recording thread state
+    Buffer current_;
+    bool have_current_;
+    uint64_t segment_used_;     ///< bytes recorded in the current segment
+    uint16_t ip_id_;
+
+    // buffers, handed between the recording and the writer thread
+    std::vector<uint8_t *> storage_;
+    mutable std::mutex mutex_;
+    std::condition_variable filled_cv_;
+    std::deque<Buffer> filled_;
+    std::vector<uint8_t *> free_;
+    bool stopping_;
+    std::string error_;
+
+    // writer thread state
+    std::thread writer_;
+    int fd_;
+    bool direct_;               ///< fd_ was opened with O_DIRECT
+    std::atomic<bool> preallocate_;   ///< false once the file system refused
+    uint64_t file_offset_;
+    unsigned next_index_;
+
+    std::atomic<uint64_t> packets_recorded_;
+    std::atomic<uint64_t> packets_dropped_;
+    std::atomic<uint64_t> bytes_written_;
+    std::atomic<uint64_t> segments_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PACKET_JOURNAL_H
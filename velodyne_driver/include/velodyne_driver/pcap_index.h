@@ -0,0 +1,98 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Scan index of a Velodyne packet capture file.
+ *
+ *  The index lists the file offset and capture time of the first
+ *  packet of every revolution.  It is built while the file plays and
+ *  saved next to it, so later runs can seek straight to a scan or a
+ *  time in the capture.
+ */
+
+#ifndef __VELODYNE_PCAP_INDEX_H
+#define __VELODYNE_PCAP_INDEX_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <velodyne_driver/pcap_reader.h>
+
+namespace velodyne_driver
+{
+  /** @brief Scan boundaries of a capture file. */
+  class PcapIndex
+  {
+  public:
+    /** @brief First packet of one revolution. */
+    struct Scan
+    {
+      uint64_t offset;          ///< file position of the record
+      int64_t stamp;            ///< capture time (ns since the epoch)
+    };
+
+    PcapIndex();
+
+    /** @brief Attach to a capture file and load its sidecar index.
+     *
+     *  The index file is only used if it was built with the same
+     *  filter for a file of the same size and modification time.
+     *
+     *  @returns true if a complete index was loaded
+     */
+    bool load(const std::string &filename, const PcapFilter &filter);
+
+    /** @brief Write the complete index next to the capture file.
+     *  @returns false if it could not be written, with errno set
+     */
+    bool save() const;
+
+    /** @brief Record a packet returned by the reader.
+     *
+     *  Packets must arrive in file order; ones at or before the last
+     *  packet already indexed are ignored, so the file may be played
+     *  again from any indexed scan.
+     */
+    void observe(const PcapPacket &pkt);
+
+    /** @brief Mark the end of the file, completing the index. */
+    void finish() {complete_ = true;}
+
+    /** @returns offset of the last packet indexed, to resume from */
+    uint64_t resumeOffset() const {return last_offset_;}
+
+    /** @returns sidecar file name */
+    const std::string & path() const {return path_;}
+    bool complete() const {return complete_;}
+    bool empty() const {return scans_.empty();}
+    size_t size() const {return scans_.size();}
+    const Scan & operator[](size_t i) const {return scans_[i];}
+
+    /** @returns the last indexed scan starting at or before stamp,
+     *           or 0 if all start later
+     */
+    size_t findTime(int64_t stamp) const;
+
+  private:
+    std::string path_;          ///< sidecar file name
+    uint64_t file_size_;        ///< identifies the indexed capture
+    int64_t file_mtime_;
+    PcapFilter filter_;
+
+    std::vector<Scan> scans_;
+    bool complete_;
+    bool have_last_;            ///< last_* describe an indexed packet
+    uint64_t last_offset_;
+    uint16_t last_azimuth_;
+  };
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PCAP_INDEX_H
@@ -0,0 +1,302 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Readers for Velodyne packet capture files.
+ *
+ *  Classes:
+ *
+ *     velodyne::PcapReader -- base class returning the Velodyne UDP
+ *                      payloads of a capture file one at a time
+ *
+ *     velodyne::PcapMmapReader -- maps pcap and pcapng files into
+ *                      memory and filters packets with a fixed parser
+ *
+ *     velodyne::PcapStreamReader -- decompresses zstd or lz4 captures
+ *                      on a background thread for the same parser
+ *
+ *     velodyne::PcapLibReader -- reads through libpcap and its BPF
+ *                      filter, for captures the fixed parser rejects
+ *
+ *     velodyne::PcapMemoryReader -- loops over packets held in memory
+ */
+
+#ifndef __VELODYNE_PCAP_READER_H
+#define __VELODYNE_PCAP_READER_H
+
+#include <stdint.h>
+#include <pcap.h>
+#include <netinet/in.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace velodyne_driver
+{
+  /** @brief One Velodyne packet found in a capture file. */
+  struct PcapPacket
+  {
+    const uint8_t *payload;     ///< UDP payload, valid until the next call
+    int64_t stamp;              ///< capture time (ns since the epoch)
+    uint64_t offset;            ///< file position of the record, for seek()
+  };
+
+  /** @brief Selects the packets wanted from a capture file. */
+  struct PcapFilter
+  {
+    uint16_t port;              ///< UDP destination port
+    bool match_source;          ///< only accept packets from source
+    in_addr source;             ///< device IP address
+    size_t payload_size;        ///< UDP payload size of a data packet
+  };
+
+  /** @brief Capture file reader base class */
+  class PcapReader
+  {
+  public:
+    virtual ~PcapReader() {}
+
+    /** @brief Find the next packet passing the filter.
+     *
+     * @returns 1 if a packet was found,
+     *          0 at end of file,
+     *          -1 on error
+     */
+    virtual int next(PcapPacket *pkt) = 0;
+
+    /** @brief Go back to the first packet. @returns false on error */
+    virtual bool rewind() = 0;
+
+    /** @brief Continue reading at a record returned by next().
+     *
+     * @returns false if the reader cannot seek
+     */
+    virtual bool seek(uint64_t offset) {(void)offset; return false;}
+
+    /** @returns true if seek() and the record offsets work */
+    virtual bool seekable() const {return false;}
+
+    const std::string & error() const {return error_;}
+
+  protected:
+    std::string error_;
+  };
+
+  /** @brief Parser for pcap and pcapng files.
+   *
+   * Derived classes supply the file contents through bytes(), either
+   * from memory or from a stream.
+   */
+  class PcapFileReader: public PcapReader
+  {
+  public:
+    PcapFileReader(const PcapFilter &filter);
+
+    virtual int next(PcapPacket *pkt);
+    virtual bool rewind();
+
+  protected:
+    /** pcapng interface, ticks are converted to ns as ticks * mul / div */
+    struct Interface
+    {
+      int linktype;
+      uint64_t tick_mul;
+      uint64_t tick_div;
+    };
+
+    /** @brief Get part of the file.
+     *
+     * The pointer stays valid until the next call.  Only positions
+     * at or after the current record are requested.
+     *
+     * @returns pointer to length bytes at file offset pos, or NULL
+     *          if the file ends first
+     */
+    virtual const uint8_t *bytes(uint64_t pos, size_t length) = 0;
+
+    /** @returns false if the file is not a usable capture */
+    bool parseFileHeader();
+
+    uint64_t pos_;              ///< next record
+    uint64_t first_record_;     ///< first record after the file headers
+
+  private:
+    uint32_t read32(const uint8_t *p) const;
+    uint16_t read16(const uint8_t *p) const;
+    int64_t ticksToNs(uint64_t ticks, const Interface &iface) const;
+    bool parseSectionHeader(const uint8_t *block, size_t *block_length);
+    bool parseInterface(const uint8_t *block, size_t block_length);
+    int nextPcap(PcapPacket *pkt);
+    int nextPcapng(PcapPacket *pkt);
+
+    PcapFilter filter_;
+    bool pcapng_;
+    bool swapped_;              ///< file byte order differs from ours
+    std::vector<Interface> interfaces_;  ///< pcap files have exactly one
+  };
+
+  /** @brief Memory-mapped pcap and pcapng reader.
+   *
+   * Packets are parsed straight from the mapping, with sequential
+   * read-ahead advice given to the kernel, and payloads are returned
+   * as pointers into the mapped file.
+   */
+  class PcapMmapReader: public PcapFileReader
+  {
+  public:
+    PcapMmapReader(const PcapFilter &filter);
+    virtual ~PcapMmapReader();
+
+    /** @returns false if the file cannot be mapped or parsed */
+    bool open(const std::string &filename);
+
+    virtual int next(PcapPacket *pkt);
+    virtual bool seek(uint64_t offset);
+    virtual bool seekable() const {return true;}
+
+  protected:
+    virtual const uint8_t *bytes(uint64_t pos, size_t length);
+
+  private:
+    void readAhead();
+
+    int fd_;
+    const uint8_t *data_;
+    size_t size_;
+    size_t readahead_end_;      ///< end of the range advised so far
+  };
+
+  class ByteSource;
+
+  /** @brief Reader for compressed pcap and pcapng files.
+   *
+   * A background thread decompresses the file into a bounded queue
+   * of chunks, which the parser consumes in order.  Rewinding
+   * restarts the decompression.
+   */
+  class PcapStreamReader: public PcapFileReader
+  {
+  public:
+    PcapStreamReader(const PcapFilter &filter);
+    virtual ~PcapStreamReader();
+
+    /** @brief Check for a compression format this build can read. */
+    static bool compressed(const std::string &filename);
+
+    /** @returns false if the file cannot be opened or parsed */
+    bool open(const std::string &filename);
+
+    virtual int next(PcapPacket *pkt);
+    virtual bool rewind();
+
+  protected:
+    virtual const uint8_t *bytes(uint64_t pos, size_t length);
+
+  private:
+    bool start();
+    void stop();
+    void decompress();
+
+    std::string filename_;
+    std::unique_ptr<ByteSource> source_;
+    std::thread thread_;
+
+    // chunks passed from the decompression thread
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::vector<uint8_t> > chunks_;
+    std::vector<std::vector<uint8_t> > free_chunks_;
+    bool done_;                 ///< no more chunks will be queued
+    bool stopping_;
+    std::string source_error_;
+
+    std::vector<uint8_t> buffer_;       ///< decompressed file data
+    uint64_t buffer_pos_;               ///< file offset of buffer_[0]
+  };
+
+  /** @brief Reader using libpcap and a compiled BPF filter. */
+  class PcapLibReader: public PcapReader
+  {
+  public:
+    PcapLibReader(const PcapFilter &filter);
+    virtual ~PcapLibReader();
+
+    /** @returns false if libpcap cannot open the file */
+    bool open(const std::string &filename);
+
+    virtual int next(PcapPacket *pkt);
+    virtual bool rewind();
+
+  private:
+    PcapFilter filter_;
+    std::string filename_;
+    pcap_t *pcap_;
+    bpf_program pcap_packet_filter_;
+    bool have_filter_;
+    char errbuf_[PCAP_ERRBUF_SIZE];
+  };
+
+  /** @brief Replays packets loaded into memory.
+   *
+   * Payloads are packed back to back in one buffer, so replay does no
+   * file I/O and no parsing.  Every rewind() shifts the capture times
+   * by the length of the recording, keeping them increasing over any
+   * number of loops.
+   */
+  class PcapMemoryReader: public PcapReader
+  {
+  public:
+    /** @param loop_delay extra time between loops (ns) */
+    PcapMemoryReader(size_t payload_size, int64_t loop_delay = 0);
+
+    /** @brief Copy the remaining packets of another reader.
+     *
+     * @param end_stamp stop at the first packet captured after this
+     *                  time, 0 to read to end of file
+     * @returns false if no packets were loaded
+     */
+    bool load(PcapReader &source, int64_t end_stamp);
+
+    virtual int next(PcapPacket *pkt);
+    virtual bool rewind();
+
+    size_t size() const {return stamps_.size();}
+    size_t bytes() const {return payloads_.size();}
+
+    /** @returns time added to the capture times of the current loop (ns) */
+    int64_t loopOffset() const {return loop_offset_;}
+
+  private:
+    size_t payload_size_;
+    std::vector<uint8_t> payloads_;
+    std::vector<int64_t> stamps_;
+    size_t next_;
+    int64_t loop_delay_;
+    int64_t loop_offset_;
+    int64_t loop_period_;               ///< recording length plus one packet
+  };
+
+  /** @brief Open the fastest reader able to handle a capture file.
+   *
+   * @param use_mmap try the memory-mapped reader before libpcap
+   * @param error set to a description of the failure
+   * @returns the reader, or NULL if the file cannot be read
+   */
+  std::unique_ptr<PcapReader> openPcapReader(const std::string &filename,
+                                             const PcapFilter &filter,
+                                             bool use_mmap,
+                                             std::string *error);
+
+} // velodyne_driver namespace
+
+#endif // __VELODYNE_PCAP_READER_H
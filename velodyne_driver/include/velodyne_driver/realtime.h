@@ -0,0 +1,56 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  CPU affinity, real-time priority and memory locking of the
+ *  driver threads, and of the point cloud nodes' callback threads.
+ */
+
+#ifndef _VELODYNE_REALTIME_H_
+#define _VELODYNE_REALTIME_H_ 1
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+
+namespace velodyne_driver
+{
+
+/** @brief Scheduling of one driver thread. */
+struct ThreadPolicy
+{
+  std::vector<int64_t> cpus;            ///< CPUs to run on, empty for any
+  int priority;                         ///< SCHED_FIFO priority, 0 keeps SCHED_OTHER
+};
+
+/** @brief Declare the "<prefix>_cpus" and "<prefix>_priority" parameters.
+ *
+ *  @returns the policy they configure
+ */
+ThreadPolicy declareThreadPolicy(rclcpp::Node * node_ptr, const std::string & prefix);
+
+/** @brief Apply a policy to the calling thread.
+ *
+ *  @param name thread name, for the log and for tools like top
+ *  @returns false if the kernel refused part of it, which is logged
+ */
+bool applyThreadPolicy(const ThreadPolicy & policy, const std::string & name,
+                       const rclcpp::Logger & logger);
+
+/** @brief Lock the current and future pages of the process in RAM.
+ *
+ *  @returns false if not permitted, which is logged
+ */
+bool lockMemory(const rclcpp::Logger & logger);
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_REALTIME_H_
@@ -14,11 +14,15 @@
  *  ROS driver implementation for the Velodyne 3D LIDARs
  */
 
+#include <algorithm>
 #include <string>
+#include <thread>
 #include <cmath>
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <arpa/inet.h>
 #include <rclcpp/rclcpp.hpp>
 #include <tf2_ros/transform_listener.h>
 
@@ -26,6 +30,19 @@
 
 namespace velodyne_driver
 {
+  static const int SIZE_BLOCK = 100;          // bytes per data block
+  static const int BLOCKS_PER_PACKET = 12;
+  static const size_t MAX_LATENCY_SAMPLES = 1024;   // per diagnostics update
+  static const int ROTATION_MAX_UNITS = 36000;      // azimuth units per revolution
+  // Blocks are kept this far outside the view window (1 degree), as
+  // their firings spread past the block azimuth; the converter trims
+  // the points exactly.
+  static const int VIEW_MARGIN = 100;
+  // Packets in a row with the same factory bytes before the driver
+  // takes them as a model or return mode change.  The HDL-64E puts a
+  // rotating status type and value there, which never repeat.
+  static const int FACTORY_BYTES_REPEATS = 4;
+
   inline   std::string toBinary(int n)
   {
         std::string r;
@@ -134,6 +151,103 @@ inline int get_rmode_multiplier(uint8_t sensor_model, uint8_t packet_rmode)
    }
 }
 
+/** Utility function for Velodyne Driver
+ *  gets the number of data blocks carrying azimuths, the last four
+ *  blocks of a VLS-128 dual return packet are blank
+*/
+
+inline int get_azimuth_blocks(uint8_t sensor_model, uint8_t packet_rmode)
+{
+  if (packet_rmode == 57 && (sensor_model == 161 || sensor_model == 99))
+    return BLOCKS_PER_PACKET - 4; // vls128 dual return
+  return BLOCKS_PER_PACKET;
+}
+
+/** Utility function for Velodyne Driver
+ *  tells whether blank returns of a model decode to no points; the
+ *  HDL-32E, VLP-32C and HDL-64E decoder makes invalid points of them
+*/
+
+inline bool can_blank_blocks(uint8_t sensor_model)
+{
+  return (sensor_model == 34 || sensor_model == 36 ||   // vlp16, puck lite, puck hires
+          sensor_model == 161 || sensor_model == 99);   // vls128
+}
+
+/** Utility function for Velodyne Driver
+ *  gets the packet rate and full name of a model parameter value
+ *  @returns false for an unknown model
+*/
+
+inline bool get_model_info(const std::string & model, double * packet_rate, std::string * full_name)
+{
+  if ((model == "64E_S2") ||
+      (model == "64E_S2.1"))
+    {
+      *packet_rate = 3472.17;            // 1333312 / 384
+      *full_name = std::string("HDL-") + model;
+    }
+  else if (model == "64E")
+    {
+      *packet_rate = 2600.0;
+      *full_name = std::string("HDL-") + model;
+    }
+  else if (model == "64E_S3")
+    {
+      *packet_rate = 5800.0;             // single return mode
+      *full_name = std::string("HDL-") + model;
+    }
+  else if (model == "32E")
+    {
+      *packet_rate = 1808.0;
+      *full_name = std::string("HDL-") + model;
+    }
+  else if (model == "32C")
+    {
+      *packet_rate = 1507.0;
+      *full_name = std::string("VLP-") + model;
+    }
+  else if (model == "VLP16")
+    {
+      *packet_rate = 754.0;              // last or strongest return mode
+      *full_name = "VLP-16";
+    }
+  else if (model == "VLS128")
+    {
+      *packet_rate = 6253.9;             // 3 firing sequences of 53.3 us per packet
+      *full_name = "VLS-128";
+    }
+  else
+    {
+      return false;
+    }
+  return true;
+}
+
+/** Utility function for Velodyne Driver
+ *  gets the model parameter value matching the sensor model byte,
+ *  or NULL for sensors that do not report it (HDL-64E)
+*/
+
+inline const char * get_model_param(uint8_t sensor_model)
+{
+  switch(sensor_model)
+  {
+    case 33:
+        return "32E";
+    case 34:
+    case 36:
+        return "VLP16";
+    case 40:
+        return "32C";
+    case 161:
+    case 99:
+        return "VLS128";
+    default:
+        return NULL;
+  }
+}
+
 /** \brief For parameter service callback */
 template <typename T>
 bool get_param(const std::vector<rclcpp::Parameter> & p, const std::string & name, T & value)
@@ -157,7 +271,22 @@ bool get_param(const std::vector<rclcpp::Parameter> & p, const std::string & nam
 
 VelodyneDriverCore::VelodyneDriverCore(rclcpp::Node * node_ptr)
 : node_ptr_(node_ptr),
-  diagnostics_(node_ptr_, 0.2)
+  view_window_(ROTATION_MAX_UNITS << 16),
+  view_packets_dropped_(0),
+  view_blocks_blanked_(0),
+  view_bytes_saved_(0),
+  diagnostics_(node_ptr_, 0.2),
+  diag_last_packets_(0),
+  diag_last_bytes_(0),
+  diag_last_drops_(0),
+  diag_last_integrity_(),
+  measure_latency_(false),
+  sample_ring_latency_(false),
+  have_prev_block_(false),
+  prev_block_azm_phased_(0),
+  publish_queue_depth_(0),
+  publish_stopped_(false),
+  publish_dropped_(0)
 {
   // use private node handle to get parameters
   config_.frame_id = node_ptr_->declare_parameter("frame_id", std::string("velodyne"));
@@ -170,38 +299,11 @@ VelodyneDriverCore::VelodyneDriverCore(rclcpp::Node * node_ptr)
   // get model name, validate string, determine packet rate
   config_.model = node_ptr_->declare_parameter("model", std::string("64E"));
   std::string model_full_name;
-  if ((config_.model == "64E_S2") ||
-      (config_.model == "64E_S2.1"))
-    {
-      model_full_name = std::string("HDL-") + config_.model;
-    }
-  else if (config_.model == "64E")
-    {
-      model_full_name = std::string("HDL-") + config_.model;
-    }
-  else if (config_.model == "64E_S3")
-    {
-      model_full_name = std::string("HDL-") + config_.model;
-    }
-  else if (config_.model == "32E")
-    {
-      model_full_name = std::string("HDL-") + config_.model;
-    }
-    else if (config_.model == "32C")
-    {
-      model_full_name = std::string("VLP-") + config_.model;
-    }
-  else if (config_.model == "VLP16")
-    {
-      model_full_name = "VLP-16";
-    }
-  else if (config_.model == "VLS128")
-    {
-      model_full_name = "VLS-128";
-    }
-  else
+  double packet_rate;                   // packet frequency (Hz)
+  if (!get_model_info(config_.model, &packet_rate, &model_full_name))
     {
       RCLCPP_ERROR_STREAM(node_ptr_->get_logger(), "Unknown Velodyne LIDAR model: " << config_.model);
+      packet_rate = 2600.0;
     }
   std::string deviceName(std::string("Velodyne ") + model_full_name);
 
@@ -210,21 +312,73 @@ VelodyneDriverCore::VelodyneDriverCore(rclcpp::Node * node_ptr)
   RCLCPP_INFO_STREAM(node_ptr_->get_logger(), deviceName << " rotating at " << config_.rpm << " RPM");
   double frequency = (config_.rpm / 60.0);     // expected Hz rate
 
+  // single return packets per revolution, scaled for dual return
+  // once the first packet tells us the return mode
+  packets_per_rev_ = packet_rate / frequency;
+  packets_per_scan_ = expectedPacketsPerScan(1);
+  curr_packet_rmode_ = 0;               // no packet seen yet
+  curr_packet_sensor_model_ = 0;
+  seen_packet_rmode_ = 0;
+  seen_packet_sensor_model_ = 0;
+  seen_packet_repeats_ = 0;
+
   config_.scan_phase = node_ptr_->declare_parameter("scan_phase", 0.0);
   config_.scan_phase = node_ptr_->get_parameter("scan_phase").as_double();
   RCLCPP_INFO_STREAM(node_ptr_->get_logger(), "Scan start/end will be at a phase of " << config_.scan_phase  << " degrees");
 
+  // publish a partial scan when the sensor stops sending, 0 waits forever
+  double stall_timeout = node_ptr_->declare_parameter("stall_timeout", 1.5 / frequency);
+  stall_timeout_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(std::max(stall_timeout, 0.0)));
+
   config_.time_offset = node_ptr_->declare_parameter("time_offset", 0.0);
   config_.time_offset = node_ptr_->get_parameter("time_offset").as_double();
   RCLCPP_INFO_STREAM(
     node_ptr_->get_logger(),
     "time in seconds added to each velodyne time stamp " << config_.time_offset  << " s");
 
+  // packets and blocks outside this view are not published; the
+  // defaults keep the full revolution
+  config_.view_direction = node_ptr_->declare_parameter("view_direction", 0.0);
+  config_.view_width = node_ptr_->declare_parameter("view_width", 2.0 * M_PI);
+  setViewWindow(config_.view_direction, config_.view_width);
+
   dump_file = node_ptr_->declare_parameter("pcap", std::string(""));
 
   int udp_port;
   udp_port = node_ptr_->declare_parameter("port", (int) DATA_PORT_NUMBER);
 
+  // number of packets fetched from the input per read
+  int recv_batch_size = node_ptr_->declare_parameter("recv_batch_size", 32);
+  if (recv_batch_size < 1)
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "Invalid recv_batch_size %d, using 1.", recv_batch_size);
+      recv_batch_size = 1;
+    }
+  recv_batch_size_ = recv_batch_size;
+  overflow_batch_.resize(recv_batch_size_);
+
+  // packets buffered between the receive thread and scan assembly
+  int packet_ring_size = node_ptr_->declare_parameter("packet_ring_size", 4096);
+  if (packet_ring_size < recv_batch_size)
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "packet_ring_size %d is smaller than recv_batch_size, using %d.",
+                  packet_ring_size, recv_batch_size);
+      packet_ring_size = recv_batch_size;
+    }
+  ring_.reset(new PacketRing(packet_ring_size));
+
+  // packets held back to undo reordering on the network
+  int reorder_depth = node_ptr_->declare_parameter("reorder_depth", 0);
+  double reorder_max_delay = node_ptr_->declare_parameter("reorder_max_delay", 0.0003);
+  if (reorder_depth > 0)
+    {
+      reorder_.reset(new ReorderBuffer(reorder_depth,
+        std::chrono::microseconds(static_cast<int64_t>(reorder_max_delay * 1e6))));
+      RCLCPP_INFO(node_ptr_->get_logger(), "Re-sequencing up to %d packets for at most %.0f us.",
+                  reorder_depth, reorder_max_delay * 1e6);
+    }
+
   // Initialize dynamic reconfigure
   using std::placeholders::_1;
   set_param_res_ = node_ptr_->add_on_set_parameters_callback(
@@ -243,6 +397,10 @@ VelodyneDriverCore::VelodyneDriverCore(rclcpp::Node * node_ptr)
                                                              &diag_max_freq_,
                                                              0.1, 10),
                                         TimeStampStatusParam()));
+  diagnostics_.add("packet_ring", this, &VelodyneDriverCore::ringDiagnostics);
+
+  monitor_.reset(new PacketMonitor(packet_rate));
+  diagnostics_.add("packet_integrity", this, &VelodyneDriverCore::integrityDiagnostics);
 
   // open Velodyne input device or file
   if (dump_file != "")                  // have PCAP file?
@@ -256,6 +414,50 @@ VelodyneDriverCore::VelodyneDriverCore(rclcpp::Node * node_ptr)
       input_.reset(new velodyne_driver::InputSocket(node_ptr_, udp_port));
     }
 
+  // raw packets are recorded as pcap segments when a path is given
+  std::string journal_path = node_ptr_->declare_parameter("journal_path", std::string(""));
+  int journal_segment_size = node_ptr_->declare_parameter("journal_segment_size", 1024);
+  int journal_buffers = node_ptr_->declare_parameter("journal_buffers", 16);
+  if (!journal_path.empty())
+    {
+      in_addr source;
+      std::string device_ip = node_ptr_->get_parameter("device_ip").as_string();
+      if (device_ip.empty() || inet_aton(device_ip.c_str(), &source) == 0)
+        source.s_addr = INADDR_ANY;
+      journal_.reset(new PacketJournal(journal_path,
+                                       std::max(journal_segment_size, 1) * 1024ULL * 1024ULL,
+                                       std::max(journal_buffers, 2), source, udp_port));
+      if (journal_->open())
+        {
+          RCLCPP_INFO(node_ptr_->get_logger(), "Recording packets to %s-*.pcap, %d MB segments",
+                      journal_path.c_str(), journal_segment_size);
+          diagnostics_.add("packet_journal", this, &VelodyneDriverCore::journalDiagnostics);
+        }
+      else
+        {
+          RCLCPP_ERROR(node_ptr_->get_logger(), "Cannot record packets: %s",
+                       journal_->error().c_str());
+          journal_.reset();
+        }
+    }
+
+  diag_last_time_ = std::chrono::steady_clock::now();
+  diagnostics_.add("input", this, &VelodyneDriverCore::inputDiagnostics);
+  diagnostics_.add("view_filter", this, &VelodyneDriverCore::viewDiagnostics);
+
+  // on the monotonic clock, so valid for any packet stamps
+  ring_latency_samples_.reserve(MAX_LATENCY_SAMPLES);
+  diagnostics_.add("ring_latency", this, &VelodyneDriverCore::ringLatencyDiagnostics);
+
+  // packets are stamped with the receive time unless replayed or
+  // stamped by the sensor
+  measure_latency_ = dump_file.empty() && !node_ptr_->get_parameter("sensor_timestamp").as_bool();
+  if (measure_latency_)
+    {
+      latency_samples_.reserve(MAX_LATENCY_SAMPLES);
+      diagnostics_.add("publish_latency", this, &VelodyneDriverCore::latencyDiagnostics);
+    }
+
   // raw packet output topic
   output_ =
     node_ptr_->create_publisher<velodyne_msgs::msg::VelodyneScan>(
@@ -269,61 +471,460 @@ VelodyneDriverCore::VelodyneDriverCore(rclcpp::Node * node_ptr)
  */
 bool VelodyneDriverCore::poll(void)
 {
-  // Allocate a new shared pointer for zero-copy sharing with other nodelets.
-  auto scan = std::make_shared<velodyne_msgs::msg::VelodyneScan>();
+  // a backlog is measured once per scan, when nothing wakes us
+  sample_ring_latency_ = true;
 
   // Since the velodyne delivers data at a very high rate, keep
   // reading and publishing scans as fast as possible.
-  uint16_t packet_first_azm = 0;
-  uint16_t packet_first_azm_phased = 0;
-  uint16_t packet_last_azm = 0;
-  uint16_t packet_last_azm_phased = 0;
-  uint16_t prev_packet_first_azm_phased = 0;
+  while (rclcpp::ok())
+  {
+    if (reorder_ && addReordered())
+    {
+      publishScan();
+      return true;
+    }
 
-  uint16_t phase = (uint16_t)round(config_.scan_phase*100);
-  bool use_next_packet = true;
-  uint processed_packets = 0;
-  while (use_next_packet && rclcpp::ok())
-  {
-    while (rclcpp::ok())
-    {
-        // keep reading until full packet received
-        velodyne_msgs::msg::VelodynePacket new_packet;
-        scan->packets.push_back(new_packet);
-        int rc = input_->getPacket(&scan->packets.back(), config_.time_offset);
-        if (rc == 0) break;       // got a full packet?
-        if (rc < 0) return false; // end of file reached?
-    }
-    processed_packets++;
-
-    // uint8_t  curr_packet_rmode;
-    packet_first_azm  = scan->packets.back().data[2]; // lower word of azimuth block 0
-    packet_first_azm |= scan->packets.back().data[3] << 8; // higher word of azimuth block 0
-
-    packet_last_azm = scan->packets.back().data[1102];
-    packet_last_azm |= scan->packets.back().data[1103] << 8;
-
-    // curr_packet_rmode = scan->packets.back().data[1204];
-    // curr_packet_sensor_model = scan->packets.back().data[1205];
-
-    // For correct pointcloud assembly, always stop the scan after passing the
-    // zero phase point. The pointcloud assembler will remedy this after unpacking
-    // the packets, by buffering the overshot azimuths for the next cloud.
-    // NOTE: this also works for dual echo mode because the last blank data block
-    // still contains azimuth data (for VLS128). This should be modified in future
-    // to concretely handle blank data blocks.
-    packet_first_azm_phased = (36000 + packet_first_azm - phase) % 36000;
-    packet_last_azm_phased = (36000 + packet_last_azm - phase) % 36000;
-    if (processed_packets > 1)
-    {
-      if (packet_last_azm_phased < packet_first_azm_phased || packet_first_azm_phased < prev_packet_first_azm_phased)
+    // wait for the receive thread to deliver the next packet
+    velodyne_msgs::msg::VelodynePacket * packet;
+    if (ring_->readable(&packet) == 0)
+    {
+        // closed and drained: end of file reached or shutting down
+        if ((ring_->closed() && ring_->readable(&packet) == 0) || !rclcpp::ok())
+        {
+          if (reorder_ && !reorder_->empty() && rclcpp::ok())
+          {
+            // the packets held back are due now
+            reorder_->flush();
+            continue;
+          }
+          if (scan_)
+            releaseScan(std::move(scan_));
+          return false;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (reorder_ && !reorder_->empty() && stallTimedOut(now))
+        {
+          // no more packets are coming to push the held ones out
+          reorder_->flush();
+          continue;
+        }
+        if (stalled(now))
+        {
+          publishScan();
+          return true;
+        }
+        ring_->waitForPackets(timeUntilCheck(now));
+        sample_ring_latency_ = true;
+        continue;
+    }
+    if (sample_ring_latency_)
+      sampleRingLatency();
+    last_packet_time_ = std::chrono::steady_clock::now();
+
+    bool scan_complete = false;
+    if (reorder_)
+      reorder_->push(*packet, ReorderBuffer::Clock::now());
+    else
+      scan_complete = addPacket(*packet);
+    ring_->pop(1);
+
+    if (scan_complete)
+    {
+      publishScan();
+      return true;
+    }
+  }
+  return false;
+}
+
+/** @returns true if no packet came for the stall timeout */
+bool VelodyneDriverCore::stallTimedOut(std::chrono::steady_clock::time_point now) const
+{
+  return stall_timeout_.count() > 0 && now - last_packet_time_ >= stall_timeout_;
+}
+
+/** end the partial scan if no packet came for the stall timeout
+ *
+ *  The scan is handed to publishScan flagged as incomplete, and the
+ *  next packet starts a new scan, as after a restart.
+ *
+ *  @returns true if there is a scan to publish
+ */
+bool VelodyneDriverCore::stalled(std::chrono::steady_clock::time_point now)
+{
+  if (!scan_ || scan_->packets.empty() || !stallTimedOut(now))
+    return false;
+  if (reorder_ && !reorder_->empty())
+    return false;                       // the held packets are added first
+
+  RCLCPP_WARN_THROTTLE(node_ptr_->get_logger(), *node_ptr_->get_clock(), 1000 /* ms */,
+                       "No packets for %.3f s, publishing a partial scan.",
+                       std::chrono::duration<double>(now - last_packet_time_).count());
+  done_scan_ = std::move(scan_);
+  done_scan_->incomplete = true;
+  monitor_->endScan();
+  have_prev_block_ = false;
+  return true;
+}
+
+/** @returns time until the partial scan stalls, at most 100 ms */
+std::chrono::microseconds
+VelodyneDriverCore::timeUntilStall(std::chrono::steady_clock::time_point now) const
+{
+  std::chrono::microseconds timeout = std::chrono::milliseconds(100);
+  if (stall_timeout_.count() > 0 && scan_ && !scan_->packets.empty())
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+      last_packet_time_ + stall_timeout_ - now);
+    timeout = std::max(std::chrono::microseconds(0), std::min(timeout, remaining));
+  }
+  return timeout;
+}
+
+/** @returns time until the next packet held back for re-sequencing is
+ *           due or the partial scan stalls, at most 100 ms
+ */
+std::chrono::microseconds
+VelodyneDriverCore::timeUntilCheck(std::chrono::steady_clock::time_point now) const
+{
+  std::chrono::microseconds timeout = timeUntilStall(now);
+  if (reorder_ && !reorder_->empty())
+    timeout = std::min(timeout, reorder_->timeUntilDue(now));
+  return timeout;
+}
+
+/** publish the partial scan if the sensor stalled
+ *
+ * For callers of processReceived, which only runs when packets arrive,
+ * at the latest after timeUntilCheck.  Nothing else releases the
+ * packets held back for re-sequencing once the stream stops, so the
+ * ones due are added first, and all of them after the stall timeout.
+ */
+void VelodyneDriverCore::checkStall(void)
+{
+  const auto now = std::chrono::steady_clock::now();
+  if (reorder_ && !reorder_->empty())
+  {
+    if (stallTimedOut(now))
+      reorder_->flush();
+    while (addReordered())
+      publishScan();
+  }
+  if (stalled(now))
+    publishScan();
+}
+
+/** add the packets due from the reorder buffer to the scan
+ *
+ *  @returns true if a scan was completed; the packets after it stay
+ *           in the buffer
+ */
+bool VelodyneDriverCore::addReordered(void)
+{
+  const ReorderBuffer::Clock::time_point now = ReorderBuffer::Clock::now();
+  const velodyne_msgs::msg::VelodynePacket * packet;
+  while ((packet = reorder_->ready(now)) != NULL)
+  {
+    bool scan_complete = addPacket(*packet);
+    reorder_->pop();
+    if (scan_complete)
+      return true;
+  }
+  return false;
+}
+
+/** assemble and publish scans from the packets already received
+ *
+ * Unlike poll, never waits for packets; a partial scan is kept for
+ * the next call.
+ */
+void VelodyneDriverCore::processReceived(void)
+{
+  velodyne_msgs::msg::VelodynePacket * packets;
+  size_t num_packets;
+  sample_ring_latency_ = true;
+  while ((num_packets = ring_->readable(&packets)) > 0)
+  {
+    if (sample_ring_latency_)
+      sampleRingLatency();
+    last_packet_time_ = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_packets; ++i)
+    {
+      if (reorder_)
+      {
+        reorder_->push(packets[i], ReorderBuffer::Clock::now());
+        while (addReordered())
+          publishScan();
+      }
+      else if (addPacket(packets[i]))
       {
-        use_next_packet = false;
+        publishScan();
       }
     }
-    prev_packet_first_azm_phased = packet_first_azm_phased;
+    ring_->pop(num_packets);
   }
+  // packets held back past their delay, when no more arrived
+  while (reorder_ && addReordered())
+    publishScan();
+}
 
+/** add a packet to the scan being assembled
+ *
+ *  A scan ends at the first data block past scan_phase.  When that
+ *  block is inside the packet, the packet ends this scan and also
+ *  starts the next one, and first_block/end_block tell the converter
+ *  which of its blocks belong to which scan.
+ *
+ *  @returns true if the packet completes a scan, which publishScan
+ *           then publishes
+ */
+bool VelodyneDriverCore::addPacket(const velodyne_msgs::msg::VelodynePacket & packet)
+{
+  // resize the pool if the sensor changed its return mode, once the
+  // new factory bytes held for a few packets
+  uint8_t packet_rmode = packet.data[1204];
+  uint8_t packet_sensor_model = packet.data[1205];
+  if (packet_rmode == seen_packet_rmode_ && packet_sensor_model == seen_packet_sensor_model_)
+  {
+    seen_packet_repeats_ = std::min(seen_packet_repeats_ + 1, FACTORY_BYTES_REPEATS);
+  }
+  else
+  {
+    seen_packet_rmode_ = packet_rmode;
+    seen_packet_sensor_model_ = packet_sensor_model;
+    seen_packet_repeats_ = 1;
+  }
+  if (seen_packet_repeats_ == FACTORY_BYTES_REPEATS &&
+      (packet_rmode != curr_packet_rmode_ || packet_sensor_model != curr_packet_sensor_model_))
+  {
+    curr_packet_rmode_ = packet_rmode;
+    curr_packet_sensor_model_ = packet_sensor_model;
+
+    // the sensor knows its model better than the configuration
+    const char * detected_model = get_model_param(packet_sensor_model);
+    double packet_rate;
+    std::string full_name;
+    if (detected_model != NULL && config_.model != detected_model &&
+        get_model_info(detected_model, &packet_rate, &full_name))
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "model parameter is %s, but the sensor is a %s, using its packet rate",
+                  config_.model.c_str(), full_name.c_str());
+      config_.model = detected_model;
+      packets_per_rev_ = packet_rate / (config_.rpm / 60.0);
+    }
+    const int rmode_multiplier = get_rmode_multiplier(packet_sensor_model, packet_rmode);
+    if (get_model_info(config_.model, &packet_rate, &full_name))
+      monitor_->setPacketRate(packet_rate * rmode_multiplier);
+    packets_per_scan_ = expectedPacketsPerScan(rmode_multiplier);
+    RCLCPP_DEBUG(node_ptr_->get_logger(), "Expecting %zu packets per scan.", packets_per_scan_);
+    if (scan_)
+      scan_->packets.reserve(packets_per_scan_);
+  }
+
+  const int blocks = get_azimuth_blocks(packet_sensor_model, packet_rmode);
+  monitor_->check(packet, blocks);
+
+  // find the first block whose azimuth wrapped around past scan_phase
+  uint16_t phase = (uint16_t)round(config_.scan_phase*100);
+  int cut_block = -1;
+  for (int block = 0; block < blocks; ++block)
+  {
+    uint16_t azimuth = packet.data[block * SIZE_BLOCK + 2];   // lower byte
+    azimuth |= packet.data[block * SIZE_BLOCK + 3] << 8;     // higher byte
+    uint16_t azimuth_phased = (36000 + azimuth - phase) % 36000;
+    if (cut_block < 0 && have_prev_block_ && azimuth_phased < prev_block_azm_phased_)
+      cut_block = block;
+    prev_block_azm_phased_ = azimuth_phased;
+    have_prev_block_ = true;
+  }
+
+  // blocks inside the view window, a packet without any is dropped
+  const uint32_t mask = viewMask(packet, blocks);
+  if (mask == 0)
+  {
+    view_packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+    view_bytes_saved_.fetch_add(packet.data.size() + sizeof(packet.stamp),
+                                std::memory_order_relaxed);
+  }
+
+  if (!scan_)
+    scan_ = acquireScan();
+  if (cut_block < 0 || (cut_block == 0 && scan_->packets.empty()))
+  {
+    if (mask != 0)
+    {
+      scan_->packets.push_back(packet);
+      blankBlocks(scan_->packets.back(), blocks, mask);
+    }
+    return false;
+  }
+
+  // the packet past the phase starts the next scan
+  if (cut_block > 0 && mask != 0)
+  {
+    scan_->packets.push_back(packet);
+    blankBlocks(scan_->packets.back(), blocks, mask);
+    scan_->end_block = cut_block;
+  }
+  monitor_->endScan();
+  if (scan_->packets.empty())
+  {
+    // nothing of this scan was inside the view
+    scan_->first_block = 0;
+    scan_->end_block = 0;
+    if (mask != 0)
+    {
+      scan_->first_block = cut_block;
+      scan_->packets.push_back(packet);
+      blankBlocks(scan_->packets.back(), blocks, mask);
+    }
+    return false;
+  }
+  done_scan_ = std::move(scan_);
+  scan_ = acquireScan();
+  if (mask != 0)
+  {
+    scan_->first_block = cut_block;
+    scan_->packets.push_back(packet);
+    blankBlocks(scan_->packets.back(), blocks, mask);
+  }
+  return true;
+}
+
+/** set the view window from the converter style view parameters
+ *
+ *  @param view_direction center of the view (rad)
+ *  @param view_width width of the view (rad), 0 or 2 pi and more for all
+ */
+void VelodyneDriverCore::setViewWindow(double view_direction, double view_width)
+{
+  // RawData::setParameters takes an empty view for the full one
+  if (view_width <= 0)
+    view_width = 2 * M_PI;
+
+  // device azimuths turn clockwise, so the window starts at the
+  // left edge of the view, as in RawData::setParameters
+  double left = fmod(fmod(view_direction + view_width / 2, 2 * M_PI) + 2 * M_PI, 2 * M_PI);
+  int start = static_cast<int>(100 * (2 * M_PI - left) * 180 / M_PI + 0.5);
+  int width = static_cast<int>(100 * view_width * 180 / M_PI + 0.5);
+  start = ((start - VIEW_MARGIN) % ROTATION_MAX_UNITS + ROTATION_MAX_UNITS) % ROTATION_MAX_UNITS;
+  width = std::max(0, std::min(width + 2 * VIEW_MARGIN, ROTATION_MAX_UNITS));
+  view_window_.store(start | (width << 16), std::memory_order_relaxed);
+  if (width < ROTATION_MAX_UNITS)
+    RCLCPP_INFO(node_ptr_->get_logger(), "Publishing azimuths %.2f to %.2f degrees",
+                start / 100.0, ((start + width) % ROTATION_MAX_UNITS) / 100.0);
+}
+
+/** @returns bit mask of the blocks inside the view window */
+uint32_t VelodyneDriverCore::viewMask(const velodyne_msgs::msg::VelodynePacket & packet,
+                                      int blocks) const
+{
+  const uint32_t window = view_window_.load(std::memory_order_relaxed);
+  const int start = window & 0xFFFF;
+  const int width = window >> 16;
+  const uint32_t all = (1u << blocks) - 1;
+  if (width >= ROTATION_MAX_UNITS)
+    return all;
+
+  uint32_t mask = 0;
+  for (int block = 0; block < blocks; ++block)
+  {
+    int azimuth = packet.data[block * SIZE_BLOCK + 2] | (packet.data[block * SIZE_BLOCK + 3] << 8);
+    if ((azimuth - start + ROTATION_MAX_UNITS) % ROTATION_MAX_UNITS <= width)
+      mask |= 1u << block;
+  }
+  return mask;
+}
+
+/** clear the returns of the blocks outside the view window
+ *
+ *  The block headers and azimuths stay, the converter needs them to
+ *  interpolate the azimuths of the neighbouring blocks.  Packets of
+ *  models whose blank returns would still decode to points are kept
+ *  whole; only those entirely outside the view are dropped.
+ */
+void VelodyneDriverCore::blankBlocks(velodyne_msgs::msg::VelodynePacket & packet,
+                                     int blocks, uint32_t mask)
+{
+  const uint32_t all = (1u << blocks) - 1;
+  if (mask == all || !can_blank_blocks(packet.data[1205]))
+    return;
+  for (int block = 0; block < blocks; ++block)
+  {
+    if (!(mask & (1u << block)))
+      memset(&packet.data[block * SIZE_BLOCK + 4], 0, SIZE_BLOCK - 4);
+  }
+  view_blocks_blanked_.fetch_add(blocks - __builtin_popcount(mask), std::memory_order_relaxed);
+}
+
+/** publish the assembled scan, or queue it for publishQueued */
+void VelodyneDriverCore::publishScan(void)
+{
+  if (publish_queue_depth_ == 0)
+  {
+    sendScan(std::move(done_scan_));
+    return;
+  }
+
+  std::unique_ptr<velodyne_msgs::msg::VelodyneScan> dropped;
+  {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    if (publish_queue_.size() >= publish_queue_depth_)
+    {
+      dropped = std::move(publish_queue_.front());
+      publish_queue_.pop_front();
+    }
+    publish_queue_.push_back(std::move(done_scan_));
+  }
+  publish_cond_.notify_one();
+  if (dropped)
+  {
+    publish_dropped_.fetch_add(1, std::memory_order_relaxed);
+    RCLCPP_WARN_THROTTLE(node_ptr_->get_logger(), *node_ptr_->get_clock(), 1000 /* ms */,
+                         "Publishing is falling behind, dropped %lu scans.",
+                         (unsigned long) publish_dropped_.load(std::memory_order_relaxed));
+    releaseScan(std::move(dropped));
+  }
+}
+
+/** publish the next queued scan
+ *
+ *  For a thread of its own, so a slow publish does not hold up the
+ *  thread receiving and assembling the packets.
+ *
+ *  @returns false once stopPublishing was called
+ */
+bool VelodyneDriverCore::publishQueued(std::chrono::microseconds timeout)
+{
+  std::unique_ptr<velodyne_msgs::msg::VelodyneScan> scan;
+  {
+    std::unique_lock<std::mutex> lock(publish_mutex_);
+    publish_cond_.wait_for(lock, timeout,
+                           [this] {return publish_stopped_ || !publish_queue_.empty();});
+    if (publish_stopped_)
+      return false;
+    if (publish_queue_.empty())
+      return true;
+    scan = std::move(publish_queue_.front());
+    publish_queue_.pop_front();
+  }
+  sendScan(std::move(scan));
+  return true;
+}
+
+/** wake publishQueued for shutdown; queued scans are not published */
+void VelodyneDriverCore::stopPublishing(void)
+{
+  {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    publish_stopped_ = true;
+  }
+  publish_cond_.notify_all();
+}
+
+/** publish a scan and account for it in the diagnostics */
+void VelodyneDriverCore::sendScan(std::unique_ptr<velodyne_msgs::msg::VelodyneScan> scan)
+{
   // average the time stamp from first package and last package
   rclcpp::Time firstTimeStamp = scan->packets.front().stamp;
   rclcpp::Time lastTimeStamp = scan->packets.back().stamp;
@@ -334,14 +935,337 @@ bool VelodyneDriverCore::poll(void)
   scan->header.stamp = scan->packets.front().stamp;
   // scan->scan->header.stamp = scan->packets[scan->packets.size()/2].stamp;
   scan->header.frame_id = config_.frame_id;
-  output_->publish(*scan);
+  rclcpp::Time stamp = scan->header.stamp;
+  const bool incomplete = scan->incomplete;
+  if (output_->get_intra_process_subscription_count() > 0)
+  {
+    // hand the message over, so intra-process subscribers get it
+    // without a copy; rclcpp frees it with the default deleter, so it
+    // does not return to scan_pool_ and the next scan is allocated
+    output_->publish(std::move(scan));
+  }
+  else
+  {
+    // only serialized by the middleware, so the message can be reused
+    output_->publish(*scan);
+    releaseScan(std::move(scan));
+  }
   // notify diagnostics that a message has been published, updating
   // its status
-  diag_topic_->tick(scan->header.stamp);
+  diag_topic_->tick(stamp);
+
+  if (measure_latency_ && !incomplete)
+  {
+    // the packet stamps include time_offset
+    const double latency = (node_ptr_->now() - lastTimeStamp).seconds() + config_.time_offset;
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    if (latency_samples_.size() < MAX_LATENCY_SAMPLES)
+      latency_samples_.push_back(latency);
+  }
+}
+
+/** record how long the oldest packet in the ring has waited */
+void VelodyneDriverCore::sampleRingLatency(void)
+{
+  sample_ring_latency_ = false;
+  const float wait = (PacketRing::now() - ring_->headPushTime()) * 1e-9f;
+  std::lock_guard<std::mutex> lock(latency_mutex_);
+  if (ring_latency_samples_.size() < MAX_LATENCY_SAMPLES)
+    ring_latency_samples_.push_back(wait);
+}
+
+/** expected number of packets in one scan
+ *
+ *  @param rmode_multiplier packets per firing, from get_rmode_multiplier
+ */
+size_t VelodyneDriverCore::expectedPacketsPerScan(int rmode_multiplier) const
+{
+  // leave room for the packet shared with the next scan and for
+  // small rpm variations
+  return static_cast<size_t>(std::ceil(packets_per_rev_ * rmode_multiplier * 1.05)) + 1;
+}
+
+/** get a scan message from the pool, reserved to the expected size */
+std::unique_ptr<velodyne_msgs::msg::VelodyneScan> VelodyneDriverCore::acquireScan()
+{
+  std::unique_ptr<velodyne_msgs::msg::VelodyneScan> scan;
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if (!scan_pool_.empty())
+    {
+      scan = std::move(scan_pool_.back());
+      scan_pool_.pop_back();
+    }
+  }
+  if (!scan)
+    scan.reset(new velodyne_msgs::msg::VelodyneScan);
+  scan->packets.reserve(packets_per_scan_);
+  scan->first_block = 0;
+  scan->end_block = 0;
+  scan->incomplete = false;
+  return scan;
+}
 
+/** return a scan message to the pool, keeping its storage */
+void VelodyneDriverCore::releaseScan(std::unique_ptr<velodyne_msgs::msg::VelodyneScan> scan)
+{
+  scan->packets.clear();
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  scan_pool_.push_back(std::move(scan));
+}
+
+/** fill the scan pool before the driver threads start
+ *
+ *  Touches the packet storage of the scans in flight at once, so
+ *  that with locked memory no page faults are taken while publishing.
+ *  A switch to dual return mode grows them once more.
+ */
+void VelodyneDriverCore::prefaultScans(void)
+{
+  // assembling, completed and being published
+  static const size_t SCANS_IN_FLIGHT = 3;
+  std::vector<std::unique_ptr<velodyne_msgs::msg::VelodyneScan>> scans;
+  for (size_t i = 0; i < SCANS_IN_FLIGHT; ++i)
+    {
+      scans.push_back(acquireScan());
+      scans.back()->packets.resize(packets_per_scan_);
+    }
+  for (auto & scan : scans)
+    releaseScan(std::move(scan));
+}
+
+/** read the device
+ *
+ * receive is used by the nodelet's receive thread, and hands packets
+ * to poll through the packet ring, so a slow publish never stalls the
+ * socket.
+ *  @returns true unless end of file reached
+ */
+bool VelodyneDriverCore::receive(void)
+{
+  velodyne_msgs::msg::VelodynePacket * slots;
+  size_t max_packets = std::min(ring_->writable(&slots), recv_batch_size_);
+  const bool full = (max_packets == 0);
+  if (full && !dump_file.empty())
+    {
+      // a file can wait for the consumer instead of losing packets,
+      // which matters when replaying faster than real time
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      return true;
+    }
+  if (full)
+    {
+      // keep draining the socket, but the packets have nowhere to go
+      slots = overflow_batch_.data();
+      max_packets = overflow_batch_.size();
+    }
+
+  size_t num_packets = 0;
+  int rc = input_->getPackets(slots, max_packets, &num_packets, config_.time_offset);
+  if (rc < 0)                 // end of file reached?
+    {
+      ring_->close();
+      return false;
+    }
+
+  // recorded even when the ring is full, the journal has its own buffers
+  if (journal_)
+    journal_->record(slots, num_packets, config_.time_offset);
+
+  if (full)
+    {
+      ring_->dropped(num_packets);
+      RCLCPP_WARN_THROTTLE(node_ptr_->get_logger(), *node_ptr_->get_clock(), 1000 /* ms */,
+                           "Packet ring full, dropping packets.");
+    }
+  else
+    {
+      ring_->push(num_packets);
+    }
   return true;
 }
 
+/** stop handing packets to poll
+ *
+ * poll returns false once the packets already received are used up.
+ */
+void VelodyneDriverCore::stopReceiving(void)
+{
+  ring_->close();
+}
+
+void VelodyneDriverCore::ringDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat)
+{
+  const uint64_t overflows = ring_->overflows();
+  stat.add("capacity", ring_->capacity());
+  stat.add("high water mark", ring_->highWaterMark());
+  stat.add("overflow packets", overflows);
+  if (overflows > 0)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN, "Packet ring has overflowed");
+  else
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "Packet ring OK");
+}
+
+void VelodyneDriverCore::journalDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat)
+{
+  const uint64_t dropped = journal_->packetsDropped();
+  const std::string error = journal_->error();
+  stat.add("packets recorded", journal_->packetsRecorded());
+  stat.add("packets dropped", dropped);
+  stat.add("bytes written", journal_->bytesWritten());
+  stat.add("segments", journal_->segments());
+  stat.add("preallocated", journal_->preallocating());
+  if (!error.empty())
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::ERROR, error);
+  else if (dropped > 0)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN,
+                 "Journal could not keep up, packets were not recorded");
+  else
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "Journal OK");
+}
+
+void VelodyneDriverCore::inputDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat)
+{
+  const auto now = std::chrono::steady_clock::now();
+  const double elapsed = std::chrono::duration<double>(now - diag_last_time_).count();
+  const uint64_t packets = input_->packetsReceived();
+  const uint64_t bytes = input_->bytesReceived();
+  const uint64_t drops = input_->kernelDrops();
+
+  // the kernel drop counter is 32 bits and wraps
+  const uint32_t new_drops = static_cast<uint32_t>(drops - diag_last_drops_);
+  if (elapsed > 0.0)
+    {
+      stat.add("packets per second", (packets - diag_last_packets_) / elapsed);
+      stat.add("bytes per second", (bytes - diag_last_bytes_) / elapsed);
+      stat.add("kernel drops per second", new_drops / elapsed);
+    }
+  stat.add("packets received", packets);
+  stat.add("packets rejected", input_->packetsRejected());
+  if (input_->kernelFilter())
+    stat.add("kernel filter rejects", input_->filterRejects());
+  stat.add("kernel drops", drops);
+
+  if (new_drops > 0)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN, "Kernel is dropping packets");
+  else
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "No kernel drops");
+
+  diag_last_time_ = now;
+  diag_last_packets_ = packets;
+  diag_last_bytes_ = bytes;
+  diag_last_drops_ = drops;
+}
+
+void VelodyneDriverCore::integrityDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat)
+{
+  const PacketMonitor::Counts scan = monitor_->lastScan();
+  const PacketMonitor::Counts totals = monitor_->totals();
+  stat.add("lost packets in last scan", scan.lost);
+  stat.add("reordered packets in last scan", scan.reordered);
+  stat.add("duplicate packets in last scan", scan.duplicate);
+  stat.add("corrupt packets in last scan", scan.corrupt);
+  stat.add("lost packets", totals.lost);
+  stat.add("reordered packets", totals.reordered);
+  stat.add("duplicate packets", totals.duplicate);
+  stat.add("corrupt packets", totals.corrupt);
+  if (reorder_)
+  {
+    // reordering undone before the checks above
+    stat.add("packets re-sequenced", reorder_->reordered());
+    stat.add("late packets dropped", reorder_->late());
+  }
+
+  if (totals.corrupt > diag_last_integrity_.corrupt)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN, "Corrupt packets received");
+  else if (totals.lost > diag_last_integrity_.lost)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN, "Packets lost");
+  else if (totals.reordered > diag_last_integrity_.reordered ||
+           totals.duplicate > diag_last_integrity_.duplicate)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN, "Packets out of sequence");
+  else
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "Packet sequence OK");
+
+  diag_last_integrity_ = totals;
+}
+
+void VelodyneDriverCore::viewDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat)
+{
+  const uint32_t window = view_window_.load(std::memory_order_relaxed);
+  stat.add("packets dropped", view_packets_dropped_.load(std::memory_order_relaxed));
+  stat.add("blocks blanked", view_blocks_blanked_.load(std::memory_order_relaxed));
+  stat.add("bytes saved", view_bytes_saved_.load(std::memory_order_relaxed));
+  if ((int) (window >> 16) >= ROTATION_MAX_UNITS)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "Full view published");
+  else
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "Partial view published");
+}
+
+/** add the p50, p99 and max of latency samples (s) to a status
+ *
+ *  @returns the max, 0 without samples
+ */
+static float addLatencyStats(diagnostic_updater::DiagnosticStatusWrapper & stat,
+                             std::vector<float> & samples, const std::string & name)
+{
+  if (samples.empty())
+    return 0.0f;
+  std::sort(samples.begin(), samples.end());
+  const float p50 = samples[samples.size() / 2];
+  const float p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+  const float max = samples.back();
+  stat.add("samples", samples.size());
+  stat.add("p50 " + name + " (ms)", p50 * 1e3);
+  stat.add("p99 " + name + " (ms)", p99 * 1e3);
+  stat.add("max " + name + " (ms)", max * 1e3);
+  return max;
+}
+
+void VelodyneDriverCore::latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat)
+{
+  std::vector<float> samples;
+  {
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    samples.swap(latency_samples_);
+    latency_samples_.reserve(MAX_LATENCY_SAMPLES);
+  }
+  if (samples.empty())
+  {
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "No scans published");
+    return;
+  }
+  const float max = addLatencyStats(stat, samples, "latency");
+
+  // falling behind by a whole scan means the device thread is starved
+  const double scan_period = 60.0 / config_.rpm;
+  if (max > scan_period)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN, "Publishing fell behind by a scan");
+  else
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "Publish latency OK");
+}
+
+void VelodyneDriverCore::ringLatencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat)
+{
+  std::vector<float> samples;
+  {
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    samples.swap(ring_latency_samples_);
+    ring_latency_samples_.reserve(MAX_LATENCY_SAMPLES);
+  }
+  if (samples.empty())
+  {
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "No packets read");
+    return;
+  }
+  const float max = addLatencyStats(stat, samples, "wait");
+
+  const double scan_period = 60.0 / config_.rpm;
+  if (max > scan_period)
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::WARN, "Device thread fell behind by a scan");
+  else
+    stat.summary(diagnostic_msgs::msg::DiagnosticStatus::OK, "Device thread keeps up");
+}
+
 rcl_interfaces::msg::SetParametersResult VelodyneDriverCore::paramCallback(const std::vector<rclcpp::Parameter> & p)
 {
   RCLCPP_INFO(node_ptr_->get_logger(), "Reconfigure Request");
@@ -352,6 +1276,11 @@ rcl_interfaces::msg::SetParametersResult VelodyneDriverCore::paramCallback(const
   if (get_param(p, "scan_phase", config_.scan_phase)) {
     RCLCPP_DEBUG(node_ptr_->get_logger(), "Setting scan_phase to: %f.", config_.scan_phase);
   }
+  bool view_changed = get_param(p, "view_direction", config_.view_direction);
+  view_changed = get_param(p, "view_width", config_.view_width) || view_changed;
+  if (view_changed) {
+    setViewWindow(config_.view_direction, config_.view_width);
+  }
 
   rcl_interfaces::msg::SetParametersResult result;
   result.successful = true;
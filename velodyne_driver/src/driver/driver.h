@@ -16,13 +16,23 @@
 #ifndef _VELODYNE_DRIVER_H_
 #define _VELODYNE_DRIVER_H_ 1
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <rclcpp/rclcpp.hpp>
 #include <diagnostic_updater/diagnostic_updater.hpp>
 #include <diagnostic_updater/publisher.hpp>
 #include <velodyne_msgs/msg/velodyne_scan.hpp>
 
 #include <velodyne_driver/input.h>
+#include <velodyne_driver/packet_journal.h>
+
+#include "packet_monitor.h"
+#include "packet_ring.h"
+#include "reorder_buffer.h"
 
 namespace velodyne_driver
 {
@@ -35,9 +45,67 @@ public:
   ~VelodyneDriverCore() {}
 
   bool poll(void);
+  bool receive(void);
+  void stopReceiving(void);
+  void processReceived(void);
+  void checkStall(void);
+  std::chrono::microseconds timeUntilCheck(std::chrono::steady_clock::time_point now) const;
+
+  /** input descriptor to wait on, or -1 if the input is not pollable */
+  int fileDescriptor() const {return input_->fileDescriptor();}
+
+  /** have receive return at once instead of waiting for the input */
+  void setNonBlocking(bool nonblocking) {input_->setNonBlocking(nonblocking);}
+
+  void prefaultScans(void);
+
+  /** queue completed scans for publishQueued instead of publishing them
+   *
+   *  @param depth scans queued at most, the oldest is dropped beyond
+   */
+  void setPublishQueue(size_t depth) {publish_queue_depth_ = depth;}
+  bool publishQueued(std::chrono::microseconds timeout);
+  void stopPublishing(void);
 
 private:
 
+  bool addPacket(const velodyne_msgs::msg::VelodynePacket & packet);
+  bool addReordered(void);
+  bool stallTimedOut(std::chrono::steady_clock::time_point now) const;
+  bool stalled(std::chrono::steady_clock::time_point now);
+  std::chrono::microseconds timeUntilStall(std::chrono::steady_clock::time_point now) const;
+  void setViewWindow(double view_direction, double view_width);
+  uint32_t viewMask(const velodyne_msgs::msg::VelodynePacket & packet, int blocks) const;
+  void blankBlocks(velodyne_msgs::msg::VelodynePacket & packet, int blocks, uint32_t mask);
+  void publishScan(void);
+  void sendScan(std::unique_ptr<velodyne_msgs::msg::VelodyneScan> scan);
+
+  size_t expectedPacketsPerScan(int rmode_multiplier) const;
+  std::unique_ptr<velodyne_msgs::msg::VelodyneScan> acquireScan();
+  void releaseScan(std::unique_ptr<velodyne_msgs::msg::VelodyneScan> scan);
+
+  /** diagnostics of the receive thread to scan assembler ring */
+  void ringDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+
+  /** diagnostics of the input: packet, byte and kernel drop rates */
+  void inputDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+
+  /** diagnostics of the packet sequence: lost, reordered, duplicate, corrupt */
+  void integrityDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+
+  /** diagnostics of the packets and blocks outside the view window */
+  void viewDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+
+  /** diagnostics of the time from receiving a scan's last packet to publishing it */
+  void latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+
+  /** diagnostics of the time packets wait in the ring for the device thread */
+  void ringLatencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+  void sampleRingLatency(void);
+
+  /** diagnostics of the raw packet journal */
+  void journalDiagnostics(diagnostic_updater::DiagnosticStatusWrapper & stat);
+
   // opinter to node for loggers and clocks
   rclcpp::Node * node_ptr_;
 
@@ -55,9 +123,29 @@ private:
     double rpm;                      ///< device rotation rate (RPMs)
     double scan_phase;               ///< scan phase (degrees)
     double time_offset;              ///< time in seconds added to each velodyne time stamp
+    double view_direction;           ///< center of the published view (rad)
+    double view_width;               ///< width of the published view (rad)
   } config_;
 
+  // view window in device azimuth units, start | width << 16, with
+  // a width of ROTATION_MAX_UNITS or more when disabled
+  std::atomic<uint32_t> view_window_;
+  std::atomic<uint64_t> view_packets_dropped_;
+  std::atomic<uint64_t> view_blocks_blanked_;
+  std::atomic<uint64_t> view_bytes_saved_;
+
   std::shared_ptr<Input> input_;
+
+  // packets read by the receive thread, waiting for scan assembly
+  std::shared_ptr<PacketRing> ring_;
+  size_t recv_batch_size_;
+  // scratch space for packets read while the ring is full
+  std::vector<velodyne_msgs::msg::VelodynePacket> overflow_batch_;
+  // re-sequences packets before scan assembly, NULL when disabled
+  std::unique_ptr<ReorderBuffer> reorder_;
+  // records every packet received, NULL when disabled
+  std::unique_ptr<PacketJournal> journal_;
+
   rclcpp::Publisher<velodyne_msgs::msg::VelodyneScan>::SharedPtr output_;
 
   /** diagnostics updater */
@@ -66,9 +154,59 @@ private:
   double diag_max_freq_;
   std::shared_ptr<diagnostic_updater::TopicDiagnostic> diag_topic_;
 
-  // uint8_t  curr_packet_rmode; //    [strongest return or farthest mode => Singular Retruns per firing]
-                              // or [Both  => Dual Retruns per fire]
-  // uint8_t  curr_packet_sensor_model; // extract the sensor id from packet
+  // input counters at the previous diagnostics update
+  std::chrono::steady_clock::time_point diag_last_time_;
+  uint64_t diag_last_packets_;
+  uint64_t diag_last_bytes_;
+  uint64_t diag_last_drops_;
+
+  // sequence checks of the packets added to scans
+  std::unique_ptr<PacketMonitor> monitor_;
+  PacketMonitor::Counts diag_last_integrity_;
+
+  // publish latencies (s) since the previous diagnostics update
+  bool measure_latency_;
+  std::mutex latency_mutex_;
+  std::vector<float> latency_samples_;
+  // waits (s) in the ring of the first packet read after each wakeup,
+  // which is the scheduling delay of the device thread
+  bool sample_ring_latency_;
+  std::vector<float> ring_latency_samples_;   ///< guarded by latency_mutex_
+
+  // scan being assembled, carried over while waiting for packets
+  std::unique_ptr<velodyne_msgs::msg::VelodyneScan> scan_;
+  // scan completed by addPacket, waiting for publishScan
+  std::unique_ptr<velodyne_msgs::msg::VelodyneScan> done_scan_;
+  bool have_prev_block_;
+  // a partial scan is published once no packet came for stall_timeout_
+  std::chrono::steady_clock::duration stall_timeout_;
+  std::chrono::steady_clock::time_point last_packet_time_;   ///< taken from the ring
+  uint16_t prev_block_azm_phased_;     ///< phased azimuth of the last block seen
+
+  // recycled scan messages, pre-reserved to packets_per_scan_; only
+  // scans published by reference come back, one handed to intra-process
+  // subscribers is theirs, and the next acquireScan() allocates anew
+  std::vector<std::unique_ptr<velodyne_msgs::msg::VelodyneScan>> scan_pool_;
+  std::mutex pool_mutex_;              ///< scans come back on the publish thread
+
+  // completed scans waiting for publishQueued, when publish_queue_depth_ > 0
+  size_t publish_queue_depth_;
+  std::mutex publish_mutex_;
+  std::condition_variable publish_cond_;
+  std::deque<std::unique_ptr<velodyne_msgs::msg::VelodyneScan>> publish_queue_;
+  bool publish_stopped_;               ///< guarded by publish_mutex_
+  std::atomic<uint64_t> publish_dropped_;
+  double packets_per_rev_;             ///< single return packets per revolution
+  size_t packets_per_scan_;            ///< packets reserved in each scan
+
+  uint8_t  curr_packet_rmode_; //    [strongest return or farthest mode => Singular Retruns per firing]
+                               // or [Both  => Dual Retruns per fire]
+  uint8_t  curr_packet_sensor_model_; // extract the sensor id from packet
+  // factory bytes of the latest packets, bound to the curr_packet_*
+  // values once they repeat; an HDL-64E sends status bytes there instead
+  uint8_t  seen_packet_rmode_;
+  uint8_t  seen_packet_sensor_model_;
+  int      seen_packet_repeats_;
   std::string dump_file; // string to hold pcap file name
 };
 
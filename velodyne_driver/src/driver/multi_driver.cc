@@ -0,0 +1,351 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  ROS driver component for several Velodyne 3D LIDARs in one process
+ *
+ *  The "sensors" parameter names the devices.  Each one gets a child
+ *  node in a sub-namespace of the same name, configured from the
+ *  parameters prefixed with its name (e.g. "front.port",
+ *  "front.device_ip"), and publishes its own velodyne_packets topic.
+ *  All sockets are served by a few event threads instead of two
+ *  threads per sensor.  The event threads only assemble the scans;
+ *  each sensor publishes them from a thread of its own, so a slow
+ *  subscriber cannot hold up the sockets of the other sensors.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+#include <velodyne_driver/realtime.h>
+
+#include "driver.h"
+
+namespace velodyne_driver
+{
+
+// scans waiting for a sensor's publish thread, the oldest is dropped beyond
+static const size_t PUBLISH_QUEUE_DEPTH = 2;
+
+class VelodyneMultiDriver: public rclcpp::Node
+{
+public:
+
+  VelodyneMultiDriver(const rclcpp::NodeOptions & options)
+  : Node("velodyne_multi_driver_node", options),
+    running_(false)
+  {
+    onInit();
+  }
+
+  ~VelodyneMultiDriver()
+  {
+    if (running_)
+      {
+        RCLCPP_INFO(this->get_logger(), "shutting down driver threads");
+        running_ = false;
+      }
+    for (auto & loop : loops_)
+      {
+        // wake the thread from epoll_wait()
+        uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) < 0)
+          RCLCPP_WARN(this->get_logger(), "could not wake event thread: %s", strerror(errno));
+      }
+    for (auto & loop : loops_)
+      {
+        if (loop->thread.joinable())
+          loop->thread.join();
+        close(loop->epoll_fd);
+        close(loop->wake_fd);
+      }
+    for (auto & sensor : sensors_)
+      {
+        sensor->dvr->stopPublishing();
+        if (sensor->publish_thread.joinable())
+          sensor->publish_thread.join();
+      }
+    if (executor_)
+      executor_->cancel();
+    if (spinThread_.joinable())
+      spinThread_.join();
+    RCLCPP_INFO(this->get_logger(), "driver threads stopped");
+  }
+
+private:
+
+  /** one device, with its own node, socket and scan assembly */
+  struct Sensor
+  {
+    std::string name;
+    rclcpp::Node::SharedPtr node;
+    std::unique_ptr<VelodyneDriverCore> dvr;
+    std::thread publish_thread;         ///< publishes the scans the event thread queues
+  };
+
+  /** thread waiting on the sockets of some of the sensors */
+  struct EventLoop
+  {
+    int epoll_fd;
+    int wake_fd;                        ///< eventfd, written at shutdown
+    std::thread thread;
+    std::vector<Sensor *> sensors;      ///< sensors watched by this thread
+  };
+
+  void onInit(void);
+  std::vector<rclcpp::Parameter> sensorParameters(const std::string & name) const;
+  void eventLoop(EventLoop * loop);
+  void publishLoop(Sensor * sensor);
+
+  std::atomic<bool> running_;           ///< event threads are running
+  std::vector<std::unique_ptr<Sensor>> sensors_;
+  std::vector<std::unique_ptr<EventLoop>> loops_;
+  ThreadPolicy eventPolicy_;
+
+  /** serves parameters and diagnostics of the sensor nodes */
+  rclcpp::executors::SingleThreadedExecutor::SharedPtr executor_;
+  std::thread spinThread_;
+};
+
+/** parameter overrides of one sensor, with its prefix removed */
+std::vector<rclcpp::Parameter>
+VelodyneMultiDriver::sensorParameters(const std::string & name) const
+{
+  const std::string prefix = name + ".";
+  std::vector<rclcpp::Parameter> params;
+  for (const auto & item : get_node_parameters_interface()->get_parameter_overrides())
+  {
+    if (item.first.compare(0, prefix.size(), prefix) == 0)
+      params.emplace_back(item.first.substr(prefix.size()), item.second);
+  }
+  return params;
+}
+
+void VelodyneMultiDriver::onInit()
+{
+  std::vector<std::string> names =
+    declare_parameter("sensors", std::vector<std::string>());
+  int event_threads = declare_parameter("event_threads", 1);
+  eventPolicy_ = declareThreadPolicy(this, "event_thread");
+  bool lock_memory = declare_parameter("lock_memory", false);
+  if (names.empty())
+  {
+    RCLCPP_ERROR(get_logger(), "no sensors configured, set the sensors parameter");
+    return;
+  }
+
+  // find the ports several sensors share
+  std::vector<std::vector<rclcpp::Parameter>> params;
+  std::map<int64_t, int> port_users;
+  for (const std::string & name : names)
+  {
+    params.push_back(sensorParameters(name));
+    int64_t port = DATA_PORT_NUMBER;
+    for (const rclcpp::Parameter & param : params.back())
+    {
+      if (param.get_name() == "port")
+        port = param.as_int();
+    }
+    port_users[port]++;
+  }
+
+  std::string ns = get_namespace();
+  if (ns.empty() || ns.back() != '/')
+    ns += "/";
+
+  for (size_t i = 0; i < names.size(); ++i)
+  {
+    const std::string & name = names[i];
+    bool has_pcap = false;
+    bool has_device_ip = false;
+    bool has_reuse_port = false;
+    int64_t port = DATA_PORT_NUMBER;
+    for (const rclcpp::Parameter & param : params[i])
+    {
+      if (param.get_name() == "pcap")
+        has_pcap = !param.as_string().empty();
+      else if (param.get_name() == "device_ip")
+        has_device_ip = !param.as_string().empty();
+      else if (param.get_name() == "socket_reuse_port")
+        has_reuse_port = true;
+      else if (param.get_name() == "port")
+        port = param.as_int();
+    }
+    if (has_pcap)
+    {
+      RCLCPP_ERROR(get_logger(), "sensor %s: PCAP replay needs its own driver node, skipped",
+                   name.c_str());
+      continue;
+    }
+    if (port_users[port] > 1)
+    {
+      // sensors sharing a port are told apart by their address
+      if (!has_device_ip)
+        RCLCPP_WARN(get_logger(), "sensor %s shares port %ld, but has no device_ip",
+                    name.c_str(), (long) port);
+      if (!has_reuse_port)
+        params[i].emplace_back("socket_reuse_port", true);
+    }
+
+    std::unique_ptr<Sensor> sensor(new Sensor());
+    sensor->name = name;
+    sensor->node = std::make_shared<rclcpp::Node>(
+      get_name(), ns + name,
+      rclcpp::NodeOptions()
+      .context(get_node_base_interface()->get_context())
+      .use_global_arguments(false)
+      .use_intra_process_comms(get_node_options().use_intra_process_comms())
+      .parameter_overrides(params[i]));
+    sensor->dvr.reset(new VelodyneDriverCore(sensor->node.get()));
+    sensor->dvr->setNonBlocking(true);
+    sensor->dvr->setPublishQueue(PUBLISH_QUEUE_DEPTH);
+    if (sensor->dvr->fileDescriptor() < 0)
+    {
+      RCLCPP_ERROR(get_logger(), "sensor %s: could not open its input, skipped", name.c_str());
+      continue;
+    }
+    sensors_.push_back(std::move(sensor));
+  }
+  if (sensors_.empty())
+    return;
+
+  if (lock_memory && lockMemory(get_logger()))
+  {
+    for (auto & sensor : sensors_)
+      sensor->dvr->prefaultScans();
+  }
+
+  // spread the sensors over the event threads
+  size_t num_loops = std::min(sensors_.size(), (size_t) std::max(event_threads, 1));
+  for (size_t i = 0; i < num_loops; ++i)
+  {
+    std::unique_ptr<EventLoop> loop(new EventLoop());
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (loop->epoll_fd < 0 || loop->wake_fd < 0)
+    {
+      RCLCPP_ERROR(get_logger(), "could not create event thread: %s", strerror(errno));
+      if (loop->epoll_fd >= 0)
+        close(loop->epoll_fd);
+      if (loop->wake_fd >= 0)
+        close(loop->wake_fd);
+      return;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;              // wake_fd
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event);
+    loops_.push_back(std::move(loop));
+  }
+  for (size_t i = 0; i < sensors_.size(); ++i)
+  {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = sensors_[i].get();
+    if (epoll_ctl(loops_[i % num_loops]->epoll_fd, EPOLL_CTL_ADD,
+                  sensors_[i]->dvr->fileDescriptor(), &event) < 0)
+    {
+      RCLCPP_ERROR(get_logger(), "sensor %s: could not watch its socket: %s",
+                   sensors_[i]->name.c_str(), strerror(errno));
+      continue;
+    }
+    loops_[i % num_loops]->sensors.push_back(sensors_[i].get());
+  }
+  RCLCPP_INFO(get_logger(), "serving %zu sensors from %zu event threads",
+              sensors_.size(), num_loops);
+
+  executor_ = std::make_shared<rclcpp::executors::SingleThreadedExecutor>();
+  for (auto & sensor : sensors_)
+    executor_->add_node(sensor->node);
+  spinThread_ = std::thread([this] {executor_->spin();});
+
+  running_ = true;
+  for (auto & sensor : sensors_)
+    sensor->publish_thread = std::thread(&VelodyneMultiDriver::publishLoop, this, sensor.get());
+  for (auto & loop : loops_)
+    loop->thread = std::thread(&VelodyneMultiDriver::eventLoop, this, loop.get());
+}
+
+/** @brief Publish thread main loop of one sensor.
+ *
+ *  Serializing a scan or a slow subscriber then only delays that
+ *  sensor's scans, never the sockets of the sensors sharing its event
+ *  thread.
+ */
+void VelodyneMultiDriver::publishLoop(Sensor * sensor)
+{
+  while (rclcpp::ok() && running_)
+  {
+    if (!sensor->dvr->publishQueued(std::chrono::milliseconds(100)))
+      break;
+  }
+}
+
+/** @brief Event thread main loop.
+ *
+ *  Level-triggered: each wakeup reads one batch per ready socket, so a
+ *  busy sensor cannot starve the others sharing the thread.
+ */
+void VelodyneMultiDriver::eventLoop(EventLoop * loop)
+{
+  applyThreadPolicy(eventPolicy_, "velodyne_event", get_logger());
+
+  static const int MAX_EVENTS = 16;
+  epoll_event events[MAX_EVENTS];
+
+  while (rclcpp::ok() && running_)
+  {
+    // wake up when a sensor has held packets due or a partial scan
+    // stalls, rounded up to the millisecond epoll_wait counts in
+    const auto now = std::chrono::steady_clock::now();
+    std::chrono::microseconds timeout = std::chrono::milliseconds(100);
+    for (Sensor * sensor : loop->sensors)
+      timeout = std::min(timeout, sensor->dvr->timeUntilCheck(now));
+    const int timeout_ms = static_cast<int>((timeout.count() + 999) / 1000);
+
+    int nevents = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (nevents < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      RCLCPP_ERROR(get_logger(), "epoll_wait() error: %s", strerror(errno));
+      break;
+    }
+    for (int i = 0; i < nevents; ++i)
+    {
+      Sensor * sensor = static_cast<Sensor *>(events[i].data.ptr);
+      if (sensor == NULL)
+        return;                         // woken for shutdown
+      if (events[i].events & EPOLLERR)
+        RCLCPP_WARN(sensor->node->get_logger(), "socket error on %s", sensor->name.c_str());
+      sensor->dvr->receive();
+      sensor->dvr->processReceived();
+    }
+    for (Sensor * sensor : loop->sensors)
+      sensor->dvr->checkStall();
+  }
+}
+
+} // namespace velodyne_driver
+
+#include <rclcpp_components/register_node_macro.hpp>
+
+RCLCPP_COMPONENTS_REGISTER_NODE(velodyne_driver::VelodyneMultiDriver)
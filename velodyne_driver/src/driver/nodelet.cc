@@ -15,6 +15,7 @@
 #include <thread>
 
 #include <rclcpp/rclcpp.hpp>
+#include <velodyne_driver/realtime.h>
 // #include <pluginlib/class_list_macros.h>
 // #include <nodelet/nodelet.h>
 
@@ -38,31 +39,52 @@ public:
   {
     if (running_)
       {
-        RCLCPP_INFO(this->get_logger(), "shutting down driver thread");
+        RCLCPP_INFO(this->get_logger(), "shutting down driver threads");
         running_ = false;
-        deviceThread_->join();
-        RCLCPP_INFO(this->get_logger(), "driver thread stopped");
       }
+    if (receiveThread_ && receiveThread_->joinable())
+      receiveThread_->join();
+    if (deviceThread_ && deviceThread_->joinable())
+      deviceThread_->join();
+    RCLCPP_INFO(this->get_logger(), "driver threads stopped");
   }
 
 private:
 
   virtual void onInit(void);
   virtual void devicePoll(void);
+  virtual void receivePoll(void);
 
-  volatile bool running_;               ///< device thread is running
-  std::shared_ptr<std::thread> deviceThread_;
+  volatile bool running_;               ///< device threads are running
+  std::shared_ptr<std::thread> deviceThread_;  ///< assembles and publishes scans
+  std::shared_ptr<std::thread> receiveThread_; ///< reads packets from the input
 
   std::shared_ptr<VelodyneDriverCore> dvr_; ///< driver implementation class
+
+  ThreadPolicy receivePolicy_;
+  ThreadPolicy devicePolicy_;
 };
 
 void VelodyneDriver::onInit()
 {
+  // scheduling of the driver threads
+  receivePolicy_ = declareThreadPolicy(this, "receive_thread");
+  devicePolicy_ = declareThreadPolicy(this, "device_thread");
+  bool lock_memory = declare_parameter("lock_memory", false);
+
   // start the driver
   dvr_.reset(new VelodyneDriverCore(this));
 
-  // spawn device poll thread
+  if (lock_memory && lockMemory(get_logger()))
+    {
+      // fault in the scan messages now, instead of while publishing
+      dvr_->prefaultScans();
+    }
+
+  // spawn receive and device poll threads
   running_ = true;
+  receiveThread_ = std::shared_ptr< std::thread >
+    (new std::thread(std::bind(&VelodyneDriver::receivePoll, this)));
   deviceThread_ = std::shared_ptr< std::thread >
     (new std::thread(std::bind(&VelodyneDriver::devicePoll, this)));
 }
@@ -70,16 +92,30 @@ void VelodyneDriver::onInit()
 /** @brief Device poll thread main loop. */
 void VelodyneDriver::devicePoll()
 {
-  while(rclcpp::ok())
+  applyThreadPolicy(devicePolicy_, "velodyne_device", get_logger());
+  while(rclcpp::ok() && running_)
   {
     // poll device until end of file
-    running_ = dvr_->poll();
-    if (!running_)
+    if (!dvr_->poll())
       break;
   }
   running_ = false;
 }
 
+/** @brief Receive thread main loop. */
+void VelodyneDriver::receivePoll()
+{
+  applyThreadPolicy(receivePolicy_, "velodyne_recv", get_logger());
+  while(rclcpp::ok() && running_)
+  {
+    // read device until end of file
+    if (!dvr_->receive())
+      break;
+  }
+  // let the device thread drain the ring and stop
+  dvr_->stopReceiving();
+}
+
 } // namespace velodyne_driver
 
 #include <rclcpp_components/register_node_macro.hpp>
@@ -0,0 +1,247 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Packet stream monitor implementation.
+ */
+
+#include <math.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "packet_monitor.h"
+
+namespace velodyne_driver
+{
+
+static const int SIZE_BLOCK = 100;              // bytes per data block
+static const int TIMESTAMP_OFFSET = 1200;       // GPS timestamp, little-endian
+
+static const int64_t HOUR_US = 3600000000LL;
+// stamps further apart mean the sensor or the replay restarted
+static const int64_t RESYNC_US = 1000000;
+
+PacketMonitor::PacketMonitor(double packet_rate)
+: period_us_(packet_rate > 0.0 ? 1e6 / packet_rate : 1000.0),
+  learn_deltas_(),
+  learned_(0),
+  have_prev_(false),
+  prev_stamp_(0),
+  prev_azimuth_(0),
+  scan_(),
+  totals_(),
+  last_scan_()
+{
+}
+
+void PacketMonitor::setPacketRate(double packet_rate)
+{
+  if (packet_rate > 0.0)
+    period_us_ = 1e6 / packet_rate;
+  learned_ = 0;
+}
+
+/** @returns flag and bank byte of a block, as a little-endian word */
+static inline uint16_t headerWord(const uint8_t * data, int block)
+{
+  return data[block * SIZE_BLOCK] | (data[block * SIZE_BLOCK + 1] << 8);
+}
+
+#if defined(__SSE2__)
+/** @returns all ones in the lanes holding a valid header word */
+static inline __m128i validWords(__m128i words)
+{
+  const __m128i upper = _mm_or_si128(_mm_cmpeq_epi16(words, _mm_set1_epi16((short) 0xEEFF)),
+                                     _mm_cmpeq_epi16(words, _mm_set1_epi16((short) 0xDDFF)));
+  const __m128i lower = _mm_or_si128(_mm_cmpeq_epi16(words, _mm_set1_epi16((short) 0xCCFF)),
+                                     _mm_cmpeq_epi16(words, _mm_set1_epi16((short) 0xBBFF)));
+  return _mm_or_si128(upper, lower);
+}
+#elif defined(__aarch64__)
+/** @returns all ones in the lanes holding a valid header word */
+static inline uint16x8_t validWords(uint16x8_t words)
+{
+  const uint16x8_t upper = vorrq_u16(vceqq_u16(words, vdupq_n_u16(0xEEFF)),
+                                     vceqq_u16(words, vdupq_n_u16(0xDDFF)));
+  const uint16x8_t lower = vorrq_u16(vceqq_u16(words, vdupq_n_u16(0xCCFF)),
+                                     vceqq_u16(words, vdupq_n_u16(0xBBFF)));
+  return vorrq_u16(upper, lower);
+}
+#endif
+
+/** @brief Check the flag of all data blocks at once.
+ *
+ *  A block starts with 0xFF and a bank byte of 0xEE, 0xDD, 0xCC or
+ *  0xBB.  The headers are 100 bytes apart, so they are gathered into
+ *  two vectors of eight words, blocks 0-7 and 8-11, and compared with
+ *  the four valid words together, without branching.
+ *
+ *  @param blocks number of blocks in use, from the start of the packet
+ */
+bool PacketMonitor::validHeaders(const uint8_t * data, int blocks)
+{
+  // all twelve headers are inside the packet, those of blocks not in
+  // use are gathered but masked off
+#if defined(__SSE2__)
+  // pinsrw takes its lane as an immediate, hence the unrolled gather
+  __m128i low = _mm_setzero_si128();
+  low = _mm_insert_epi16(low, headerWord(data, 0), 0);
+  low = _mm_insert_epi16(low, headerWord(data, 1), 1);
+  low = _mm_insert_epi16(low, headerWord(data, 2), 2);
+  low = _mm_insert_epi16(low, headerWord(data, 3), 3);
+  low = _mm_insert_epi16(low, headerWord(data, 4), 4);
+  low = _mm_insert_epi16(low, headerWord(data, 5), 5);
+  low = _mm_insert_epi16(low, headerWord(data, 6), 6);
+  low = _mm_insert_epi16(low, headerWord(data, 7), 7);
+  __m128i high = _mm_setzero_si128();
+  high = _mm_insert_epi16(high, headerWord(data, 8), 0);
+  high = _mm_insert_epi16(high, headerWord(data, 9), 1);
+  high = _mm_insert_epi16(high, headerWord(data, 10), 2);
+  high = _mm_insert_epi16(high, headerWord(data, 11), 3);
+
+  const __m128i lane = _mm_set_epi16(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m128i used_low = _mm_cmplt_epi16(lane, _mm_set1_epi16(blocks));
+  const __m128i used_high = _mm_cmplt_epi16(lane, _mm_set1_epi16(blocks - 8));
+  const __m128i bad = _mm_or_si128(_mm_andnot_si128(validWords(low), used_low),
+                                   _mm_andnot_si128(validWords(high), used_high));
+  return _mm_movemask_epi8(bad) == 0;
+#elif defined(__aarch64__)
+  uint16x8_t low = vdupq_n_u16(0);
+  low = vsetq_lane_u16(headerWord(data, 0), low, 0);
+  low = vsetq_lane_u16(headerWord(data, 1), low, 1);
+  low = vsetq_lane_u16(headerWord(data, 2), low, 2);
+  low = vsetq_lane_u16(headerWord(data, 3), low, 3);
+  low = vsetq_lane_u16(headerWord(data, 4), low, 4);
+  low = vsetq_lane_u16(headerWord(data, 5), low, 5);
+  low = vsetq_lane_u16(headerWord(data, 6), low, 6);
+  low = vsetq_lane_u16(headerWord(data, 7), low, 7);
+  uint16x8_t high = vdupq_n_u16(0);
+  high = vsetq_lane_u16(headerWord(data, 8), high, 0);
+  high = vsetq_lane_u16(headerWord(data, 9), high, 1);
+  high = vsetq_lane_u16(headerWord(data, 10), high, 2);
+  high = vsetq_lane_u16(headerWord(data, 11), high, 3);
+
+  static const uint16_t LANES[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  const uint16x8_t lane = vld1q_u16(LANES);
+  const uint16x8_t used_low = vcltq_u16(lane, vdupq_n_u16(std::max(blocks, 0)));
+  const uint16x8_t used_high = vcltq_u16(lane, vdupq_n_u16(std::max(blocks - 8, 0)));
+  // vbicq(a, b) is a & ~b
+  const uint16x8_t bad = vorrq_u16(vbicq_u16(used_low, validWords(low)),
+                                   vbicq_u16(used_high, validWords(high)));
+  return vmaxvq_u16(bad) == 0;
+#else
+  uint32_t bad = 0;
+  for (int block = 0; block < blocks; ++block)
+  {
+    const uint8_t flag = data[block * SIZE_BLOCK];
+    const uint8_t bank = data[block * SIZE_BLOCK + 1] - 0xBB;  // 0x00, 0x11, 0x22 or 0x33
+    bad |= (flag ^ 0xFFu) | (uint32_t) (bank > 0x33) | ((bank >> 4) ^ (bank & 0x0F));
+  }
+  return bad == 0;
+#endif
+}
+
+void PacketMonitor::check(const velodyne_msgs::msg::VelodynePacket & packet, int blocks)
+{
+  const uint8_t * data = &packet.data[0];
+  if (!validHeaders(data, blocks))
+  {
+    // nothing in it can be trusted, including its stamp
+    ++scan_.corrupt;
+    return;
+  }
+
+  const uint32_t stamp = data[TIMESTAMP_OFFSET] | (data[TIMESTAMP_OFFSET + 1] << 8) |
+    (data[TIMESTAMP_OFFSET + 2] << 16) | ((uint32_t) data[TIMESTAMP_OFFSET + 3] << 24);
+  const uint16_t azimuth = data[2] | (data[3] << 8);
+  if (!have_prev_)
+  {
+    have_prev_ = true;
+    prev_stamp_ = stamp;
+    prev_azimuth_ = azimuth;
+    return;
+  }
+
+  // the stamp wraps at the top of the hour
+  int64_t delta = (int64_t) stamp - prev_stamp_;
+  if (delta < -HOUR_US / 2)
+    delta += HOUR_US;
+  else if (delta > HOUR_US / 2)
+    delta -= HOUR_US;
+
+  if (delta == 0 && azimuth == prev_azimuth_)
+  {
+    ++scan_.duplicate;
+    return;
+  }
+  if (delta <= 0 && delta > -RESYNC_US)
+  {
+    // a late packet, already counted as lost when its successor came
+    ++scan_.reordered;
+    if (scan_.lost > 0)
+      --scan_.lost;
+    return;
+  }
+
+  if (delta > 0 && delta <= RESYNC_US)
+  {
+    if (learned_ < LEARN_DELTAS)
+    {
+      // the adaptation below only follows small changes, so start
+      // from the median interval, which the odd lost packet does not move
+      learn_deltas_[learned_++] = delta;
+      if (learned_ == LEARN_DELTAS)
+      {
+        std::nth_element(learn_deltas_, learn_deltas_ + LEARN_DELTAS / 2,
+                         learn_deltas_ + LEARN_DELTAS);
+        period_us_ = learn_deltas_[LEARN_DELTAS / 2];
+      }
+    }
+    else if (delta > 1.5 * period_us_)
+    {
+      scan_.lost += llround(delta / period_us_) - 1;
+    }
+    else
+    {
+      // follow the actual rate, which depends on the return mode
+      period_us_ += (delta - period_us_) / 64.0;
+    }
+  }
+  prev_stamp_ = stamp;
+  prev_azimuth_ = azimuth;
+}
+
+void PacketMonitor::endScan()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  totals_.lost += scan_.lost;
+  totals_.reordered += scan_.reordered;
+  totals_.duplicate += scan_.duplicate;
+  totals_.corrupt += scan_.corrupt;
+  last_scan_ = scan_;
+  scan_ = Counts();
+}
+
+PacketMonitor::Counts PacketMonitor::totals() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return totals_;
+}
+
+PacketMonitor::Counts PacketMonitor::lastScan() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return last_scan_;
+}
+
+} // namespace velodyne_driver
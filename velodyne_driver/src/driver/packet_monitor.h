@@ -0,0 +1,93 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Sequence and integrity checks of the raw Velodyne packet stream.
+ */
+
+#ifndef _VELODYNE_PACKET_MONITOR_H_
+#define _VELODYNE_PACKET_MONITOR_H_ 1
+
+#include <stdint.h>
+
+#include <mutex>
+
+#include <velodyne_msgs/msg/velodyne_packet.hpp>
+
+namespace velodyne_driver
+{
+
+/** @brief Counts lost, reordered, duplicate and corrupt packets.
+ *
+ *  Packets are sequenced by the sensor's microseconds-past-the-hour
+ *  timestamp, with the azimuth telling duplicates from packets that
+ *  merely share a stamp.  check() must be called by one thread, in
+ *  arrival order; the counts may be read from any thread.
+ */
+class PacketMonitor
+{
+public:
+
+  struct Counts
+  {
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t duplicate;
+    uint64_t corrupt;                   ///< invalid block headers
+  };
+
+  /** @param packet_rate expected packets per second */
+  explicit PacketMonitor(double packet_rate);
+
+  /** @brief Restart learning the packet interval at a new rate.
+   *
+   *  Called by the checking thread when the sensor model or return
+   *  mode changed.
+   */
+  void setPacketRate(double packet_rate);
+
+  /** @brief Check the next packet received.
+   *
+   *  @param blocks number of data blocks in use
+   */
+  void check(const velodyne_msgs::msg::VelodynePacket & packet, int blocks);
+
+  /** @brief Close the counts of the current scan. */
+  void endScan();
+
+  /** @returns counts since the driver started */
+  Counts totals() const;
+
+  /** @returns counts of the last complete scan */
+  Counts lastScan() const;
+
+  static bool validHeaders(const uint8_t * data, int blocks);
+
+private:
+
+  // intervals whose median replaces the expected one before losses
+  // are counted, so a wrong model or return mode does not hide them
+  static const int LEARN_DELTAS = 15;
+
+  double period_us_;                    ///< learned packet interval
+  int64_t learn_deltas_[LEARN_DELTAS];
+  int learned_;                         ///< intervals in learn_deltas_
+  bool have_prev_;
+  uint32_t prev_stamp_;                 ///< microseconds past the hour
+  uint16_t prev_azimuth_;
+
+  Counts scan_;                         ///< current scan, checking thread only
+
+  mutable std::mutex mutex_;            ///< guards totals_ and last_scan_
+  Counts totals_;
+  Counts last_scan_;
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_PACKET_MONITOR_H_
@@ -0,0 +1,131 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Single-producer/single-consumer packet ring implementation.
+ */
+
+#include <time.h>
+
+#include <algorithm>
+
+#include "packet_ring.h"
+
+namespace velodyne_driver
+{
+
+PacketRing::PacketRing(size_t capacity)
+: head_(0),
+  tail_(0),
+  high_water_mark_(0),
+  overflows_(0),
+  closed_(false),
+  consumer_waiting_(false)
+{
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  packets_.resize(size);
+  push_times_.resize(size);
+  mask_ = size - 1;
+}
+
+size_t PacketRing::writable(velodyne_msgs::msg::VelodynePacket **first)
+{
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  const size_t head = head_.load(std::memory_order_acquire);
+  const size_t index = tail & mask_;
+  *first = &packets_[index];
+
+  // free space, limited to the end of the storage
+  return std::min(packets_.size() - (tail - head), packets_.size() - index);
+}
+
+void PacketRing::push(size_t count)
+{
+  if (count == 0)
+    return;
+
+  // one stamp for the batch, which arrived together
+  const int64_t stamp = now();
+  const size_t first = tail_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < count; ++i)
+    push_times_[(first + i) & mask_] = stamp;
+
+  const size_t tail = first + count;
+  tail_.store(tail, std::memory_order_release);
+
+  const size_t used = tail - head_.load(std::memory_order_relaxed);
+  if (used > high_water_mark_.load(std::memory_order_relaxed))
+    high_water_mark_.store(used, std::memory_order_relaxed);
+
+  notify();
+}
+
+void PacketRing::dropped(size_t count)
+{
+  overflows_.fetch_add(count, std::memory_order_relaxed);
+}
+
+void PacketRing::close()
+{
+  closed_.store(true);
+  notify();
+}
+
+size_t PacketRing::readable(velodyne_msgs::msg::VelodynePacket **first)
+{
+  const size_t head = head_.load(std::memory_order_relaxed);
+  const size_t tail = tail_.load(std::memory_order_acquire);
+  const size_t index = head & mask_;
+  *first = &packets_[index];
+
+  return std::min(tail - head, packets_.size() - index);
+}
+
+void PacketRing::pop(size_t count)
+{
+  head_.store(head_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+int64_t PacketRing::headPushTime() const
+{
+  return push_times_[head_.load(std::memory_order_relaxed) & mask_];
+}
+
+int64_t PacketRing::now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void PacketRing::waitForPackets(std::chrono::microseconds timeout)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  consumer_waiting_.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  ready_.wait_for(lock, timeout, [this] {
+    return closed_.load() ||
+           tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_relaxed);
+  });
+  consumer_waiting_.store(false);
+}
+
+void PacketRing::notify()
+{
+  // Order the tail update before the check, so a consumer which has
+  // just found the ring empty is always woken.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (consumer_waiting_.load())
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ready_.notify_one();
+    }
+}
+
+} // namespace velodyne_driver
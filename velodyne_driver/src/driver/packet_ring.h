@@ -0,0 +1,114 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Single-producer/single-consumer ring of raw Velodyne packets,
+ *  passing packets from the receive thread to the scan assembler.
+ */
+
+#ifndef _VELODYNE_PACKET_RING_H_
+#define _VELODYNE_PACKET_RING_H_ 1
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <velodyne_msgs/msg/velodyne_packet.hpp>
+
+namespace velodyne_driver
+{
+
+/** @brief Preallocated lock-free packet queue.
+ *
+ *  Exactly one thread may call the producer methods (writable(),
+ *  push(), dropped(), close()) and exactly one other thread the
+ *  consumer methods (readable(), pop(), waitForPackets()).  The
+ *  consumer only takes a lock when it has to sleep on an empty ring.
+ */
+class PacketRing
+{
+public:
+
+  /** @param capacity number of packets, rounded up to a power of two */
+  explicit PacketRing(size_t capacity);
+
+  /** @brief Contiguous free slots at the tail.
+   *
+   *  @param first set to the first free slot
+   *  @returns number of packets that may be written at first
+   */
+  size_t writable(velodyne_msgs::msg::VelodynePacket **first);
+
+  /** @brief Publish count packets written at the tail. */
+  void push(size_t count);
+
+  /** @brief Account for count packets that did not fit. */
+  void dropped(size_t count);
+
+  /** @brief Mark the end of input; wakes the consumer. */
+  void close();
+
+  /** @brief Contiguous filled slots at the head.
+   *
+   *  @param first set to the oldest packet
+   *  @returns number of packets that may be read at first
+   */
+  size_t readable(velodyne_msgs::msg::VelodynePacket **first);
+
+  /** @brief Release count packets at the head. */
+  void pop(size_t count);
+
+  /** @returns when the oldest packet was pushed, in now() nanoseconds;
+   *  only meaningful while readable() is not 0
+   */
+  int64_t headPushTime() const;
+
+  /** @returns CLOCK_MONOTONIC time in nanoseconds */
+  static int64_t now();
+
+  /** @brief Sleep until packets are available, the ring is closed
+   *         or the timeout expires. */
+  void waitForPackets(std::chrono::microseconds timeout);
+
+  bool closed() const {return closed_.load();}
+  size_t capacity() const {return packets_.size();}
+  size_t highWaterMark() const {return high_water_mark_.load(std::memory_order_relaxed);}
+  uint64_t overflows() const {return overflows_.load(std::memory_order_relaxed);}
+
+private:
+
+  void notify();
+
+  std::vector<velodyne_msgs::msg::VelodynePacket> packets_;
+  std::vector<int64_t> push_times_;     ///< now() at push, per slot
+  size_t mask_;
+
+  // keep the producer and consumer indices on separate cache lines
+  char pad0_[64];
+  std::atomic<size_t> head_;            ///< next packet to read
+  char pad1_[64];
+  std::atomic<size_t> tail_;            ///< next slot to write
+  char pad2_[64];
+
+  std::atomic<size_t> high_water_mark_;
+  std::atomic<uint64_t> overflows_;
+  std::atomic<bool> closed_;
+
+  // only used while the consumer sleeps on an empty ring
+  std::atomic<bool> consumer_waiting_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_PACKET_RING_H_
@@ -0,0 +1,126 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Packet reorder window implementation.
+ */
+
+#include <algorithm>
+
+#include "reorder_buffer.h"
+
+namespace velodyne_driver
+{
+
+static const int TIMESTAMP_OFFSET = 1200;       // GPS timestamp, little-endian
+static const int64_t HOUR_US = 3600000000LL;
+// stamps further apart mean the sensor or the replay restarted
+static const int64_t RESYNC_US = 1000000;
+
+ReorderBuffer::ReorderBuffer(size_t depth, std::chrono::microseconds max_delay)
+: depth_(depth),
+  max_delay_(max_delay),
+  flushing_(false),
+  packets_(depth + 1),
+  have_released_(false),
+  released_stamp_(0),
+  reordered_(0),
+  late_(0)
+{
+  free_slots_.reserve(packets_.size());
+  for (size_t slot = packets_.size(); slot > 0; --slot)
+    free_slots_.push_back(slot - 1);
+  entries_.reserve(packets_.size());
+}
+
+/** @returns a - b, taking the wrap at the top of the hour into account */
+int64_t ReorderBuffer::stampDelta(uint32_t a, uint32_t b)
+{
+  int64_t delta = (int64_t) a - b;
+  if (delta < -HOUR_US / 2)
+    delta += HOUR_US;
+  else if (delta > HOUR_US / 2)
+    delta -= HOUR_US;
+  return delta;
+}
+
+void ReorderBuffer::push(const velodyne_msgs::msg::VelodynePacket & packet,
+                         Clock::time_point now)
+{
+  const uint8_t * data = &packet.data[TIMESTAMP_OFFSET];
+  Entry entry;
+  entry.stamp = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+  entry.due = now + max_delay_;
+
+  if (have_released_)
+  {
+    const int64_t delta = stampDelta(entry.stamp, released_stamp_);
+    if (delta <= 0 && delta > -RESYNC_US)
+    {
+      // too late to put in sequence
+      late_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  // the stamps mostly come in order, so search from the newest
+  size_t pos = entries_.size();
+  while (pos > 0)
+  {
+    const int64_t delta = stampDelta(entry.stamp, entries_[pos - 1].stamp);
+    if (delta >= 0 || delta <= -RESYNC_US)
+      break;
+    --pos;
+  }
+  if (pos < entries_.size())
+    reordered_.fetch_add(1, std::memory_order_relaxed);
+
+  entry.slot = free_slots_.back();
+  free_slots_.pop_back();
+  packets_[entry.slot] = packet;
+  entries_.insert(entries_.begin() + pos, entry);
+}
+
+const velodyne_msgs::msg::VelodynePacket * ReorderBuffer::ready(Clock::time_point now)
+{
+  if (entries_.empty())
+    return NULL;
+  if (flushing_ || entries_.size() > depth_)
+    return &packets_[entries_.front().slot];
+
+  // a packet inserted ahead of older ones inherits their deadline
+  for (const Entry & entry : entries_)
+  {
+    if (entry.due <= now)
+      return &packets_[entries_.front().slot];
+  }
+  return NULL;
+}
+
+void ReorderBuffer::pop()
+{
+  have_released_ = true;
+  released_stamp_ = entries_.front().stamp;
+  free_slots_.push_back(entries_.front().slot);
+  entries_.erase(entries_.begin());
+  if (entries_.empty())
+    flushing_ = false;
+}
+
+std::chrono::microseconds ReorderBuffer::timeUntilDue(Clock::time_point now) const
+{
+  if (entries_.empty())
+    return max_delay_;
+  Clock::time_point due = entries_.front().due;
+  for (const Entry & entry : entries_)
+    due = std::min(due, entry.due);
+  if (due <= now)
+    return std::chrono::microseconds(0);
+  return std::chrono::duration_cast<std::chrono::microseconds>(due - now);
+}
+
+} // namespace velodyne_driver
@@ -0,0 +1,104 @@
+/* -*- mode: C++ -*- */
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Small window re-sequencing raw Velodyne packets by their GPS
+ *  timestamp before scan assembly.
+ */
+
+#ifndef _VELODYNE_REORDER_BUFFER_H_
+#define _VELODYNE_REORDER_BUFFER_H_ 1
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include <velodyne_msgs/msg/velodyne_packet.hpp>
+
+namespace velodyne_driver
+{
+
+/** @brief Bounded reorder window.
+ *
+ *  Packets are held sorted by the sensor's microseconds-past-the-hour
+ *  stamp, and released oldest first once more than depth packets are
+ *  held, or when any of them has waited max_delay.  A packet arriving
+ *  after a newer one was released can no longer be put in sequence
+ *  and is dropped, as it would end the scan being assembled.
+ *
+ *  Only the counters may be read from another thread.
+ */
+class ReorderBuffer
+{
+public:
+
+  typedef std::chrono::steady_clock Clock;
+
+  /** @param depth packets held back
+   *  @param max_delay longest a packet is held back
+   */
+  ReorderBuffer(size_t depth, std::chrono::microseconds max_delay);
+
+  /** @brief Add a received packet, copying it.
+   *
+   *  Release the packets ready() returns before pushing the next one,
+   *  there is room for only one packet more than depth.
+   */
+  void push(const velodyne_msgs::msg::VelodynePacket & packet, Clock::time_point now);
+
+  /** @returns the oldest packet if it is due at now, else NULL */
+  const velodyne_msgs::msg::VelodynePacket * ready(Clock::time_point now);
+
+  /** @brief Release the packet returned by ready(). */
+  void pop();
+
+  /** @brief Make all packets held due, at the end of input. */
+  void flush() {flushing_ = !entries_.empty();}
+
+  bool empty() const {return entries_.empty();}
+
+  /** @returns time until the oldest packet is due, if any */
+  std::chrono::microseconds timeUntilDue(Clock::time_point now) const;
+
+  /** @returns packets put back in sequence */
+  uint64_t reordered() const {return reordered_.load(std::memory_order_relaxed);}
+
+  /** @returns packets dropped for arriving after a newer one was released */
+  uint64_t late() const {return late_.load(std::memory_order_relaxed);}
+
+private:
+
+  struct Entry
+  {
+    uint32_t stamp;                     ///< microseconds past the hour
+    Clock::time_point due;
+    size_t slot;                        ///< index into packets_
+  };
+
+  static int64_t stampDelta(uint32_t a, uint32_t b);
+
+  size_t depth_;
+  std::chrono::microseconds max_delay_;
+  bool flushing_;
+
+  std::vector<velodyne_msgs::msg::VelodynePacket> packets_;
+  std::vector<size_t> free_slots_;
+  std::vector<Entry> entries_;          ///< oldest stamp first
+
+  bool have_released_;
+  uint32_t released_stamp_;             ///< stamp of the last packet released
+
+  std::atomic<uint64_t> reordered_;
+  std::atomic<uint64_t> late_;
+};
+
+} // namespace velodyne_driver
+
+#endif // _VELODYNE_REORDER_BUFFER_H_
@@ -23,22 +23,34 @@
  */
 
 #include <unistd.h>
+#include <time.h>
 #include <string>
 #include <sstream>
+#include <algorithm>
 #include <sys/socket.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <poll.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <linux/filter.h>
 #include <velodyne_driver/input.h>
 #include <velodyne_driver/time_conversion.hpp>
 
+#ifndef UDP_GRO
+#define UDP_GRO 104                     // linux/udp.h, not in older libcs
+#endif
+
 namespace velodyne_driver
 {
   static const size_t packet_size =
     sizeof(velodyne_msgs::msg::VelodynePacket().data);
 
+  // largest datagram the kernel hands back when UDP_GRO is enabled
+  static const size_t gro_buffer_size = 65535;
+  static const size_t control_buffer_size = 256;
+
   ////////////////////////////////////////////////////////////////////////
   // Input base class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -50,8 +62,17 @@ namespace velodyne_driver
    */
   Input::Input(rclcpp::Node * node_ptr, uint16_t port):
     node_ptr_(node_ptr),
-    port_(port)
+    port_(port),
+    packets_received_(0),
+    bytes_received_(0),
+    kernel_drops_(0),
+    packets_rejected_(0),
+    filter_rejects_(0),
+    kernel_filter_(false)
   {
+    // Only packets from this address are used.  The data socket is
+    // connected to it, so the kernel discards datagrams from any other
+    // address before they are queued; they show up in no counter.
     devip_str_ = node_ptr_->declare_parameter("device_ip", std::string(""));
     sensor_timestamp_ = node_ptr_->declare_parameter("sensor_timestamp", false);
     if (!devip_str_.empty())
@@ -59,6 +80,45 @@ namespace velodyne_driver
                       << devip_str_);
   }
 
+  /** @brief Add to the receive counters. */
+  void Input::countPackets(uint64_t packets, uint64_t bytes)
+  {
+    // only the reading thread writes, so no read-modify-write is needed
+    packets_received_.store(packets_received_.load(std::memory_order_relaxed) + packets,
+                            std::memory_order_relaxed);
+    bytes_received_.store(bytes_received_.load(std::memory_order_relaxed) + bytes,
+                          std::memory_order_relaxed);
+  }
+
+  /** @brief Count datagrams the kernel filter refused. */
+  void Input::countFilterRejected(uint64_t packets)
+  {
+    filter_rejects_.store(filter_rejects_.load(std::memory_order_relaxed) + packets,
+                          std::memory_order_relaxed);
+  }
+
+  /** @brief Count datagrams refused for their size or sender. */
+  void Input::countRejected(uint64_t packets)
+  {
+    packets_rejected_.store(packets_rejected_.load(std::memory_order_relaxed) + packets,
+                            std::memory_order_relaxed);
+  }
+
+  /** @brief Get packets one at a time for sources that cannot batch. */
+  int Input::getPackets(velodyne_msgs::msg::VelodynePacket *pkts,
+                        size_t max_packets, size_t *num_packets,
+                        const double time_offset)
+  {
+    *num_packets = 0;
+    if (max_packets == 0)
+      return 1;
+
+    int rc = getPacket(&pkts[0], time_offset);
+    if (rc == 0)
+      *num_packets = 1;
+    return rc;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputSocket class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -69,10 +129,21 @@ namespace velodyne_driver
    *  @param port UDP port number
    */
   InputSocket::InputSocket(rclcpp::Node * node_ptr, uint16_t port):
-    Input(node_ptr, port)
+    Input(node_ptr, port),
+    nonblocking_(false),
+    gro_slot_(0),
+    gro_slots_(0),
+    gro_offset_(0)
   {
     sockfd_ = -1;
 
+    int receive_buffer_size = node_ptr_->declare_parameter("socket_receive_buffer", 0);
+    udp_gro_ = node_ptr_->declare_parameter("udp_gro", false);
+    kernel_timestamp_ = node_ptr_->declare_parameter("kernel_timestamp", false);
+    bool reuse_port = node_ptr_->declare_parameter("socket_reuse_port", false);
+    bool socket_filter = node_ptr_->declare_parameter("socket_filter", false);
+    int busy_poll_us = node_ptr_->declare_parameter("socket_busy_poll", 0);
+
     if (!devip_str_.empty()) {
       inet_aton(devip_str_.c_str(),&devip_);
     }
@@ -92,135 +163,549 @@ namespace velodyne_driver
     my_addr.sin_port = htons(port);          // port in network byte order
     my_addr.sin_addr.s_addr = INADDR_ANY;    // automatically fill in my IP
 
+    if (reuse_port)
+      {
+        // let sockets for other devices bind the same port
+        int enable = 1;
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0
+            || setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "SO_REUSEPORT not supported: %s",
+                        strerror(errno));
+          }
+      }
+
     if (bind(sockfd_, (sockaddr *)&my_addr, sizeof(sockaddr)) == -1)
       {
         perror("bind");                 // TODO: RCLCPP_ERROR errno
+        (void) close(sockfd_);
+        sockfd_ = -1;                   // callers check fileDescriptor()
         return;
       }
 
+    if (!devip_str_.empty())
+      {
+        // A connected socket only receives from its device (any
+        // source port), and the kernel prefers it over unconnected
+        // sockets on the same port.  Datagrams from other hosts are
+        // not queued, nor counted as drops.
+        sockaddr_in device_addr;
+        memset(&device_addr, 0, sizeof(device_addr));
+        device_addr.sin_family = AF_INET;
+        device_addr.sin_port = 0;
+        device_addr.sin_addr = devip_;
+        if (connect(sockfd_, (sockaddr *)&device_addr, sizeof(device_addr)) < 0)
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "Could not connect socket to %s: %s",
+                        devip_str_.c_str(), strerror(errno));
+          }
+      }
+
     if (fcntl(sockfd_,F_SETFL, O_NONBLOCK|FASYNC) < 0)
       {
         perror("non-block");
+        (void) close(sockfd_);
+        sockfd_ = -1;
         return;
       }
 
+    if (receive_buffer_size > 0)
+      {
+        // SO_RCVBUF is capped at net.core.rmem_max; SO_RCVBUFFORCE
+        // ignores the cap but needs CAP_NET_ADMIN.
+        setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF,
+                   &receive_buffer_size, sizeof(receive_buffer_size));
+        int actual_size = 0;
+        socklen_t option_len = sizeof(actual_size);
+        getsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &actual_size, &option_len);
+
+        // the kernel reports double the requested size for bookkeeping
+        if (actual_size < 2 * receive_buffer_size
+            && setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUFFORCE,
+                          &receive_buffer_size, sizeof(receive_buffer_size)) < 0)
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(),
+                        "Could not force socket receive buffer to %d bytes (%s), "
+                        "raise net.core.rmem_max", receive_buffer_size, strerror(errno));
+          }
+        option_len = sizeof(actual_size);
+        getsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &actual_size, &option_len);
+        RCLCPP_INFO(node_ptr_->get_logger(), "Socket receive buffer is %d bytes.", actual_size);
+      }
+
+    // report the kernel's drop counter with every datagram
+    int enable_overflow = 1;
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_RXQ_OVFL,
+                   &enable_overflow, sizeof(enable_overflow)) < 0)
+      {
+        RCLCPP_WARN(node_ptr_->get_logger(), "SO_RXQ_OVFL not supported: %s",
+                    strerror(errno));
+      }
+
+    if (kernel_timestamp_)
+      {
+        // Have the kernel stamp each datagram on arrival, instead of
+        // reading the clock after we get around to receiving it.
+        int enable = 1;
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0)
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "SO_TIMESTAMPNS not supported: %s",
+                        strerror(errno));
+            kernel_timestamp_ = false;
+          }
+        else
+          {
+            RCLCPP_INFO(node_ptr_->get_logger(), "Using kernel receive timestamps.");
+          }
+      }
+
+    if (udp_gro_)
+      {
+        // Let the kernel coalesce back-to-back datagrams from the
+        // sensor, so one recvmmsg() slot can carry dozens of packets.
+        int enable = 1;
+        if (setsockopt(sockfd_, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) < 0)
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "UDP_GRO not supported: %s",
+                        strerror(errno));
+            udp_gro_ = false;
+          }
+        else
+          {
+            RCLCPP_INFO(node_ptr_->get_logger(), "UDP_GRO enabled on data socket.");
+          }
+      }
+
+    if (busy_poll_us > 0)
+      {
+        // Spin on the NIC queue for up to busy_poll_us when the socket
+        // is empty, instead of waiting for the interrupt.  Values above
+        // net.core.busy_read need CAP_NET_ADMIN.
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_BUSY_POLL,
+                       &busy_poll_us, sizeof(busy_poll_us)) < 0)
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "SO_BUSY_POLL not supported: %s",
+                        strerror(errno));
+          }
+        else
+          {
+            RCLCPP_INFO(node_ptr_->get_logger(), "Busy polling the socket for %d us.",
+                        busy_poll_us);
+          }
+      }
+
+    if (socket_filter)
+      attachFilter();
+
     RCLCPP_DEBUG(node_ptr_->get_logger(), "Velodyne socket fd is %d\n", sockfd_);
   }
 
   /** @brief destructor */
   InputSocket::~InputSocket(void)
   {
-    (void) close(sockfd_);
+    if (sockfd_ != -1)
+      (void) close(sockfd_);
   }
 
   /** @brief Get one velodyne packet. */
   int InputSocket::getPacket(velodyne_msgs::msg::VelodynePacket *pkt, const double time_offset)
   {
-    double time1 = node_ptr_->now().seconds();
+    size_t num_packets;
+    return getPackets(pkt, 1, &num_packets, time_offset);
+  }
 
-    struct pollfd fds[1];
-    fds[0].fd = sockfd_;
-    fds[0].events = POLLIN;
-    static const int POLL_TIMEOUT = 1000; // one second (in msec)
+  /** @brief Get a batch of velodyne packets.
+   *
+   *  Reads every datagram already queued on the socket (up to
+   *  max_packets) with a single recvmmsg() call, and only falls back
+   *  to poll() when the socket is empty.
+   */
+  int InputSocket::getPackets(velodyne_msgs::msg::VelodynePacket *pkts,
+                              size_t max_packets, size_t *num_packets,
+                              const double time_offset)
+  {
+    *num_packets = 0;
+    if (max_packets == 0)
+      return 1;
 
-    sockaddr_in sender_address;
-    socklen_t sender_address_len = sizeof(sender_address);
+    // hand out coalesced packets left over from the previous call first
+    if (udp_gro_ && gro_slot_ < gro_slots_)
+      {
+        splitGroSegments(pkts, max_packets, num_packets, time_offset);
+        if (*num_packets > 0)
+          return 0;
+      }
+
+    resizeBatch(max_packets);
+    size_t slots = msgs_.size();
+    if (!udp_gro_)
+      {
+        // receive straight into the caller's messages
+        slots = std::min(slots, max_packets);
+        for (size_t i = 0; i < slots; ++i)
+          iovecs_[i].iov_base = &pkts[i].data[0];
+      }
 
     while (rclcpp::ok())
       {
-        // Unfortunately, the Linux kernel recvfrom() implementation
-        // uses a non-interruptible sleep() when waiting for data,
-        // which would cause this method to hang if the device is not
-        // providing data.  We poll() the device first to make sure
-        // the recvfrom() will not block.
-        //
-        // Note, however, that there is a known Linux kernel bug:
-        //
-        //   Under Linux, select() may report a socket file descriptor
-        //   as "ready for reading", while nevertheless a subsequent
-        //   read blocks.  This could for example happen when data has
-        //   arrived but upon examination has wrong checksum and is
-        //   discarded.  There may be other circumstances in which a
-        //   file descriptor is spuriously reported as ready.  Thus it
-        //   may be safer to use O_NONBLOCK on sockets that should not
-        //   block.
-
-        // poll() until input available
-        do
-          {
-            if(!rclcpp::ok())
-            {
-              RCLCPP_ERROR(node_ptr_->get_logger(), "poll() error: shutdown requested");
-              return 1;
-            }
-            int retval = poll(fds, 1, POLL_TIMEOUT);
-            if (retval < 0)             // poll() error?
-              {
-                if (errno != EINTR)
-                  RCLCPP_ERROR(node_ptr_->get_logger(), "poll() error: %s", strerror(errno));
-                return 1;
-              }
-            if (retval == 0)            // poll() timeout?
+        for (size_t i = 0; i < slots; ++i)
+          {
+            msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            msgs_[i].msg_hdr.msg_controllen = control_buffer_size;
+            msgs_[i].msg_hdr.msg_flags = 0;
+          }
+
+        int nmsgs = recvmmsg(sockfd_, msgs_.data(), slots, MSG_DONTWAIT, NULL);
+        if (nmsgs < 0)
+          {
+            if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
               {
-                RCLCPP_WARN(node_ptr_->get_logger(), "Velodyne poll() timeout");
+                perror("recvfail");
+                RCLCPP_INFO(node_ptr_->get_logger(), "recvfail");
                 return 1;
               }
-            if ((fds[0].revents & POLLERR)
-                || (fds[0].revents & POLLHUP)
-                || (fds[0].revents & POLLNVAL)) // device error?
+
+            // nothing queued: leave waiting to the caller's event loop
+            if (nonblocking_)
+              return 1;
+
+            // nothing queued: wait for the device
+            int rc = waitForInput();
+            if (rc != 0)
+              return rc;
+            continue;
+          }
+
+        // Without kernel timestamps every datagram in the batch gets
+        // the time the batch was read.
+        int64_t batch_time = kernel_timestamp_ ? 0 : node_ptr_->now().nanoseconds();
+        for (int i = 0; i < nmsgs; ++i)
+          {
+            receive_times_[i] = batch_time;
+            parseControlMessages(i);
+            if (receive_times_[i] == 0)
               {
-                RCLCPP_ERROR(node_ptr_->get_logger(), "poll() reports Velodyne error");
-                return 1;
+                // kernel did not stamp this datagram
+                if (batch_time == 0)
+                  batch_time = node_ptr_->now().nanoseconds();
+                receive_times_[i] = batch_time;
               }
-          } while ((fds[0].revents & POLLIN) == 0);
+          }
 
-        // Receive packets that should now be available from the
-        // socket using a blocking read.
-        ssize_t nbytes = recvfrom(sockfd_, &pkt->data[0],
-                                  packet_size,  0,
-                                  (sockaddr*) &sender_address,
-                                  &sender_address_len);
+        // count datagrams as sent, before they are split or filtered
+        uint64_t ndatagrams = 0;
+        uint64_t nbytes = 0;
+        for (int i = 0; i < nmsgs; ++i)
+          {
+            const size_t segment_size = std::max<size_t>(gro_segment_size_[i], 1);
+            ndatagrams += std::max<size_t>((msgs_[i].msg_len + segment_size - 1) / segment_size, 1);
+            nbytes += msgs_[i].msg_len;
+          }
+        countPackets(ndatagrams, nbytes);
 
-        if (nbytes < 0)
+        if (udp_gro_)
           {
-            if (errno != EWOULDBLOCK)
+            gro_slot_ = 0;
+            gro_slots_ = nmsgs;
+            gro_offset_ = 0;
+            splitGroSegments(pkts, max_packets, num_packets, time_offset);
+          }
+        else
+          {
+            // compact the accepted datagrams to the front of the array
+            for (int i = 0; i < nmsgs; ++i)
               {
-                perror("recvfail");
-                RCLCPP_INFO(node_ptr_->get_logger(), "recvfail");
-                return 1;
+                if (!acceptDatagram(i, msgs_[i].msg_len))
+                  continue;
+                if ((size_t) i != *num_packets)
+                  pkts[*num_packets].data = pkts[i].data;
+                stampPacket(&pkts[*num_packets], receive_times_[i], time_offset);
+                ++(*num_packets);
               }
           }
-        else if ((size_t) nbytes == packet_size)
+
+        if (*num_packets > 0)
+          return 0;
+      }
+
+    return 1;
+  }
+
+  /** @brief Block in poll() until the socket is readable.
+   *
+   *  @returns 0 when data is available, > 0 on timeout or error
+   */
+  int InputSocket::waitForInput()
+  {
+    struct pollfd fds[1];
+    fds[0].fd = sockfd_;
+    fds[0].events = POLLIN;
+    static const int POLL_TIMEOUT = 1000; // one second (in msec)
+
+    // Unfortunately, the Linux kernel recvfrom() implementation
+    // uses a non-interruptible sleep() when waiting for data,
+    // which would cause this method to hang if the device is not
+    // providing data.  We poll() the device first to make sure
+    // the recvfrom() will not block.
+    //
+    // Note, however, that there is a known Linux kernel bug:
+    //
+    //   Under Linux, select() may report a socket file descriptor
+    //   as "ready for reading", while nevertheless a subsequent
+    //   read blocks.  This could for example happen when data has
+    //   arrived but upon examination has wrong checksum and is
+    //   discarded.  There may be other circumstances in which a
+    //   file descriptor is spuriously reported as ready.  Thus it
+    //   may be safer to use O_NONBLOCK on sockets that should not
+    //   block.
+
+    // poll() until input available
+    do
+      {
+        if(!rclcpp::ok())
+        {
+          RCLCPP_ERROR(node_ptr_->get_logger(), "poll() error: shutdown requested");
+          return 1;
+        }
+        int retval = poll(fds, 1, POLL_TIMEOUT);
+        if (retval < 0)             // poll() error?
+          {
+            if (errno != EINTR)
+              RCLCPP_ERROR(node_ptr_->get_logger(), "poll() error: %s", strerror(errno));
+            return 1;
+          }
+        if (retval == 0)            // poll() timeout?
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "Velodyne poll() timeout");
+            return 1;
+          }
+        if ((fds[0].revents & POLLERR)
+            || (fds[0].revents & POLLHUP)
+            || (fds[0].revents & POLLNVAL)) // device error?
+          {
+            RCLCPP_ERROR(node_ptr_->get_logger(), "poll() reports Velodyne error");
+            return 1;
+          }
+      } while ((fds[0].revents & POLLIN) == 0);
+
+    return 0;
+  }
+
+  /** @brief Make sure there are enough recvmmsg() slots for a batch. */
+  void InputSocket::resizeBatch(size_t max_packets)
+  {
+    // a coalesced slot holds many packets, so fewer slots are needed
+    size_t slots = max_packets;
+    if (udp_gro_)
+      slots = std::max<size_t>(1, max_packets / (gro_buffer_size / packet_size));
+
+    if (msgs_.size() >= slots)
+      return;
+
+    msgs_.resize(slots);
+    iovecs_.resize(slots);
+    sender_addresses_.resize(slots);
+    control_.resize(slots * control_buffer_size);
+    gro_segment_size_.resize(slots);
+    receive_times_.resize(slots);
+    if (udp_gro_)
+      gro_buffer_.resize(slots * gro_buffer_size);
+
+    // vectors may have moved, so rebuild every header
+    for (size_t i = 0; i < slots; ++i)
+      {
+        if (udp_gro_)
+          {
+            iovecs_[i].iov_base = &gro_buffer_[i * gro_buffer_size];
+            iovecs_[i].iov_len = gro_buffer_size;
+          }
+        else
+          {
+            iovecs_[i].iov_len = packet_size;
+          }
+        memset(&msgs_[i], 0, sizeof(mmsghdr));
+        msgs_[i].msg_hdr.msg_name = &sender_addresses_[i];
+        msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+        msgs_[i].msg_hdr.msg_control = &control_[i * control_buffer_size];
+      }
+  }
+
+  /** @brief Extract the ancillary data the kernel attached to a slot. */
+  void InputSocket::parseControlMessages(size_t slot)
+  {
+    // without a UDP_GRO message the datagram was not coalesced
+    gro_segment_size_[slot] = msgs_[slot].msg_len;
+
+    msghdr *hdr = &msgs_[slot].msg_hdr;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(hdr, cmsg))
+      {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
           {
-            // read successful,
-            // if packet is not from the lidar scanner we selected by IP,
-            // continue otherwise we are done
-            if(devip_str_ != ""
-               && sender_address.sin_addr.s_addr != devip_.s_addr)
-              continue;
-            else
-              break; //done
+            int segment_size;
+            memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+            gro_segment_size_[slot] = segment_size;
           }
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+          {
+            timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            receive_times_[slot] = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+          }
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+          {
+            // cumulative count of datagrams dropped on this socket
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            kernel_drops_.store(drops, std::memory_order_relaxed);
+          }
+      }
+  }
 
+  /** @brief Have the kernel trim datagrams of the wrong size or sender.
+   *
+   *  A classic BPF program checks the UDP length and, when device_ip
+   *  is set, the IPv4 source address before the datagram is queued.
+   *  A rejected datagram is still queued and wakes the reader, but
+   *  only its 8 byte UDP header is kept, so its payload is neither
+   *  buffered nor copied.  acceptDatagram() counts the empty datagrams
+   *  as filter rejects; the kernel drop counter stays for receive
+   *  buffer overflows.
+   */
+  void InputSocket::attachFilter()
+  {
+    static const uint32_t UDP_HEADER_SIZE = 8;
+    std::vector<sock_filter> program;
+
+    // jump offsets to the final reject instruction are patched below
+    std::vector<size_t> reject_jumps;
+    if (!devip_str_.empty())
+      {
+        // the filter sees the UDP header, the IP header is at SKF_NET_OFF
+        program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) (SKF_NET_OFF + 12)));
+        program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(devip_.s_addr), 0, 0));
+        reject_jumps.push_back(program.size() - 1);
+      }
+    program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));
+    if (udp_gro_)
+      {
+        // a coalesced datagram carries whole packets only
+        program.push_back(BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, UDP_HEADER_SIZE, 0, 0));
+        reject_jumps.push_back(program.size() - 1);
+        program.push_back(BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, UDP_HEADER_SIZE));
+        program.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, packet_size));
+        program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 0));
+      }
+    else
+      {
+        program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                   UDP_HEADER_SIZE + packet_size, 0, 0));
+      }
+    reject_jumps.push_back(program.size() - 1);
+    // A rejected datagram is cut down to its UDP header rather than
+    // dropped: the kernel would count a drop in the SO_RXQ_OVFL
+    // counter, hiding receive buffer overflows, while an empty
+    // datagram is cheap to receive and counted as a filter reject.
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));     // accept
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, UDP_HEADER_SIZE)); // reject
+    for (size_t jump : reject_jumps)
+      program[jump].jf = program.size() - 2 - jump;
+
+    sock_fprog fprog;
+    fprog.len = program.size();
+    fprog.filter = program.data();
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+      {
+        RCLCPP_WARN(node_ptr_->get_logger(), "SO_ATTACH_FILTER not supported: %s",
+                    strerror(errno));
+        return;
+      }
+    kernel_filter_ = true;
+    RCLCPP_INFO(node_ptr_->get_logger(), "Kernel packet filter attached to data socket.");
+  }
+
+  /** @brief Check a received datagram's size and sender. */
+  bool InputSocket::acceptDatagram(size_t slot, size_t nbytes)
+  {
+    if (nbytes == 0 && kernel_filter_)
+      {
+        // cut down to its UDP header by the kernel filter
+        countFilterRejected(1);
+        return false;
+      }
+    if (nbytes != packet_size)
+      {
         RCLCPP_DEBUG_STREAM(node_ptr_->get_logger(), "incomplete Velodyne packet read: "
                          << nbytes << " bytes");
+        countRejected(1);
+        return false;
       }
 
-      if (!sensor_timestamp_) {
-        // Packet stamp from when read began. Add the time offset.
-        auto time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
-          std::chrono::duration<double>(time1 + time_offset)).count();
+    // if packet is not from the lidar scanner we selected by IP, skip it
+    if (devip_str_ != ""
+        && sender_addresses_[slot].sin_addr.s_addr != devip_.s_addr)
+      {
+        countRejected(1);
+        return false;
+      }
+
+    return true;
+  }
+
+  /** @brief Hand out packets from coalesced datagrams.
+   *
+   *  Resumes where the previous call stopped, so no packet is lost
+   *  when a coalesced datagram holds more than max_packets.
+   */
+  void InputSocket::splitGroSegments(velodyne_msgs::msg::VelodynePacket *pkts,
+                                     size_t max_packets, size_t *num_packets,
+                                     const double time_offset)
+  {
+    while (gro_slot_ < gro_slots_ && *num_packets < max_packets)
+      {
+        const size_t nbytes = msgs_[gro_slot_].msg_len;
+        const size_t segment_size = gro_segment_size_[gro_slot_];
+        if (nbytes == 0)
+          acceptDatagram(gro_slot_, 0);   // only counts it
+        if (gro_offset_ >= nbytes || segment_size == 0)
+          {
+            ++gro_slot_;
+            gro_offset_ = 0;
+            continue;
+          }
 
-        pkt->stamp = rclcpp::Time(time_ns);
-      } else {
-        // Time for each packet is a 4 byte uint located starting at offset 1200 in
-        // the data packet
-        auto ros_time_now = node_ptr_->now();
-        pkt->stamp = rosTimeFromGpsTimestamp(ros_time_now, &(pkt->data[1200]));
+        const size_t length = std::min(segment_size, nbytes - gro_offset_);
+        if (acceptDatagram(gro_slot_, length))
+          {
+            memcpy(&pkts[*num_packets].data[0],
+                   &gro_buffer_[gro_slot_ * gro_buffer_size + gro_offset_],
+                   packet_size);
+            stampPacket(&pkts[*num_packets], receive_times_[gro_slot_], time_offset);
+            ++(*num_packets);
+          }
+        gro_offset_ += segment_size;
       }
+  }
 
+  /** @brief Fill in the stamp of a received packet. */
+  void InputSocket::stampPacket(velodyne_msgs::msg::VelodynePacket *pkt,
+                                int64_t receive_time, const double time_offset)
+  {
+    int64_t time_ns = receive_time;
 
-    return 0;
+    if (!sensor_timestamp_) {
+      // Packet stamp from when the packet was received. Add the time offset.
+      time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<double>(time_offset)).count();
+
+      pkt->stamp = rclcpp::Time(time_ns);
+    } else {
+      // Time for each packet is a 4 byte uint located starting at offset 1200 in
+      // the data packet. The receive time only serves to recover the hour.
+      rclcpp::Time receive_stamp(time_ns);
+      pkt->stamp = rosTimeFromGpsTimestamp(receive_stamp, &(pkt->data[TIMESTAMP_BYTE]));
+    }
   }
 
   ////////////////////////////////////////////////////////////////////////
@@ -237,21 +722,36 @@ namespace velodyne_driver
                        std::string filename, bool read_once,
                        bool read_fast, double repeat_delay):
     Input(node_ptr, port),
-    last_packet_receive_time_(rclcpp::Time(0.0, RCL_ROS_TIME)),
-    last_packet_stamp_(rclcpp::Time(0.0, RCL_ROS_TIME)),
-    filename_(filename)
+    filename_(filename),
+    cache_(NULL),
+    have_pending_(false),
+    pending_deadline_(0),
+    pacing_started_(false),
+    pacing_stamp_base_(0),
+    pacing_clock_base_(0),
+    pacing_last_stamp_(0),
+    use_index_(false),
+    have_window_(false),
+    window_start_(0),
+    window_end_(0)
   {
     (void)read_once;
     (void)read_fast;
     (void)repeat_delay;
 
-    pcap_ = NULL;
     empty_ = true;
 
     // get parameters using private node handle
     read_once_ = node_ptr_->declare_parameter("read_once", false);
     read_fast_ = node_ptr_->declare_parameter("read_fast", false);
     repeat_delay_ = node_ptr_->declare_parameter("repeat_delay", 0.0);
+    rate_ = node_ptr_->declare_parameter("rate", 1.0);
+    bool pcap_mmap = node_ptr_->declare_parameter("pcap_mmap", true);
+    bool pcap_index = node_ptr_->declare_parameter("pcap_index", true);
+    start_time_ = node_ptr_->declare_parameter("start_time", 0.0);
+    end_time_ = node_ptr_->declare_parameter("end_time", 0.0);
+    start_scan_ = node_ptr_->declare_parameter("start_scan", 0);
+    bool pcap_cache = node_ptr_->declare_parameter("pcap_cache", false);
 
     if (read_once_)
       RCLCPP_INFO(node_ptr_->get_logger(), "Read input file only once.");
@@ -260,111 +760,226 @@ namespace velodyne_driver
     if (repeat_delay_ > 0.0)
       RCLCPP_INFO(node_ptr_->get_logger(), "Delay %.3f seconds before repeating input file.",
                repeat_delay_);
+    if (rate_ <= 0.0)
+      {
+        RCLCPP_WARN(node_ptr_->get_logger(), "Invalid replay rate %.3f, using 1.0", rate_);
+        rate_ = 1.0;
+      }
+    else if (rate_ != 1.0 && !read_fast_)
+      RCLCPP_INFO(node_ptr_->get_logger(), "Replay input file at %.2fx speed.", rate_);
+
+    filter_.port = port;
+    filter_.match_source = false;
+    filter_.source.s_addr = 0;
+    filter_.payload_size = packet_size;
+    if( devip_str_ != "" )              // using specific IP?
+      {
+        filter_.match_source = (inet_aton(devip_str_.c_str(), &filter_.source) != 0);
+      }
 
     // Open the PCAP dump file
     RCLCPP_INFO(node_ptr_->get_logger(), "Opening PCAP file \"%s\"", filename_.c_str());
-    if ((pcap_ = pcap_open_offline(filename_.c_str(), errbuf_) ) == NULL)
+    std::string error;
+    reader_ = openPcapReader(filename_, filter_, pcap_mmap, &error);
+    if (!reader_)
       {
-        RCLCPP_FATAL(node_ptr_->get_logger(), "Error opening Velodyne socket dump file.");
+        RCLCPP_FATAL(node_ptr_->get_logger(), "Error opening Velodyne socket dump file: %s",
+                     error.c_str());
         return;
       }
+    if (!error.empty())
+      RCLCPP_WARN(node_ptr_->get_logger(), "Falling back to libpcap, %s", error.c_str());
 
-    std::stringstream filter;
-    if( devip_str_ != "" )              // using specific IP?
+    // The scan index needs record offsets, which only the mmap
+    // reader provides.
+    use_index_ = pcap_index && reader_->seekable();
+    if (use_index_ && index_.load(filename_, filter_))
+      RCLCPP_INFO(node_ptr_->get_logger(), "Loaded index of %zu scans", index_.size());
+
+    if (start_time_ > 0.0 || end_time_ > 0.0 || start_scan_ > 0)
       {
-        filter << "src host " << devip_str_ << " && ";
+        if (use_index_)
+          seekWindowStart();
+        else
+          RCLCPP_WARN(node_ptr_->get_logger(),
+                      "Replay window needs pcap_mmap and pcap_index, playing whole file");
       }
-    filter << "udp dst port " << port;
-    pcap_compile(pcap_, &pcap_packet_filter_,
-                 filter.str().c_str(), 1, PCAP_NETMASK_UNKNOWN);
+
+    if (pcap_cache)
+      loadCache();
   }
 
   /** destructor */
   InputPCAP::~InputPCAP(void)
   {
-    pcap_close(pcap_);
   }
 
-  /** @brief Get one velodyne packet. */
-  int InputPCAP::getPacket(velodyne_msgs::msg::VelodynePacket *pkt, const double time_offset)
+  /** @brief Index the file until it covers a scan number and time.
+   *
+   *  Reads ahead from the last packet indexed until the index holds
+   *  more than scans entries, the last starting after stamp.  Leaves
+   *  the reader at an arbitrary position.
+   */
+  void InputPCAP::extendIndex(size_t scans, int64_t stamp)
   {
-    (void)time_offset;
+    if (index_.complete()
+        || (index_.size() > scans && index_[index_.size() - 1].stamp > stamp))
+      return;
+
+    if (index_.empty())
+      reader_->rewind();
+    else
+      reader_->seek(index_.resumeOffset());
+
+    PcapPacket found;
+    int res;
+    while ((res = reader_->next(&found)) > 0)
+      {
+        index_.observe(found);
+        if (index_.size() > scans && index_[index_.size() - 1].stamp > stamp)
+          return;
+      }
+
+    if (res == 0)
+      {
+        finishIndex();
+      }
+  }
+
+  /** @brief Complete the index at end of file and save it.
+   *
+   *  If the sidecar file cannot be written, the file is indexed again
+   *  on every run, so say why.
+   */
+  void InputPCAP::finishIndex()
+  {
+    index_.finish();
+    if (index_.save())
+      RCLCPP_INFO(node_ptr_->get_logger(), "Saved index of %zu scans", index_.size());
+    else
+      RCLCPP_WARN(node_ptr_->get_logger(), "Cannot save PCAP index %s: %s",
+                  index_.path().c_str(), strerror(errno));
+  }
+
+  /** @brief Locate the replay window and seek to its first scan. */
+  void InputPCAP::seekWindowStart()
+  {
+    RCLCPP_INFO(node_ptr_->get_logger(), "Indexing PCAP file for replay window");
+    extendIndex(0, INT64_MIN);
+    if (index_.empty())
+      return;
 
-    struct pcap_pkthdr *header;
-    const u_char *pkt_data;
+    // window times are seconds from the start of the capture
+    const int64_t first_stamp = index_[0].stamp;
+    size_t scan;
+    if (start_scan_ > 0)
+      {
+        extendIndex(start_scan_, INT64_MIN);
+        scan = std::min<size_t>(start_scan_, index_.size() - 1);
+      }
+    else
+      {
+        int64_t start = first_stamp + (int64_t) (start_time_ * 1e9);
+        extendIndex(0, start);
+        scan = index_.findTime(start);
+      }
+    if (end_time_ > 0.0)
+      window_end_ = first_stamp + (int64_t) (end_time_ * 1e9);
 
+    have_window_ = true;
+    window_start_ = index_[scan].offset;
+    reader_->seek(window_start_);
+    RCLCPP_INFO(node_ptr_->get_logger(), "Replaying from scan %zu at %.3f seconds",
+                scan, (index_[scan].stamp - first_stamp) * 1e-9);
+  }
+
+  /** @brief Load the replay window into memory and play it from there. */
+  void InputPCAP::loadCache()
+  {
+    // With pacing, the repeat delay becomes a gap in the looped
+    // timeline instead of a blocking sleep.
+    int64_t loop_delay = read_fast_ ? 0 : (int64_t) (repeat_delay_ * 1e9);
+    std::unique_ptr<PcapMemoryReader> cache(new PcapMemoryReader(packet_size, loop_delay));
+    if (!cache->load(*reader_, window_end_))
+      {
+        RCLCPP_WARN(node_ptr_->get_logger(), "Cannot cache PCAP file (%s), reading it instead",
+                    cache->error().c_str());
+        rewind();
+        return;
+      }
+
+    RCLCPP_INFO(node_ptr_->get_logger(), "Cached %zu packets (%.1f MB) for replay",
+                cache->size(), cache->bytes() / 1e6);
+    cache_ = cache.get();
+    reader_ = std::move(cache);
+
+    // the cache holds exactly the window and has no file offsets
+    use_index_ = false;
+    have_window_ = false;
+    window_end_ = 0;
+  }
+
+  /** @brief Move the GPS timestamp of a packet forward.
+   *
+   *  The field counts microseconds past the hour, so the shifted
+   *  value wraps the same way the sensor's does.
+   */
+  static void shiftGpsTimestamp(uint8_t *data, int64_t offset_ns)
+  {
+    static const uint64_t usec_per_hour = 3600ULL * 1000000ULL;
+    uint32_t usecs = ((uint32_t) data[3]) << 24 | ((uint32_t) data[2]) << 16 |
+                     ((uint32_t) data[1]) << 8 | ((uint32_t) data[0]);
+    usecs = (usecs + (uint64_t) (offset_ns / 1000)) % usec_per_hour;
+    data[0] = usecs & 0xff;
+    data[1] = (usecs >> 8) & 0xff;
+    data[2] = (usecs >> 16) & 0xff;
+    data[3] = (usecs >> 24) & 0xff;
+  }
+
+  /** @brief Go back to the start of the replay window. */
+  bool InputPCAP::rewind()
+  {
+    if (have_window_)
+      return reader_->seek(window_start_);
+    return reader_->rewind();
+  }
+
+  /** @brief Find the next packet to replay, looping at end of file.
+   *
+   *  @param batch_started packets are waiting to be returned, so
+   *                       leave the end of file for the next call
+   *  @returns 1 if a packet was found,
+   *           0 if the batch must be returned first,
+   *           -1 if done reading
+   */
+  int InputPCAP::nextPacket(PcapPacket *found, bool batch_started)
+  {
     while (true)
       {
-        int res;
-        if ((res = pcap_next_ex(pcap_, &header, &pkt_data)) >= 0)
-          {
-            // Skip packets not for the correct port and from the
-            // selected IP address.
-            if ( /* !devip_str_.empty() &&  Let the filter take care of skipping bad packets ... not dependent on device IP setting*/
-                (0 == pcap_offline_filter(&pcap_packet_filter_,
-                                          header, pkt_data)))
-            {
-              continue;
-            }
-
-            memcpy(&pkt->data[0], pkt_data+BLOCK_LENGTH, packet_size);
-            rclcpp::Time t=rclcpp::Clock{RCL_ROS_TIME}.now();
-            pkt->stamp = rosTimeFromGpsTimestamp(t,&(pkt->data[TIMESTAMP_BYTE])); // time_offset not considered here, as no synchronization required
+        int res = reader_->next(found);
+        bool end_of_file = (res == 0);
+        if (res > 0 && window_end_ != 0 && found->stamp > window_end_)
+          res = 0;                      // end of replay window
+        if (res > 0)
+          {
+            if (use_index_)
+              index_.observe(*found);
             empty_ = false;
+            return 1;
+          }
 
-            // Keep the reader from blowing through the file.
-            if (read_fast_ == false)
-            {
-              if (last_packet_stamp_ != rclcpp::Time(0.0, RCL_ROS_TIME) && last_packet_receive_time_ != rclcpp::Time(0.0, RCL_ROS_TIME))
-              {
-                rclcpp::Time current_packet_stamp = pkt->stamp;
-                rclcpp::Duration expected_cycle_time = current_packet_stamp - last_packet_stamp_;
-                rclcpp::Time expected_end = last_packet_receive_time_ + expected_cycle_time;
-                rclcpp::Time actual_end = rclcpp::Clock{RCL_ROS_TIME}.now();
-
-                // Detect backward jumps in time
-                if (actual_end < last_packet_receive_time_)
-                {
-                  expected_end = actual_end + expected_cycle_time;
-                }
-
-                // Calculate the time we'll sleep for.
-                rclcpp::Duration sleep_time = expected_end - actual_end;
-
-
-                // Make sure to reset our start time.
-                last_packet_receive_time_ = expected_end;
-                last_packet_stamp_ = current_packet_stamp;
-                
-                // If we've taken too much time we won't sleep.
-                if(sleep_time <= rclcpp::Duration::from_seconds(0.0))
-                {
-                  // If we've jumped forward in time, or the loop has taken more than a full extra
-                  // cycle, reset our cycle.
-                  if (actual_end > expected_end + expected_cycle_time)
-                  {
-                    last_packet_receive_time_ = actual_end;
-                  }                
-                }
-                else
-                {
-                  uint64_t count = sleep_time.nanoseconds();
-                  rclcpp::sleep_for(std::chrono::nanoseconds(count));
-                }
-              }
-              else
-              {
-                last_packet_stamp_ = pkt->stamp;
-                last_packet_receive_time_ = rclcpp::Clock{RCL_ROS_TIME}.now();
-              }              
-            }
-            return 0;                   // success
+        if (end_of_file && use_index_ && !index_.complete())
+          {
+            finishIndex();
           }
 
+        if (batch_started && res == 0)
+          return 0;
+
         if (empty_)                 // no data in file?
           {
             RCLCPP_WARN(node_ptr_->get_logger(), "Error %d reading Velodyne packet: %s",
-                     res, pcap_geterr(pcap_));
+                     res, reader_->error().c_str());
             return -1;
           }
 
@@ -374,7 +989,7 @@ namespace velodyne_driver
             return -1;
           }
 
-        if (repeat_delay_ > 0.0)
+        if (repeat_delay_ > 0.0 && (cache_ == NULL || read_fast_))
           {
             RCLCPP_INFO(node_ptr_->get_logger(), "end of file reached -- delaying %.3f seconds.",
                      repeat_delay_);
@@ -383,13 +998,138 @@ namespace velodyne_driver
 
         RCLCPP_DEBUG(node_ptr_->get_logger(), "replaying Velodyne dump file");
 
-        // I can't figure out how to rewind the file, because it
-        // starts with some kind of header.  So, close the file
-        // and reopen it with pcap.
-        pcap_close(pcap_);
-        pcap_ = pcap_open_offline(filename_.c_str(), errbuf_);
+        if (!rewind())
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "Error rewinding Velodyne dump file: %s",
+                        reader_->error().c_str());
+            return -1;
+          }
         empty_ = true;              // maybe the file disappeared?
       } // loop back and try again
   }
 
+  static int64_t monotonicNow()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+  }
+
+  /** @brief Monotonic clock time at which a packet is due.
+   *
+   *  Packets are due at their capture time relative to a base packet,
+   *  scaled by the replay rate.  The base moves whenever the capture
+   *  time goes backwards (the file looped) or replay falls too far
+   *  behind to catch up without a burst.
+   */
+  int64_t InputPCAP::packetDeadline(int64_t stamp)
+  {
+    static const int64_t max_lag = 10000000LL;          // 10 ms
+
+    int64_t deadline = pacing_clock_base_
+      + (int64_t) ((stamp - pacing_stamp_base_) / rate_);
+    if (!pacing_started_ || stamp < pacing_last_stamp_
+        || monotonicNow() > deadline + max_lag)
+      {
+        pacing_started_ = true;
+        pacing_stamp_base_ = stamp;
+        pacing_clock_base_ = monotonicNow();
+        deadline = pacing_clock_base_;
+      }
+    pacing_last_stamp_ = stamp;
+    return deadline;
+  }
+
+  /** @brief Wait for a monotonic clock time.
+   *
+   *  Sleeps to an absolute deadline, so time spent reading does not
+   *  add up, and spins through the last stretch to absorb the timer
+   *  wakeup latency.
+   */
+  static void sleepUntil(int64_t deadline)
+  {
+    static const int64_t spin_time = 50000;             // 50 us
+
+    int64_t wake = deadline - spin_time;
+    if (monotonicNow() < wake)
+      {
+        struct timespec ts;
+        ts.tv_sec = wake / 1000000000LL;
+        ts.tv_nsec = wake % 1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+          continue;
+      }
+    while (monotonicNow() < deadline)
+      continue;
+  }
+
+  /** @brief Get one velodyne packet. */
+  int InputPCAP::getPacket(velodyne_msgs::msg::VelodynePacket *pkt, const double time_offset)
+  {
+    size_t num_packets;
+    return getPackets(pkt, 1, &num_packets, time_offset);
+  }
+
+  /** @brief Get the velodyne packets due in the next pacing interval.
+   *
+   *  Sleeps once for the first packet, then returns every following
+   *  packet due within pacing_interval of it.
+   */
+  int InputPCAP::getPackets(velodyne_msgs::msg::VelodynePacket *pkts,
+                            size_t max_packets, size_t *num_packets,
+                            const double time_offset)
+  {
+    (void)time_offset;
+    static const int64_t pacing_interval = 2000000LL;   // 2 ms
+
+    *num_packets = 0;
+    if (!reader_)                       // file never opened?
+      return -1;
+
+    int64_t batch_deadline = 0;
+    while (*num_packets < max_packets)
+      {
+        if (!have_pending_)
+          {
+            int res = nextPacket(&pending_, *num_packets > 0);
+            if (res < 0)
+              return -1;
+            if (res == 0)
+              break;
+            have_pending_ = true;
+            // Keep the reader from blowing through the file.
+            pending_deadline_ = read_fast_ ? 0 : packetDeadline(pending_.stamp);
+          }
+
+        if (*num_packets == 0)
+          {
+            batch_deadline = pending_deadline_;
+            if (!read_fast_)
+              sleepUntil(batch_deadline);
+          }
+        else if (pending_deadline_ > batch_deadline + pacing_interval)
+          break;                        // due in the next batch
+
+        // the reader only returns packets for the correct port
+        // and from the selected IP address
+        velodyne_msgs::msg::VelodynePacket *pkt = &pkts[*num_packets];
+        memcpy(&pkt->data[0], pending_.payload, packet_size);
+        if (cache_ != NULL && cache_->loopOffset() != 0)
+          {
+            // later loops continue the timeline instead of
+            // jumping back to the start of the recording
+            shiftGpsTimestamp(&pkt->data[TIMESTAMP_BYTE], cache_->loopOffset());
+          }
+        have_pending_ = false;
+        ++*num_packets;
+      }
+
+    // time_offset not considered here, as no synchronization required
+    rclcpp::Time t = rclcpp::Clock{RCL_ROS_TIME}.now();
+    for (size_t i = 0; i < *num_packets; ++i)
+      pkts[i].stamp = rosTimeFromGpsTimestamp(t, &(pkts[i].data[TIMESTAMP_BYTE]));
+    countPackets(*num_packets, *num_packets * packet_size);
+    return (*num_packets > 0) ? 0 : 1;
+  }
+
 } // velodyne_driver namespace
@@ -0,0 +1,384 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Raw packet journal, written as segmented nanosecond pcap files.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <rclcpp/time.hpp>
+
+#include <velodyne_driver/packet_journal.h>
+
+namespace velodyne_driver
+{
+  static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+  static const int LINKTYPE_IPV4 = 228;
+  static const size_t PCAP_FILE_HEADER_SIZE = 24;
+  static const size_t PCAP_RECORD_HEADER_SIZE = 16;
+  static const size_t IP_HEADER_SIZE = 20;
+  static const size_t UDP_HEADER_SIZE = 8;
+
+  static const size_t BUFFER_SIZE = 1024 * 1024;
+  // O_DIRECT needs buffers, lengths and offsets aligned to the
+  // logical block size, 4096 covers every common device
+  static const size_t DIRECT_ALIGNMENT = 4096;
+
+  static inline void writeBE16(uint8_t *p, uint16_t value)
+  {
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+  }
+
+  PacketJournal::PacketJournal(const std::string &prefix, uint64_t segment_size,
+                               size_t buffers, in_addr source, uint16_t port):
+    prefix_(prefix),
+    segment_size_(segment_size),
+    source_(source),
+    port_(port),
+    have_current_(false),
+    segment_used_(0),
+    ip_id_(0),
+    stopping_(false),
+    fd_(-1),
+    direct_(false),
+    preallocate_(true),
+    file_offset_(0),
+    next_index_(0),
+    packets_recorded_(0),
+    packets_dropped_(0),
+    bytes_written_(0),
+    segments_(0)
+  {
+    current_.data = NULL;
+    current_.length = 0;
+    current_.last = false;
+    // two buffers at least, one filling while the other is written
+    storage_.resize(std::max<size_t>(buffers, 2), NULL);
+  }
+
+  PacketJournal::~PacketJournal()
+  {
+    if (writer_.joinable())
+      {
+        if (have_current_)
+          submit(true);
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          stopping_ = true;
+        }
+        filled_cv_.notify_one();
+        writer_.join();
+      }
+    for (uint8_t *buffer : storage_)
+      free(buffer);
+  }
+
+  bool PacketJournal::open()
+  {
+    for (uint8_t *&buffer : storage_)
+      {
+        if (posix_memalign(reinterpret_cast<void **>(&buffer), DIRECT_ALIGNMENT, BUFFER_SIZE) != 0)
+          {
+            buffer = NULL;
+            setError("out of memory for journal buffers");
+            return false;
+          }
+        // fault the pages in now, not while recording
+        memset(buffer, 0, BUFFER_SIZE);
+        free_.push_back(buffer);
+      }
+
+    // the writer opens segments, but a bad path should fail here
+    if (!openSegment())
+      return false;
+    writer_ = std::thread(&PacketJournal::writerLoop, this);
+    startSegment();
+    return true;
+  }
+
+  std::string PacketJournal::error() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+  }
+
+  void PacketJournal::setError(const std::string &error)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = error;
+  }
+
+  /** @brief Get an empty buffer, without waiting. */
+  bool PacketJournal::takeBuffer()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty())
+      return false;
+    current_.data = free_.back();
+    current_.length = 0;
+    current_.last = false;
+    free_.pop_back();
+    have_current_ = true;
+    return true;
+  }
+
+  /** @brief Hand the current buffer to the writer thread. */
+  void PacketJournal::submit(bool last)
+  {
+    current_.last = last;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      filled_.push_back(current_);
+    }
+    filled_cv_.notify_one();
+    have_current_ = false;
+  }
+
+  /** @brief Copy bytes into the buffers, which have room for them.
+   *
+   * A full buffer is only handed over once more bytes follow, so
+   * there always is a current buffer to end the segment with.
+   */
+  void PacketJournal::append(const uint8_t *bytes, size_t length)
+  {
+    while (length > 0)
+      {
+        if (current_.length == BUFFER_SIZE)
+          {
+            submit(false);
+            takeBuffer();       // checked by record()
+          }
+        size_t n = std::min(length, BUFFER_SIZE - current_.length);
+        memcpy(current_.data + current_.length, bytes, n);
+        current_.length += n;
+        bytes += n;
+        length -= n;
+      }
+  }
+
+  /** @brief Begin a segment with the pcap file header. */
+  void PacketJournal::startSegment()
+  {
+    uint8_t header[PCAP_FILE_HEADER_SIZE];
+    uint32_t magic = PCAP_MAGIC_NSEC;
+    uint16_t version_major = 2, version_minor = 4;
+    uint32_t zero = 0, snaplen = 65535, linktype = LINKTYPE_IPV4;
+    memcpy(header, &magic, 4);
+    memcpy(header + 4, &version_major, 2);
+    memcpy(header + 6, &version_minor, 2);
+    memcpy(header + 8, &zero, 4);       // thiszone
+    memcpy(header + 12, &zero, 4);      // sigfigs
+    memcpy(header + 16, &snaplen, 4);
+    memcpy(header + 20, &linktype, 4);
+
+    segment_used_ = 0;
+    if (!have_current_ && !takeBuffer())
+      return;                   // retried by record()
+    append(header, sizeof(header));
+    segment_used_ = sizeof(header);
+  }
+
+  void PacketJournal::record(const velodyne_msgs::msg::VelodynePacket *pkts,
+                             size_t num_packets, double time_offset)
+  {
+    if (!writer_.joinable())
+      return;
+
+    const int64_t offset_ns = static_cast<int64_t>(time_offset * 1e9);
+    for (size_t i = 0; i < num_packets; ++i)
+      {
+        const size_t payload_size = pkts[i].data.size();
+        const size_t frame_size = IP_HEADER_SIZE + UDP_HEADER_SIZE + payload_size;
+        const size_t record_size = PCAP_RECORD_HEADER_SIZE + frame_size;
+
+        if (segment_used_ > 0 && segment_used_ + record_size > segment_size_)
+          {
+            submit(true);
+            segment_used_ = 0;
+          }
+        // room for the file header and this record, possibly spanning two buffers
+        if (!have_current_ && !takeBuffer())
+          {
+            packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+          }
+        if (segment_used_ == 0)
+          startSegment();
+        if (current_.length + record_size > BUFFER_SIZE)
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.empty())
+              {
+                packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+              }
+          }
+
+        uint8_t header[PCAP_RECORD_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE];
+        const int64_t stamp = rclcpp::Time(pkts[i].stamp).nanoseconds() - offset_ns;
+        uint32_t seconds = static_cast<uint32_t>(stamp / 1000000000);
+        uint32_t nanoseconds = static_cast<uint32_t>(stamp % 1000000000);
+        uint32_t caplen = frame_size;
+        memcpy(header, &seconds, 4);
+        memcpy(header + 4, &nanoseconds, 4);
+        memcpy(header + 8, &caplen, 4);
+        memcpy(header + 12, &caplen, 4);
+
+        uint8_t *ip = header + PCAP_RECORD_HEADER_SIZE;
+        memset(ip, 0, IP_HEADER_SIZE);
+        ip[0] = 0x45;                   // version 4, 5 words of header
+        writeBE16(ip + 2, frame_size);
+        writeBE16(ip + 4, ip_id_++);
+        ip[8] = 64;                     // time to live
+        ip[9] = 17;                     // UDP
+        memcpy(ip + 12, &source_.s_addr, 4);
+        const in_addr_t broadcast = INADDR_BROADCAST;
+        memcpy(ip + 16, &broadcast, 4);
+        uint32_t sum = 0;
+        for (size_t w = 0; w < IP_HEADER_SIZE; w += 2)
+          sum += (ip[w] << 8) | ip[w + 1];
+        while (sum >> 16)
+          sum = (sum & 0xffff) + (sum >> 16);
+        writeBE16(ip + 10, ~sum & 0xffff);
+
+        uint8_t *udp = ip + IP_HEADER_SIZE;
+        writeBE16(udp, port_);          // the sensor sends from the same port
+        writeBE16(udp + 2, port_);
+        writeBE16(udp + 4, UDP_HEADER_SIZE + payload_size);
+        writeBE16(udp + 6, 0);          // no checksum
+
+        append(header, sizeof(header));
+        append(pkts[i].data.data(), payload_size);
+        segment_used_ += record_size;
+        packets_recorded_.fetch_add(1, std::memory_order_relaxed);
+      }
+  }
+
+  /** @brief Create the next segment file, from the writer thread.
+   *
+   * @returns false if no file could be created
+   */
+  bool PacketJournal::openSegment()
+  {
+    if (fd_ >= 0)
+      return true;
+    for (int attempts = 0; attempts < 100000; ++attempts)
+      {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "-%05u.pcap", next_index_++);
+        std::string filename = prefix_ + suffix;
+        direct_ = true;
+        fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_DIRECT | O_CLOEXEC, 0644);
+        if (fd_ < 0 && errno == EINVAL)
+          {
+            // the file system does not do direct I/O, tmpfs for one
+            direct_ = false;
+            fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+          }
+        if (fd_ >= 0)
+          {
+            if (preallocate_)
+              {
+                // reserve the extents up front, trimmed again when closing
+                int rc = posix_fallocate(fd_, 0, segment_size_);
+                if (rc == EOPNOTSUPP || rc == EINVAL)
+                  {
+                    // not supported here, nor emulated for direct I/O:
+                    // the segments grow as they are written
+                    preallocate_ = false;
+                  }
+                else if (rc != 0)
+                  {
+                    // most likely ENOSPC; record what still fits
+                    setError(filename + ": cannot preallocate: " + strerror(rc));
+                  }
+              }
+            file_offset_ = 0;
+            segments_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+        if (errno != EEXIST)
+          {
+            setError(filename + ": " + strerror(errno));
+            return false;
+          }
+      }
+    setError("no free journal file name at " + prefix_);
+    return false;
+  }
+
+  /** @brief Trim the segment to the bytes recorded and close it. */
+  void PacketJournal::closeSegment(uint64_t length)
+  {
+    if (fd_ < 0)
+      return;
+    if (ftruncate(fd_, length) < 0)
+      setError(std::string("journal truncate: ") + strerror(errno));
+    close(fd_);
+    fd_ = -1;
+  }
+
+  /** @brief Writer thread main loop. */
+  void PacketJournal::writerLoop()
+  {
+    for (;;)
+      {
+        Buffer buffer;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          filled_cv_.wait(lock, [this] {return stopping_ || !filled_.empty();});
+          if (filled_.empty())
+            break;              // stopping, and all written
+          buffer = filled_.front();
+          filled_.pop_front();
+        }
+
+        if (openSegment())
+          {
+            // direct writes must be whole blocks; the padding of the
+            // last one is cut off by closeSegment()
+            size_t length = buffer.length;
+            if (direct_)
+              {
+                length = (length + DIRECT_ALIGNMENT - 1) & ~(DIRECT_ALIGNMENT - 1);
+                memset(buffer.data + buffer.length, 0, length - buffer.length);
+              }
+            size_t done = 0;
+            while (done < length)
+              {
+                ssize_t n = pwrite(fd_, buffer.data + done, length - done, file_offset_ + done);
+                if (n < 0 && errno == EINTR)
+                  continue;
+                if (n <= 0)
+                  {
+                    setError(std::string("journal write: ") + strerror(errno));
+                    break;
+                  }
+                done += n;
+              }
+            file_offset_ += buffer.length;
+            bytes_written_.fetch_add(buffer.length, std::memory_order_relaxed);
+            if (buffer.last)
+              closeSegment(file_offset_);
+          }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(buffer.data);
+      }
+    closeSegment(file_offset_);
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,173 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Scan index of a Velodyne packet capture file, kept in a sidecar
+ *  file named after the capture with an ".idx" suffix.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <velodyne_driver/pcap_index.h>
+
+namespace velodyne_driver
+{
+  static const uint32_t INDEX_MAGIC = 0x58444956;   // "VIDX"
+  static const uint32_t INDEX_VERSION = 1;
+
+  /** Sidecar file header, in host byte order. */
+  struct IndexHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint32_t source;
+    uint16_t port;
+    uint16_t match_source;
+    uint64_t payload_size;
+    uint64_t count;             ///< number of Scan records following
+  };
+
+  PcapIndex::PcapIndex():
+    file_size_(0),
+    file_mtime_(0),
+    complete_(false),
+    have_last_(false),
+    last_offset_(0),
+    last_azimuth_(0)
+  {
+    memset(&filter_, 0, sizeof(filter_));
+  }
+
+  bool PcapIndex::load(const std::string &filename, const PcapFilter &filter)
+  {
+    path_ = filename + ".idx";
+    filter_ = filter;
+    scans_.clear();
+    complete_ = false;
+    have_last_ = false;
+
+    struct stat st;
+    if (stat(filename.c_str(), &st) < 0)
+      return false;
+    file_size_ = st.st_size;
+    file_mtime_ = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    FILE *file = fopen(path_.c_str(), "rb");
+    if (file == NULL)
+      return false;
+
+    IndexHeader header;
+    bool valid = (fread(&header, sizeof(header), 1, file) == 1
+                  && header.magic == INDEX_MAGIC
+                  && header.version == INDEX_VERSION
+                  && header.file_size == file_size_
+                  && header.file_mtime == file_mtime_
+                  && header.port == filter_.port
+                  && header.match_source == filter_.match_source
+                  && (!filter_.match_source || header.source == filter_.source.s_addr)
+                  && header.payload_size == filter_.payload_size
+                  && header.count <= file_size_);
+    if (valid)
+      {
+        scans_.resize(header.count);
+        valid = (fread(scans_.data(), sizeof(Scan), scans_.size(), file) == scans_.size());
+      }
+    fclose(file);
+
+    if (!valid)
+      {
+        scans_.clear();
+        return false;
+      }
+    complete_ = true;
+    return true;
+  }
+
+  bool PcapIndex::save() const
+  {
+    if (!complete_ || path_.empty())
+      {
+        errno = EINVAL;
+        return false;
+      }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.file_size = file_size_;
+    header.file_mtime = file_mtime_;
+    header.source = filter_.match_source ? filter_.source.s_addr : 0;
+    header.port = filter_.port;
+    header.match_source = filter_.match_source;
+    header.payload_size = filter_.payload_size;
+    header.count = scans_.size();
+
+    // write a temporary file, so readers never see a partial index
+    std::string temp = path_ + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file == NULL)
+      return false;
+    bool written = (fwrite(&header, sizeof(header), 1, file) == 1
+                    && fwrite(scans_.data(), sizeof(Scan), scans_.size(), file) == scans_.size());
+    int error = errno;
+    if (fclose(file) != 0 && written)
+      {
+        written = false;
+        error = errno;
+      }
+    if (written && rename(temp.c_str(), path_.c_str()) < 0)
+      {
+        written = false;
+        error = errno;
+      }
+    if (!written)
+      {
+        remove(temp.c_str());
+        errno = error;          // of the failed write, not the cleanup
+        return false;
+      }
+    return true;
+  }
+
+  void PcapIndex::observe(const PcapPacket &pkt)
+  {
+    if (complete_ || (have_last_ && pkt.offset <= last_offset_))
+      return;
+
+    // A revolution starts where the azimuth of the first block
+    // wraps around past zero.
+    uint16_t azimuth = pkt.payload[2] | (pkt.payload[3] << 8);
+    if (!have_last_ || azimuth < last_azimuth_)
+      {
+        Scan scan;
+        scan.offset = pkt.offset;
+        scan.stamp = pkt.stamp;
+        scans_.push_back(scan);
+      }
+
+    have_last_ = true;
+    last_offset_ = pkt.offset;
+    last_azimuth_ = azimuth;
+  }
+
+  size_t PcapIndex::findTime(int64_t stamp) const
+  {
+    std::vector<Scan>::const_iterator it =
+      std::upper_bound(scans_.begin(), scans_.end(), stamp,
+                       [](int64_t t, const Scan &scan) {return t < scan.stamp;});
+    return (it == scans_.begin()) ? 0 : (it - scans_.begin()) - 1;
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,755 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Capture file readers for the Velodyne PCAP input:
+ *
+ *     PcapMmapReader -- maps pcap and pcapng files and filters
+ *              packets with a fixed Ethernet/IPv4/UDP parser
+ *
+ *     PcapLibReader -- reads through libpcap and a BPF filter
+ *
+ *     PcapMemoryReader -- loops over packets copied into memory
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <byteswap.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include <velodyne_driver/pcap_reader.h>
+
+namespace velodyne_driver
+{
+  // pcap file magic numbers, as read in our byte order
+  static const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+  static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+  static const size_t PCAP_FILE_HEADER_SIZE = 24;
+  static const size_t PCAP_RECORD_HEADER_SIZE = 16;
+
+  // pcapng block types
+  static const uint32_t PCAPNG_SECTION_HEADER = 0x0a0d0d0a;
+  static const uint32_t PCAPNG_INTERFACE_DESCRIPTION = 1;
+  static const uint32_t PCAPNG_PACKET = 2;  // obsolete
+  static const uint32_t PCAPNG_SIMPLE_PACKET = 3;
+  static const uint32_t PCAPNG_ENHANCED_PACKET = 6;
+  static const uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+  static const uint16_t PCAPNG_OPTION_END = 0;
+  static const uint16_t PCAPNG_OPTION_TSRESOL = 9;
+
+  // link-layer header types handled by the fixed parser
+  static const int LINKTYPE_NULL = 0;
+  static const int LINKTYPE_ETHERNET = 1;
+  static const int LINKTYPE_RAW = 101;
+  static const int LINKTYPE_LINUX_SLL = 113;
+  static const int LINKTYPE_IPV4 = 228;
+  static const int LINKTYPE_LINUX_SLL2 = 276;
+
+  static const uint16_t ETHERTYPE_IPV4 = 0x0800;
+  static const uint16_t ETHERTYPE_VLAN = 0x8100;
+  static const uint16_t ETHERTYPE_QINQ = 0x88a8;
+  static const uint8_t IP_PROTOCOL_UDP = 17;
+
+  // how far ahead of the read position the kernel is asked to read
+  static const size_t READAHEAD_WINDOW = 16 * 1024 * 1024;
+
+  // larger records are taken for corruption rather than buffered
+  static const size_t MAX_BLOCK_LENGTH = 16 * 1024 * 1024;
+
+  static inline uint16_t readBE16(const uint8_t *p)
+  {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+  }
+
+  static inline size_t pad4(size_t length)
+  {
+    return (length + 3) & ~static_cast<size_t>(3);
+  }
+
+  /** @brief Locate the Velodyne payload in a captured frame.
+   *
+   *  Replaces the BPF interpreter with a fixed check of the only
+   *  things the filter ever looked at: IPv4, UDP, destination port,
+   *  source address and payload size.
+   *
+   *  @returns the UDP payload, or NULL if the frame does not match
+   */
+  static const uint8_t *findUdpPayload(const uint8_t *frame, size_t caplen,
+                                       int linktype, const PcapFilter &filter)
+  {
+    size_t offset;
+    uint16_t ethertype = ETHERTYPE_IPV4;
+    switch (linktype)
+      {
+      case LINKTYPE_ETHERNET:
+        if (caplen < 14)
+          return NULL;
+        ethertype = readBE16(frame + 12);
+        offset = 14;
+        // skip 802.1Q and 802.1ad tags
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ)
+               && caplen >= offset + 4)
+          {
+            ethertype = readBE16(frame + offset + 2);
+            offset += 4;
+          }
+        break;
+      case LINKTYPE_LINUX_SLL:
+        if (caplen < 16)
+          return NULL;
+        ethertype = readBE16(frame + 14);
+        offset = 16;
+        break;
+      case LINKTYPE_LINUX_SLL2:
+        if (caplen < 20)
+          return NULL;
+        ethertype = readBE16(frame);
+        offset = 20;
+        break;
+      case LINKTYPE_NULL:
+        offset = 4;             // address family, checked by the IP version
+        break;
+      case LINKTYPE_RAW:
+      case LINKTYPE_IPV4:
+        offset = 0;
+        break;
+      default:
+        return NULL;
+      }
+
+    if (ethertype != ETHERTYPE_IPV4 || caplen < offset + 20)
+      return NULL;
+
+    const uint8_t *ip = frame + offset;
+    if ((ip[0] >> 4) != 4 || ip[9] != IP_PROTOCOL_UDP)
+      return NULL;
+    // a fragment does not carry a whole packet
+    if ((readBE16(ip + 6) & 0x3fff) != 0)
+      return NULL;
+    if (filter.match_source
+        && memcmp(ip + 12, &filter.source.s_addr, 4) != 0)
+      return NULL;
+
+    const size_t ip_header_length = (ip[0] & 0x0f) * 4;
+    offset += ip_header_length;
+    if (ip_header_length < 20 || caplen < offset + 8)
+      return NULL;
+
+    const uint8_t *udp = frame + offset;
+    if (readBE16(udp + 2) != filter.port
+        || readBE16(udp + 4) != filter.payload_size + 8
+        || caplen < offset + 8 + filter.payload_size)
+      return NULL;
+
+    return udp + 8;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // PcapFileReader class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  PcapFileReader::PcapFileReader(const PcapFilter &filter):
+    pos_(0),
+    first_record_(0),
+    filter_(filter),
+    pcapng_(false),
+    swapped_(false)
+  {}
+
+  uint32_t PcapFileReader::read32(const uint8_t *p) const
+  {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped_ ? bswap_32(value) : value;
+  }
+
+  uint16_t PcapFileReader::read16(const uint8_t *p) const
+  {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped_ ? bswap_16(value) : value;
+  }
+
+  int64_t PcapFileReader::ticksToNs(uint64_t ticks, const Interface &iface) const
+  {
+    // split the division so the product cannot overflow
+    return (ticks / iface.tick_div) * iface.tick_mul
+      + ((ticks % iface.tick_div) * iface.tick_mul) / iface.tick_div;
+  }
+
+  /** @brief Read the file headers and position at the first record. */
+  bool PcapFileReader::parseFileHeader()
+  {
+    const uint8_t *header = bytes(0, PCAP_FILE_HEADER_SIZE);
+    if (header == NULL)
+      {
+        error_ = "file too short";
+        return false;
+      }
+
+    uint32_t magic;
+    memcpy(&magic, header, sizeof(magic));
+    if (magic == PCAPNG_SECTION_HEADER)
+      {
+        // Walk the leading blocks to check the link types.  Reading
+        // still starts at the section header, since a later section
+        // replaces the interfaces and rewind() must restore them.
+        pcapng_ = true;
+        uint64_t pos = 0;
+        const uint8_t *block;
+        while ((block = bytes(pos, 12)) != NULL)
+          {
+            uint32_t block_type;
+            memcpy(&block_type, block, sizeof(block_type));
+            size_t block_length;
+            if (block_type == PCAPNG_SECTION_HEADER)
+              {
+                if (!parseSectionHeader(block, &block_length))
+                  return false;
+              }
+            else
+              {
+                block_type = read32(block);
+                block_length = read32(block + 4);
+                if (block_type != PCAPNG_INTERFACE_DESCRIPTION)
+                  break;
+                block = bytes(pos, block_length);
+                if (block == NULL || !parseInterface(block, block_length))
+                  {
+                    error_ = "bad pcapng interface description";
+                    return false;
+                  }
+              }
+            pos += block_length;
+          }
+        first_record_ = 0;
+      }
+    else
+      {
+        Interface iface;
+        iface.tick_div = 1;
+        if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC)
+          swapped_ = false;
+        else if (bswap_32(magic) == PCAP_MAGIC_USEC || bswap_32(magic) == PCAP_MAGIC_NSEC)
+          swapped_ = true;
+        else
+          {
+            error_ = "not a pcap or pcapng file";
+            return false;
+          }
+        magic = read32(header);
+        iface.tick_mul = (magic == PCAP_MAGIC_NSEC) ? 1 : 1000;
+        iface.linktype = read32(header + 20) & 0xffff;
+        interfaces_.push_back(iface);
+        first_record_ = PCAP_FILE_HEADER_SIZE;
+      }
+
+    // make sure the fixed parser understands the captured frames
+    for (size_t i = 0; i < interfaces_.size(); ++i)
+      {
+        switch (interfaces_[i].linktype)
+          {
+          case LINKTYPE_NULL:
+          case LINKTYPE_ETHERNET:
+          case LINKTYPE_RAW:
+          case LINKTYPE_LINUX_SLL:
+          case LINKTYPE_IPV4:
+          case LINKTYPE_LINUX_SLL2:
+            break;
+          default:
+            std::ostringstream msg;
+            msg << "unsupported link type " << interfaces_[i].linktype;
+            error_ = msg.str();
+            return false;
+          }
+      }
+
+    pos_ = first_record_;
+    return true;
+  }
+
+  /** @brief Read the first 12 bytes of a pcapng section header block. */
+  bool PcapFileReader::parseSectionHeader(const uint8_t *block, size_t *block_length)
+  {
+    uint32_t byte_order;
+    memcpy(&byte_order, block + 8, sizeof(byte_order));
+    if (byte_order == PCAPNG_BYTE_ORDER_MAGIC)
+      swapped_ = false;
+    else if (bswap_32(byte_order) == PCAPNG_BYTE_ORDER_MAGIC)
+      swapped_ = true;
+    else
+      {
+        error_ = "bad pcapng byte order magic";
+        return false;
+      }
+
+    // interface ids restart in every section
+    interfaces_.clear();
+    *block_length = read32(block + 4);
+    if (*block_length < 28 || *block_length > MAX_BLOCK_LENGTH)
+      {
+        error_ = "bad pcapng section header length";
+        return false;
+      }
+    return true;
+  }
+
+  /** @brief Read a pcapng interface description block. */
+  bool PcapFileReader::parseInterface(const uint8_t *block, size_t block_length)
+  {
+    if (block_length < 20)
+      return false;
+
+    Interface iface;
+    iface.linktype = read16(block + 8);
+    iface.tick_mul = 1000;      // microseconds unless told otherwise
+    iface.tick_div = 1;
+
+    // options follow the 16 byte fixed part, up to the trailing length
+    size_t option = 16;
+    const size_t end = block_length - 4;
+    while (option + 4 <= end)
+      {
+        uint16_t code = read16(block + option);
+        uint16_t length = read16(block + option + 2);
+        if (code == PCAPNG_OPTION_END)
+          break;
+        if (code == PCAPNG_OPTION_TSRESOL && length >= 1)
+          {
+            uint8_t resolution = block[option + 4];
+            uint8_t exponent = resolution & 0x7f;
+            if (resolution & 0x80)
+              {
+                // 2^-exponent seconds per tick
+                if (exponent > 30)
+                  exponent = 30;
+                iface.tick_mul = 1000000000ULL;
+                iface.tick_div = 1ULL << exponent;
+              }
+            else
+              {
+                // 10^-exponent seconds per tick
+                iface.tick_mul = 1;
+                iface.tick_div = 1;
+                for (int e = exponent; e < 9; ++e)
+                  iface.tick_mul *= 10;
+                for (int e = 9; e < exponent && e < 18; ++e)
+                  iface.tick_div *= 10;
+              }
+          }
+        option += 4 + pad4(length);
+      }
+
+    interfaces_.push_back(iface);
+    return true;
+  }
+
+  int PcapFileReader::next(PcapPacket *pkt)
+  {
+    return pcapng_ ? nextPcapng(pkt) : nextPcap(pkt);
+  }
+
+  int PcapFileReader::nextPcap(PcapPacket *pkt)
+  {
+    const Interface &iface = interfaces_[0];
+    const uint8_t *record;
+    while ((record = bytes(pos_, PCAP_RECORD_HEADER_SIZE)) != NULL)
+      {
+        const uint32_t caplen = read32(record + 8);
+        const uint64_t record_pos = pos_;
+        if (caplen > MAX_BLOCK_LENGTH)
+          break;                // corrupt record
+        record = bytes(pos_, PCAP_RECORD_HEADER_SIZE + caplen);
+        if (record == NULL)
+          break;                // truncated last record
+        pos_ += PCAP_RECORD_HEADER_SIZE + caplen;
+
+        const uint8_t *payload = findUdpPayload(record + PCAP_RECORD_HEADER_SIZE,
+                                                caplen, iface.linktype, filter_);
+        if (payload == NULL)
+          continue;
+
+        pkt->payload = payload;
+        pkt->stamp = read32(record) * 1000000000LL
+          + ticksToNs(read32(record + 4), iface);
+        pkt->offset = record_pos;
+        return 1;
+      }
+    return 0;
+  }
+
+  int PcapFileReader::nextPcapng(PcapPacket *pkt)
+  {
+    const uint8_t *block;
+    while ((block = bytes(pos_, 12)) != NULL)
+      {
+        const uint64_t record_pos = pos_;
+        uint32_t block_type;
+        memcpy(&block_type, block, sizeof(block_type));
+        size_t block_length;
+        if (block_type == PCAPNG_SECTION_HEADER)
+          {
+            if (!parseSectionHeader(block, &block_length))
+              return -1;
+            pos_ += block_length;
+            continue;
+          }
+
+        block_type = read32(block);
+        block_length = read32(block + 4);
+        if (block_length < 12 || (block_length & 3) != 0 || block_length > MAX_BLOCK_LENGTH)
+          break;                // corrupt block
+        block = bytes(pos_, block_length);
+        if (block == NULL)
+          break;                // truncated last block
+        pos_ += block_length;
+
+        const uint8_t *frame;
+        uint32_t caplen;
+        const Interface *iface;
+        uint64_t ticks = 0;
+        switch (block_type)
+          {
+          case PCAPNG_INTERFACE_DESCRIPTION:
+            if (!parseInterface(block, block_length))
+              {
+                error_ = "bad pcapng interface description";
+                return -1;
+              }
+            continue;
+          case PCAPNG_ENHANCED_PACKET:
+          case PCAPNG_PACKET:
+            {
+              if (block_length < 32)
+                continue;
+              // the obsolete packet block has a 16 bit interface id
+              uint32_t interface_id = (block_type == PCAPNG_ENHANCED_PACKET) ?
+                read32(block + 8) : read16(block + 8);
+              if (interface_id >= interfaces_.size())
+                continue;
+              iface = &interfaces_[interface_id];
+              ticks = ((uint64_t) read32(block + 12) << 32) | read32(block + 16);
+              caplen = read32(block + 20);
+              frame = block + 28;
+              if (28 + (size_t) caplen + 4 > block_length)
+                continue;
+              break;
+            }
+          case PCAPNG_SIMPLE_PACKET:
+            {
+              // no timestamp and no capture length, belongs to interface 0
+              if (interfaces_.empty() || block_length < 16)
+                continue;
+              iface = &interfaces_[0];
+              caplen = std::min<uint32_t>(read32(block + 8), block_length - 16);
+              frame = block + 12;
+              break;
+            }
+          default:
+            continue;
+          }
+
+        const uint8_t *payload = findUdpPayload(frame, caplen, iface->linktype, filter_);
+        if (payload == NULL)
+          continue;
+
+        pkt->payload = payload;
+        pkt->stamp = ticksToNs(ticks, *iface);
+        pkt->offset = record_pos;
+        return 1;
+      }
+    return 0;
+  }
+
+  bool PcapFileReader::rewind()
+  {
+    pos_ = first_record_;
+    return true;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // PcapMmapReader class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  PcapMmapReader::PcapMmapReader(const PcapFilter &filter):
+    PcapFileReader(filter),
+    fd_(-1),
+    data_(NULL),
+    size_(0),
+    readahead_end_(0)
+  {}
+
+  PcapMmapReader::~PcapMmapReader()
+  {
+    if (data_ != NULL)
+      munmap(const_cast<uint8_t *>(data_), size_);
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  /** @brief Open and map a capture file. */
+  bool PcapMmapReader::open(const std::string &filename)
+  {
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0)
+      {
+        error_ = strerror(errno);
+        return false;
+      }
+
+    struct stat st;
+    if (fstat(fd_, &st) < 0 || st.st_size < (off_t) PCAP_FILE_HEADER_SIZE)
+      {
+        error_ = "file too short";
+        return false;
+      }
+    size_ = st.st_size;
+
+    void *map = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (map == MAP_FAILED)
+      {
+        error_ = std::string("mmap: ") + strerror(errno);
+        return false;
+      }
+    data_ = static_cast<const uint8_t *>(map);
+    madvise(map, size_, MADV_SEQUENTIAL);
+
+    return parseFileHeader();
+  }
+
+  const uint8_t *PcapMmapReader::bytes(uint64_t pos, size_t length)
+  {
+    if (pos > size_ || length > size_ - pos)
+      return NULL;
+    return data_ + pos;
+  }
+
+  /** @brief Ask the kernel to read the next window of the file. */
+  void PcapMmapReader::readAhead()
+  {
+    if (pos_ + READAHEAD_WINDOW / 2 < readahead_end_ || readahead_end_ >= size_)
+      return;
+
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t start = (pos_ / page_size) * page_size;
+    size_t length = std::min(READAHEAD_WINDOW, size_ - start);
+    madvise(const_cast<uint8_t *>(data_) + start, length, MADV_WILLNEED);
+    readahead_end_ = start + length;
+  }
+
+  int PcapMmapReader::next(PcapPacket *pkt)
+  {
+    readAhead();
+    return PcapFileReader::next(pkt);
+  }
+
+  bool PcapMmapReader::seek(uint64_t offset)
+  {
+    if (offset > size_)
+      return false;
+    pos_ = offset;
+    readahead_end_ = 0;
+    return true;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // PcapLibReader class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  PcapLibReader::PcapLibReader(const PcapFilter &filter):
+    filter_(filter),
+    pcap_(NULL),
+    have_filter_(false)
+  {}
+
+  PcapLibReader::~PcapLibReader()
+  {
+    if (have_filter_)
+      pcap_freecode(&pcap_packet_filter_);
+    if (pcap_ != NULL)
+      pcap_close(pcap_);
+  }
+
+  bool PcapLibReader::open(const std::string &filename)
+  {
+    filename_ = filename;
+    if ((pcap_ = pcap_open_offline(filename_.c_str(), errbuf_) ) == NULL)
+      {
+        error_ = errbuf_;
+        return false;
+      }
+
+    std::stringstream filter;
+    if (filter_.match_source)           // using specific IP?
+      {
+        filter << "src host " << inet_ntoa(filter_.source) << " && ";
+      }
+    filter << "udp dst port " << filter_.port;
+    if (pcap_compile(pcap_, &pcap_packet_filter_,
+                     filter.str().c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0)
+      {
+        error_ = pcap_geterr(pcap_);
+        return false;
+      }
+    have_filter_ = true;
+    return true;
+  }
+
+  int PcapLibReader::next(PcapPacket *pkt)
+  {
+    // Ethernet, IPv4 and UDP headers without options
+    static const size_t headers_size = 42;
+
+    struct pcap_pkthdr *header;
+    const u_char *pkt_data;
+    int res;
+    while ((res = pcap_next_ex(pcap_, &header, &pkt_data)) >= 0)
+      {
+        // Skip packets not for the correct port and from the
+        // selected IP address.
+        if (0 == pcap_offline_filter(&pcap_packet_filter_, header, pkt_data)
+            || header->caplen < headers_size + filter_.payload_size)
+          continue;
+
+        pkt->payload = pkt_data + headers_size;
+        pkt->stamp = header->ts.tv_sec * 1000000000LL + header->ts.tv_usec * 1000LL;
+        pkt->offset = 0;
+        return 1;
+      }
+
+    if (res == PCAP_ERROR_BREAK)        // end of file
+      return 0;
+    error_ = pcap_geterr(pcap_);
+    return -1;
+  }
+
+  bool PcapLibReader::rewind()
+  {
+    // I can't figure out how to rewind the file, because it
+    // starts with some kind of header.  So, close the file
+    // and reopen it with pcap.
+    pcap_close(pcap_);
+    pcap_ = pcap_open_offline(filename_.c_str(), errbuf_);
+    if (pcap_ == NULL)
+      {
+        error_ = errbuf_;
+        return false;
+      }
+    return true;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // PcapMemoryReader class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  PcapMemoryReader::PcapMemoryReader(size_t payload_size, int64_t loop_delay):
+    payload_size_(payload_size),
+    next_(0),
+    loop_delay_(loop_delay),
+    loop_offset_(0),
+    loop_period_(0)
+  {}
+
+  bool PcapMemoryReader::load(PcapReader &source, int64_t end_stamp)
+  {
+    payloads_.clear();
+    stamps_.clear();
+
+    PcapPacket pkt;
+    int res;
+    while ((res = source.next(&pkt)) > 0)
+      {
+        if (end_stamp != 0 && pkt.stamp > end_stamp)
+          break;
+        payloads_.insert(payloads_.end(), pkt.payload, pkt.payload + payload_size_);
+        stamps_.push_back(pkt.stamp);
+      }
+    if (res < 0)
+      {
+        error_ = source.error();
+        return false;
+      }
+    if (stamps_.empty())
+      {
+        error_ = "no packets";
+        return false;
+      }
+    payloads_.shrink_to_fit();
+    stamps_.shrink_to_fit();
+
+    // the next loop starts one average packet interval after the last
+    int64_t length = stamps_.back() - stamps_.front();
+    loop_period_ = length + loop_delay_;
+    if (stamps_.size() > 1)
+      loop_period_ += length / (int64_t) (stamps_.size() - 1);
+    next_ = 0;
+    loop_offset_ = 0;
+    return true;
+  }
+
+  int PcapMemoryReader::next(PcapPacket *pkt)
+  {
+    if (next_ >= stamps_.size())
+      return 0;
+
+    pkt->payload = &payloads_[next_ * payload_size_];
+    pkt->stamp = stamps_[next_] + loop_offset_;
+    pkt->offset = next_;
+    ++next_;
+    return 1;
+  }
+
+  bool PcapMemoryReader::rewind()
+  {
+    next_ = 0;
+    loop_offset_ += loop_period_;
+    return true;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // reader factory
+  ////////////////////////////////////////////////////////////////////////
+
+  std::unique_ptr<PcapReader> openPcapReader(const std::string &filename,
+                                             const PcapFilter &filter,
+                                             bool use_mmap,
+                                             std::string *error)
+  {
+    error->clear();
+    if (PcapStreamReader::compressed(filename))
+      {
+        // libpcap cannot read these either, so there is no fallback
+        std::unique_ptr<PcapStreamReader> reader(new PcapStreamReader(filter));
+        if (reader->open(filename))
+          return reader;
+        *error = "compressed capture: " + reader->error();
+        return nullptr;
+      }
+
+    if (use_mmap)
+      {
+        std::unique_ptr<PcapMmapReader> reader(new PcapMmapReader(filter));
+        if (reader->open(filename))
+          return reader;
+        *error = "mmap reader: " + reader->error() + "; ";
+      }
+
+    std::unique_ptr<PcapLibReader> reader(new PcapLibReader(filter));
+    if (reader->open(filename))
+      return reader;
+    *error += "libpcap: " + reader->error();
+    return nullptr;
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,405 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Streaming reader for compressed Velodyne capture files.
+ *
+ *  zstd and lz4 (frame format) compressed pcap and pcapng files are
+ *  decompressed on a background thread.  Support for each format is
+ *  compiled in when its library is found (HAVE_ZSTD, HAVE_LZ4).
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <algorithm>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include <velodyne_driver/pcap_reader.h>
+
+namespace velodyne_driver
+{
+  // leading bytes of the compressed formats, read as little-endian
+  static const uint32_t ZSTD_FRAME_MAGIC = 0xfd2fb528;
+  static const uint32_t LZ4_FRAME_MAGIC = 0x184d2204;
+
+  // decompressed chunk size and how many may wait for the parser
+  static const size_t CHUNK_SIZE = 1024 * 1024;
+  static const size_t MAX_QUEUED_CHUNKS = 16;
+
+  static uint32_t fileMagic(const std::string &filename)
+  {
+    uint8_t magic[4] = {0, 0, 0, 0};
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file != NULL)
+      {
+        if (fread(magic, sizeof(magic), 1, file) != 1)
+          memset(magic, 0, sizeof(magic));
+        fclose(file);
+      }
+    return magic[0] | (magic[1] << 8) | (magic[2] << 16) | ((uint32_t) magic[3] << 24);
+  }
+
+  /** @brief Decompressed contents of a file. */
+  class ByteSource
+  {
+  public:
+    virtual ~ByteSource() {}
+
+    /** @brief Decompress the next part of the file.
+     *
+     * @returns number of bytes stored in buf, 0 at end of file,
+     *          -1 on error
+     */
+    virtual ssize_t read(uint8_t *buf, size_t size) = 0;
+
+    const std::string & error() const {return error_;}
+
+  protected:
+    std::string error_;
+  };
+
+  /** @brief Compressed input common to the decompressors. */
+  class CompressedSource: public ByteSource
+  {
+  public:
+    CompressedSource():
+      file_(NULL),
+      in_(CHUNK_SIZE),
+      in_pos_(0),
+      in_size_(0)
+    {}
+
+    virtual ~CompressedSource()
+    {
+      if (file_ != NULL)
+        fclose(file_);
+    }
+
+    bool open(const std::string &filename)
+    {
+      file_ = fopen(filename.c_str(), "rb");
+      if (file_ == NULL)
+        {
+          error_ = strerror(errno);
+          return false;
+        }
+      return true;
+    }
+
+  protected:
+    /** @returns 0 at the end of a complete stream, else -1 */
+    ssize_t endOfInput(bool frame_end, const char *truncated)
+    {
+      if (!error_.empty())
+        return -1;
+      if (!frame_end)
+        {
+          error_ = truncated;
+          return -1;
+        }
+      return 0;
+    }
+
+    /** @returns false at end of file or on error */
+    bool fill()
+    {
+      if (in_pos_ < in_size_)
+        return true;
+      in_pos_ = 0;
+      in_size_ = fread(in_.data(), 1, in_.size(), file_);
+      if (in_size_ == 0 && ferror(file_))
+        error_ = strerror(errno);
+      return in_size_ > 0;
+    }
+
+    FILE *file_;
+    std::vector<uint8_t> in_;
+    size_t in_pos_;
+    size_t in_size_;
+  };
+
+#ifdef HAVE_ZSTD
+  class ZstdSource: public CompressedSource
+  {
+  public:
+    ZstdSource():
+      stream_(ZSTD_createDStream()),
+      frame_end_(true)
+    {
+      ZSTD_initDStream(stream_);
+    }
+
+    virtual ~ZstdSource()
+    {
+      ZSTD_freeDStream(stream_);
+    }
+
+    virtual ssize_t read(uint8_t *buf, size_t size)
+    {
+      ZSTD_outBuffer out = {buf, size, 0};
+      while (true)
+        {
+          // call even without new input, to flush buffered output
+          ZSTD_inBuffer in = {in_.data(), in_size_, in_pos_};
+          size_t rc = ZSTD_decompressStream(stream_, &out, &in);
+          if (ZSTD_isError(rc))
+            {
+              error_ = ZSTD_getErrorName(rc);
+              return -1;
+            }
+          // a call with nothing to do reports on the next frame
+          if (in.pos > in_pos_ || out.pos > 0)
+            frame_end_ = (rc == 0);
+          in_pos_ = in.pos;
+          if (out.pos > 0)
+            return out.pos;
+          if (!fill())
+            return endOfInput(frame_end_, "truncated zstd frame");
+        }
+    }
+
+  private:
+    ZSTD_DStream *stream_;
+    bool frame_end_;
+  };
+#endif // HAVE_ZSTD
+
+#ifdef HAVE_LZ4
+  class Lz4Source: public CompressedSource
+  {
+  public:
+    Lz4Source():
+      context_(NULL),
+      frame_end_(true)
+    {
+      LZ4F_createDecompressionContext(&context_, LZ4F_VERSION);
+    }
+
+    virtual ~Lz4Source()
+    {
+      LZ4F_freeDecompressionContext(context_);
+    }
+
+    virtual ssize_t read(uint8_t *buf, size_t size)
+    {
+      while (true)
+        {
+          // call even without new input, to flush buffered output
+          size_t out_size = size;
+          size_t in_size = in_size_ - in_pos_;
+          size_t rc = LZ4F_decompress(context_, buf, &out_size,
+                                      in_.data() + in_pos_, &in_size, NULL);
+          if (LZ4F_isError(rc))
+            {
+              error_ = LZ4F_getErrorName(rc);
+              return -1;
+            }
+          // a call with nothing to do reports on the next frame
+          if (in_size > 0 || out_size > 0)
+            frame_end_ = (rc == 0);
+          in_pos_ += in_size;
+          if (out_size > 0)
+            return out_size;
+          if (!fill())
+            return endOfInput(frame_end_, "truncated lz4 frame");
+        }
+    }
+
+  private:
+    LZ4F_dctx *context_;
+    bool frame_end_;
+  };
+#endif // HAVE_LZ4
+
+  ////////////////////////////////////////////////////////////////////////
+  // PcapStreamReader class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  PcapStreamReader::PcapStreamReader(const PcapFilter &filter):
+    PcapFileReader(filter),
+    done_(false),
+    stopping_(false),
+    buffer_pos_(0)
+  {}
+
+  PcapStreamReader::~PcapStreamReader()
+  {
+    stop();
+  }
+
+  bool PcapStreamReader::compressed(const std::string &filename)
+  {
+    uint32_t magic = fileMagic(filename);
+    return magic == ZSTD_FRAME_MAGIC || magic == LZ4_FRAME_MAGIC;
+  }
+
+  bool PcapStreamReader::open(const std::string &filename)
+  {
+    filename_ = filename;
+    if (!start())
+      return false;
+    if (parseFileHeader())
+      return true;
+
+    // report why the data ended early, rather than what it lacked
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!source_error_.empty())
+      error_ = source_error_;
+    return false;
+  }
+
+  /** @brief Open the file and start decompressing from its beginning. */
+  bool PcapStreamReader::start()
+  {
+    uint32_t magic = fileMagic(filename_);
+    std::unique_ptr<CompressedSource> source;
+#ifdef HAVE_ZSTD
+    if (magic == ZSTD_FRAME_MAGIC)
+      source.reset(new ZstdSource());
+#endif
+#ifdef HAVE_LZ4
+    if (magic == LZ4_FRAME_MAGIC)
+      source.reset(new Lz4Source());
+#endif
+    if (!source)
+      {
+        error_ = (magic == ZSTD_FRAME_MAGIC || magic == LZ4_FRAME_MAGIC) ?
+          "built without support for this compression" : "not a compressed file";
+        return false;
+      }
+    if (!source->open(filename_))
+      {
+        error_ = source->error();
+        return false;
+      }
+
+    source_ = std::move(source);
+    error_.clear();
+    chunks_.clear();
+    done_ = false;
+    stopping_ = false;
+    source_error_.clear();
+    buffer_.clear();
+    buffer_pos_ = 0;
+    thread_ = std::thread(&PcapStreamReader::decompress, this);
+    return true;
+  }
+
+  void PcapStreamReader::stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable())
+      thread_.join();
+    source_.reset();
+  }
+
+  /** @brief Decompression thread, queues chunks until stopped. */
+  void PcapStreamReader::decompress()
+  {
+    while (true)
+      {
+        std::vector<uint8_t> chunk;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          cond_.wait(lock, [this] {
+              return stopping_ || chunks_.size() < MAX_QUEUED_CHUNKS;
+            });
+          if (stopping_)
+            return;
+          if (!free_chunks_.empty())
+            {
+              chunk.swap(free_chunks_.back());
+              free_chunks_.pop_back();
+            }
+        }
+
+        chunk.resize(CHUNK_SIZE);
+        ssize_t nbytes = source_->read(chunk.data(), chunk.size());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (nbytes <= 0)
+          {
+            source_error_ = source_->error();
+            done_ = true;
+            cond_.notify_all();
+            return;
+          }
+        chunk.resize(nbytes);
+        chunks_.push_back(std::move(chunk));
+        cond_.notify_all();
+      }
+  }
+
+  const uint8_t *PcapStreamReader::bytes(uint64_t pos, size_t length)
+  {
+    if (pos < buffer_pos_)
+      return NULL;              // already discarded, cannot go back
+
+    // drop data before the requested record once it is worth moving
+    size_t skip = std::min<uint64_t>(pos - buffer_pos_, buffer_.size());
+    if (skip >= CHUNK_SIZE)
+      {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + skip);
+        buffer_pos_ += skip;
+      }
+
+    const size_t needed = (pos - buffer_pos_) + length;
+    while (buffer_.size() < needed)
+      {
+        std::vector<uint8_t> chunk;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          cond_.wait(lock, [this] {return done_ || !chunks_.empty();});
+          if (chunks_.empty())
+            {
+              if (!source_error_.empty())
+                error_ = source_error_;
+              return NULL;
+            }
+          chunk.swap(chunks_.front());
+          chunks_.pop_front();
+        }
+        cond_.notify_all();
+
+        buffer_.insert(buffer_.end(), chunk.begin(), chunk.end());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_chunks_.push_back(std::move(chunk));
+      }
+    return &buffer_[pos - buffer_pos_];
+  }
+
+  int PcapStreamReader::next(PcapPacket *pkt)
+  {
+    int rc = PcapFileReader::next(pkt);
+    if (rc == 0 && !error_.empty())
+      return -1;                // decompression failed, not end of file
+    return rc;
+  }
+
+  bool PcapStreamReader::rewind()
+  {
+    stop();
+    if (!start())
+      return false;
+    return PcapFileReader::rewind();
+  }
+
+} // velodyne_driver namespace
@@ -0,0 +1,98 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Thread scheduling implementation, shared by the driver and the
+ *  point cloud nodes.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include <velodyne_driver/realtime.h>
+
+namespace velodyne_driver
+{
+
+ThreadPolicy declareThreadPolicy(rclcpp::Node * node_ptr, const std::string & prefix)
+{
+  ThreadPolicy policy;
+  policy.cpus = node_ptr->declare_parameter(prefix + "_cpus", std::vector<int64_t>());
+  policy.priority = node_ptr->declare_parameter(prefix + "_priority", 0);
+  return policy;
+}
+
+bool applyThreadPolicy(const ThreadPolicy & policy, const std::string & name,
+                       const rclcpp::Logger & logger)
+{
+  bool ok = true;
+
+  // at most 15 characters
+  pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+  if (!policy.cpus.empty())
+    {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for (int64_t cpu : policy.cpus)
+        {
+          if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &cpus);
+        }
+      int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+      if (rc != 0)
+        {
+          RCLCPP_WARN(logger, "%s thread: could not set CPU affinity: %s",
+                      name.c_str(), strerror(rc));
+          ok = false;
+        }
+      else
+        {
+          RCLCPP_INFO(logger, "%s thread pinned to %d CPUs", name.c_str(), CPU_COUNT(&cpus));
+        }
+    }
+
+  if (policy.priority > 0)
+    {
+      sched_param param;
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = std::min(policy.priority, sched_get_priority_max(SCHED_FIFO));
+      int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      if (rc != 0)
+        {
+          // needs CAP_SYS_NICE or an rtprio limit
+          RCLCPP_WARN(logger, "%s thread: could not set SCHED_FIFO priority %d: %s",
+                      name.c_str(), param.sched_priority, strerror(rc));
+          ok = false;
+        }
+      else
+        {
+          RCLCPP_INFO(logger, "%s thread running SCHED_FIFO at priority %d",
+                      name.c_str(), param.sched_priority);
+        }
+    }
+  return ok;
+}
+
+bool lockMemory(const rclcpp::Logger & logger)
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    {
+      // needs CAP_IPC_LOCK or a large enough memlock limit
+      RCLCPP_WARN(logger, "could not lock memory: %s", strerror(errno));
+      return false;
+    }
+  RCLCPP_INFO(logger, "memory locked");
+  return true;
+}
+
+} // namespace velodyne_driver
@@ -0,0 +1,219 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Partial scans of the driver core when the packets stop, fed over
+ *  UDP and serviced the way the multi-sensor event threads do.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <rclcpp/rclcpp.hpp>
+#include <velodyne_msgs/msg/velodyne_scan.hpp>
+
+#include "driver.h"
+
+namespace
+{
+
+const size_t PACKET_SIZE = 1206;
+const int BLOCKS = 12;
+const int BLOCK_SIZE = 100;
+const uint16_t AZIMUTH_STEP = 20;       // 0.2 degrees per block
+const uint32_t STAMP_STEP = 1330;       // microseconds between VLP-16 packets
+
+/** VLP-16 packet n of a scan, all returns zero */
+std::vector<uint8_t> vlp16Packet(uint32_t n)
+{
+  std::vector<uint8_t> data(PACKET_SIZE, 0);
+  for (int block = 0; block < BLOCKS; ++block)
+  {
+    uint8_t * p = &data[block * BLOCK_SIZE];
+    uint16_t azimuth = (n * BLOCKS + block) * AZIMUTH_STEP;
+    p[0] = 0xFF;
+    p[1] = 0xEE;
+    p[2] = azimuth & 0xFF;
+    p[3] = azimuth >> 8;
+  }
+  uint32_t stamp = 1000 + n * STAMP_STEP;
+  memcpy(&data[1200], &stamp, sizeof(stamp));
+  data[1204] = 0x37;                    // strongest return
+  data[1205] = 0x22;                    // VLP-16
+  return data;
+}
+
+uint32_t packetStamp(const velodyne_msgs::msg::VelodynePacket & packet)
+{
+  uint32_t stamp;
+  memcpy(&stamp, &packet.data[1200], sizeof(stamp));
+  return stamp;
+}
+
+/** a local UDP port nobody is bound to right now */
+int freePort()
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t len = sizeof(addr);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+    getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return ntohs(addr.sin_port);
+}
+
+}  // namespace
+
+class StallFlush : public ::testing::Test
+{
+protected:
+  static void SetUpTestCase() {rclcpp::init(0, nullptr);}
+  static void TearDownTestCase() {rclcpp::shutdown();}
+
+  /** a driver holding packets back for re-sequencing */
+  void start(double stall_timeout)
+  {
+    int port = freePort();
+    ASSERT_GT(port, 0);
+    node_ = std::make_shared<rclcpp::Node>(
+      "test_stall_flush",
+      rclcpp::NodeOptions().parameter_overrides({
+        {"model", std::string("VLP16")},
+        {"port", port},
+        {"reorder_depth", 8},
+        {"reorder_max_delay", 0.01},
+        {"stall_timeout", stall_timeout}}));
+    dvr_.reset(new velodyne_driver::VelodyneDriverCore(node_.get()));
+    dvr_->setNonBlocking(true);
+    ASSERT_GE(dvr_->fileDescriptor(), 0);
+    sub_ = node_->create_subscription<velodyne_msgs::msg::VelodyneScan>(
+      "velodyne_packets", rclcpp::SensorDataQoS(),
+      [this](velodyne_msgs::msg::VelodyneScan::SharedPtr scan) {scans_.push_back(scan);});
+
+    sender_ = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(sender_, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    ASSERT_EQ(connect(sender_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+  }
+
+  void TearDown() override
+  {
+    if (sender_ >= 0)
+      close(sender_);
+    sub_.reset();
+    dvr_.reset();
+    node_.reset();
+  }
+
+  void send(uint32_t n)
+  {
+    std::vector<uint8_t> data = vlp16Packet(n);
+    ASSERT_EQ(::send(sender_, data.data(), data.size(), 0), (ssize_t) data.size());
+  }
+
+  /** one pass of the event loop, waiting at most until the next check */
+  void service()
+  {
+    auto timeout = dvr_->timeUntilCheck(std::chrono::steady_clock::now());
+    pollfd pfd = {dvr_->fileDescriptor(), POLLIN, 0};
+    if (::poll(&pfd, 1, static_cast<int>((timeout.count() + 999) / 1000)) > 0)
+    {
+      dvr_->receive();
+      dvr_->processReceived();
+    }
+    dvr_->checkStall();
+    rclcpp::spin_some(node_);
+  }
+
+  /** service the driver until a scan arrives or the deadline passes */
+  void serviceUntilScan(std::chrono::steady_clock::duration deadline)
+  {
+    auto end = std::chrono::steady_clock::now() + deadline;
+    while (scans_.empty() && std::chrono::steady_clock::now() < end)
+      service();
+  }
+
+  rclcpp::Node::SharedPtr node_;
+  std::unique_ptr<velodyne_driver::VelodyneDriverCore> dvr_;
+  rclcpp::Subscription<velodyne_msgs::msg::VelodyneScan>::SharedPtr sub_;
+  std::vector<velodyne_msgs::msg::VelodyneScan::SharedPtr> scans_;
+  int sender_ = -1;
+};
+
+// packets stopping mid-scan end it once the held ones are added
+TEST_F(StallFlush, partial_scan_with_reordering)
+{
+  start(0.2);
+  const uint32_t sent = 30;             // well short of a revolution
+  for (uint32_t n = 0; n < sent; ++n)
+    send(n % 8 == 4 ? n + 1 : n % 8 == 5 ? n - 1 : n);
+  auto last_sent = std::chrono::steady_clock::now();
+
+  serviceUntilScan(std::chrono::seconds(3));
+  ASSERT_EQ(scans_.size(), 1u);
+  EXPECT_GE(std::chrono::steady_clock::now() - last_sent, std::chrono::milliseconds(200));
+
+  const velodyne_msgs::msg::VelodyneScan & scan = *scans_.front();
+  EXPECT_TRUE(scan.incomplete);
+  ASSERT_EQ(scan.packets.size(), sent);
+  for (uint32_t n = 0; n < sent; ++n)
+    EXPECT_EQ(packetStamp(scan.packets[n]), 1000 + n * STAMP_STEP) << "packet " << n;
+}
+
+// the event loop is woken for the held packets, not after a fixed wait
+TEST_F(StallFlush, wakes_for_held_packets)
+{
+  start(0.2);
+  for (uint32_t n = 0; n < 3; ++n)
+    send(n);
+  auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (std::chrono::steady_clock::now() < end)
+  {
+    pollfd pfd = {dvr_->fileDescriptor(), POLLIN, 0};
+    if (::poll(&pfd, 1, 10) > 0)
+      break;
+  }
+  dvr_->receive();
+  dvr_->processReceived();
+
+  // fewer packets than the depth are held until their delay runs out
+  EXPECT_LE(dvr_->timeUntilCheck(std::chrono::steady_clock::now()),
+            std::chrono::milliseconds(10));
+}
+
+// no stall timeout: the held packets still reach the scan, unpublished
+TEST_F(StallFlush, no_partial_scan_without_timeout)
+{
+  start(0.0);
+  for (uint32_t n = 0; n < 10; ++n)
+    send(n);
+  serviceUntilScan(std::chrono::milliseconds(500));
+  EXPECT_TRUE(scans_.empty());
+  EXPECT_EQ(dvr_->timeUntilCheck(std::chrono::steady_clock::now()),
+            std::chrono::milliseconds(100));
+}
@@ -0,0 +1,106 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Vectorized conversion of whole Velodyne data blocks.
+ *
+ *  A data block holds 32 returns sharing one azimuth, which the
+ *  kernels convert together, 4 or 8 per instruction.  The kernel is
+ *  chosen once, at run time, for the best instruction set the CPU
+ *  supports.  The scalar kernel is the reference, the others give
+ *  bit-identical results on x86, as they round every operation the
+ *  same way and never fuse a multiply and an add.
+ */
+
+#ifndef __VELODYNE_BLOCK_KERNELS_H
+#define __VELODYNE_BLOCK_KERNELS_H
+
+#include <stdint.h>
+
+namespace velodyne_rawdata
+{
+static const int BLOCK_LANES = 32;
+
+/** \brief Corrections of the laser of each return in a block. */
+struct BlockLanes
+{
+  float cos_vert[BLOCK_LANES];
+  float sin_vert[BLOCK_LANES];
+  float cos_rot[BLOCK_LANES];
+  float sin_rot[BLOCK_LANES];
+  float dist_correction[BLOCK_LANES];
+  float azimuth_fraction[BLOCK_LANES];  ///< share of the block's rotation before the firing
+};
+
+/** \brief Converted returns of a block, one per lane. */
+struct BlockPoints
+{
+  float x[BLOCK_LANES];
+  float y[BLOCK_LANES];
+  float z[BLOCK_LANES];
+  float distance[BLOCK_LANES];
+  float intensity[BLOCK_LANES];
+  int32_t azimuth[BLOCK_LANES];  ///< corrected azimuth [deg/100]
+};
+
+/** \brief Convert the 32 returns of a data block.
+ *
+ *  The returns with a zero distance are converted as any other, the
+ *  caller skips them.
+ *
+ *  @param lanes corrections of each return
+ *  @param data the 96 data bytes of the block
+ *  @param azimuth block azimuth [deg/100]
+ *  @param azimuth_diff rotation to the next block [deg/100]
+ *  @param cos_rot_table cosine of each azimuth unit
+ *  @param sin_rot_table sine of each azimuth unit
+ *  @param distance_resolution meters per distance unit
+ *  @param points converted returns
+ */
+typedef void (* BlockKernelFn)(
+  const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+  const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+  BlockPoints & points);
+
+struct BlockKernel
+{
+  BlockKernelFn convert;
+  const char * name;
+};
+
+/** @returns the fastest kernel this CPU runs */
+BlockKernel selectBlockKernel();
+
+/** @returns the scalar reference kernel */
+BlockKernel scalarBlockKernel();
+
+void convertBlockScalar(
+  const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+  const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+  BlockPoints & points);
+
+#ifdef VELODYNE_SIMD_X86
+void convertBlockSSE41(
+  const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+  const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+  BlockPoints & points);
+void convertBlockAVX2(
+  const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+  const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+  BlockPoints & points);
+#endif
+
+#ifdef VELODYNE_SIMD_NEON
+void convertBlockNEON(
+  const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+  const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+  BlockPoints & points);
+#endif
+
+}  // namespace velodyne_rawdata
+
+#endif  // __VELODYNE_BLOCK_KERNELS_H
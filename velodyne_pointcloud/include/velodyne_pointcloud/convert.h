@@ -18,7 +18,10 @@
 #define _VELODYNE_POINTCLOUD_CONVERT_H_ 1
 
 #include <deque>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 
 #include <rclcpp/rclcpp.hpp>
 
@@ -38,6 +41,7 @@
 #include <visualization_msgs/msg/marker_array.hpp>
 #include <velodyne_msgs/msg/velodyne_scan.hpp>
 
+#include <velodyne_driver/realtime.h>
 #include <velodyne_pointcloud/pointcloudXYZIRADT.h>
 #include <velodyne_pointcloud/rawdata.h>
 
@@ -54,6 +58,7 @@ private:
   /** \brief Parameter service callback */
   rcl_interfaces::msg::SetParametersResult paramCallback(const std::vector<rclcpp::Parameter> & p);
   void processScan(const velodyne_msgs::msg::VelodyneScan::SharedPtr scanMsg);
+  void applyCallbackPolicy();
   visualization_msgs::msg::MarkerArray createVelodyneModelMakerMsg(const std_msgs::msg::Header & header);
   bool getTransform(
     const std::string & target_frame, const std::string & source_frame,
@@ -69,17 +74,23 @@ private:
   // tf2_ros::Buffer tf2_buffer_;
   // tf2_ros::TransformListener tf2_listener_;
 
-  // Buffer for overflow points
-  velodyne_pointcloud::PointcloudXYZIRADT _overflow_buffer;
   /// Pointer to dynamic reconfigure service srv_
   rclcpp::node_interfaces::OnSetParametersCallbackHandle::SharedPtr set_param_res_;
 
   std::shared_ptr<velodyne_rawdata::RawData> data_;
+  /// threads decoding the packets of a scan, NULL to decode them serially
+  std::unique_ptr<velodyne_rawdata::DecodePool> decode_pool_;
 
   int num_points_threshold_;
   std::vector<float> invalid_intensity_array_;
   std::string base_link_frame_;
 
+  // scheduling of the executor threads running processScan; it stays
+  // with the thread, for the callbacks of other nodes it runs as well
+  velodyne_driver::ThreadPolicy callback_policy_;
+  std::mutex policy_mutex_;
+  std::set<std::thread::id> policy_threads_;  ///< threads already set up by this node
+
   /// configuration parameters
   typedef struct
   {
@@ -88,7 +99,6 @@ private:
     double view_direction;
     double view_width;
     int npackets;               ///< number of packets to combine
-    double scan_phase;        ///< sensor phase (degrees)
     bool sensor_timestamp;      ///< flag on whether to use sensor (GPS) time or ROS receive time
   } Config;
   Config config_;
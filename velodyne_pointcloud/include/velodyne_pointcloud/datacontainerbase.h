@@ -17,10 +17,38 @@
 #ifndef __DATACONTAINERBASE_H
 #define __DATACONTAINERBASE_H
 
+#include <vector>
+
 #include <rclcpp/rclcpp.hpp>
 
 namespace velodyne_rawdata
 {
+/** \brief Points decoded from one packet, one array per field. */
+struct PointBatch
+{
+  size_t size;
+  const float * x;
+  const float * y;
+  const float * z;
+  const uint8_t * return_type;
+  const uint16_t * ring;
+  const uint16_t * azimuth;
+  const float * distance;
+  const float * intensity;
+  const double * time_stamp;
+};
+
+/** \brief Share of a container for the points of one packet, when
+ *  the packets of a scan are decoded in parallel. */
+struct PointSlice
+{
+  size_t first;             ///< index of the slice's first point
+  size_t capacity;          ///< points the slice has room for
+  size_t size;              ///< points stored
+  size_t added;             ///< points decoded, including those not stored
+  double first_time_stamp;  ///< time stamp of the first point decoded
+};
+
 class DataContainerBase
 {
 public:
@@ -29,6 +57,50 @@ public:
     const uint8_t & return_type, const uint16_t & ring,
     const uint16_t & azimuth, const float & distance, const float & intensity,
     const double & time_stamp) = 0;
+
+  /** \brief Add the points of a packet.
+   *
+   *  The decoders call this once per packet.  Containers override it
+   *  to add the points at once, the default hands them to addPoint
+   *  one by one.
+   */
+  virtual void addPoints(const PointBatch & batch)
+  {
+    for (size_t i = 0; i < batch.size; ++i) {
+      addPoint(
+        batch.x[i], batch.y[i], batch.z[i], batch.return_type[i], batch.ring[i],
+        batch.azimuth[i], batch.distance[i], batch.intensity[i], batch.time_stamp[i]);
+    }
+  }
+
+  /** \brief Make room for slices of points, filled by writeSlice().
+   *
+   *  The slices are laid out by the caller, one after another, past
+   *  the points already added.
+   *
+   *  @returns false if the container cannot be filled in slices
+   */
+  virtual bool beginSlices(size_t points)
+  {
+    (void)points;
+    return false;
+  }
+
+  /** \brief Store a batch after the points of a slice, as many as fit.
+   *
+   *  Called concurrently for different slices.
+   */
+  virtual void writeSlice(PointSlice & slice, const PointBatch & batch)
+  {
+    (void)slice;
+    (void)batch;
+  }
+
+  /** \brief Move the points of the slices together, in slice order. */
+  virtual void endSlices(const std::vector<PointSlice> & slices)
+  {
+    (void)slices;
+  }
 };
 }  // namespace velodyne_rawdata
 #endif  //__DATACONTAINERBASE_H
@@ -0,0 +1,68 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Worker threads decoding the packets of a scan in parallel.
+ *
+ *  The pool only schedules: which packet a job decodes, and where its
+ *  points go, is decided by the caller, so the results do not depend
+ *  on which thread ran which job.
+ */
+
+#ifndef __VELODYNE_DECODE_POOL_H
+#define __VELODYNE_DECODE_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace velodyne_rawdata
+{
+class DecodePool
+{
+public:
+  /** @param threads threads running the jobs, the caller of run() included
+   *  @param thread_init run by each worker thread before its first job
+   */
+  explicit DecodePool(size_t threads, const std::function<void()> & thread_init = nullptr);
+  ~DecodePool();
+
+  /** @returns threads running the jobs, the caller of run() included */
+  size_t threads() const {return workers_.size() + 1;}
+
+  /** \brief Run job(0) to job(jobs - 1), returning once all are done.
+   *
+   *  Jobs run in any order and concurrently, they must not throw.
+   *  Only one thread may call run() at a time.
+   */
+  void run(size_t jobs, const std::function<void(size_t)> & job);
+
+private:
+  void workerLoop(std::function<void()> thread_init);
+  void runJobs();
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  uint64_t generation_;       ///< incremented by each run()
+  size_t busy_workers_;       ///< workers still in the current run()
+  bool stopping_;
+
+  const std::function<void(size_t)> * job_;
+  size_t jobs_;
+  std::atomic<size_t> next_job_;
+};
+}  // namespace velodyne_rawdata
+
+#endif  // __VELODYNE_DECODE_POOL_H
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2015-2019 Autoware Foundation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __POINTCLOUD2XYZIRADT_H
+#define __POINTCLOUD2XYZIRADT_H
+
+#include <sensor_msgs/msg/point_cloud2.hpp>
+#include <std_msgs/msg/header.hpp>
+#include <velodyne_pointcloud/datacontainerbase.h>
+
+namespace velodyne_pointcloud
+{
+/** \brief Writes the points within range straight into PointCloud2 messages.
+ *
+ *  The messages get the layout pcl::toROSMsg gives PointXYZIRADT and
+ *  PointXYZIR clouds, so subscribers see the same bytes as from the
+ *  PCL containers, without the intermediate clouds and copies.
+ */
+class Pointcloud2XYZIRADT : public velodyne_rawdata::DataContainerBase
+{
+public:
+  /** velodyne_points_ex layout, NULL unless requested */
+  sensor_msgs::msg::PointCloud2::UniquePtr xyziradt;
+  /** velodyne_points layout, NULL unless requested */
+  sensor_msgs::msg::PointCloud2::UniquePtr xyzir;
+
+  /** @param max_points points the decoder may add at most
+   *  @param min_range shortest distance kept [m]
+   *  @param max_range longest distance kept [m]
+   *  @param want_xyziradt fill xyziradt
+   *  @param want_xyzir fill xyzir
+   */
+  Pointcloud2XYZIRADT(
+    size_t max_points, double min_range, double max_range,
+    bool want_xyziradt, bool want_xyzir);
+
+  virtual void addPoint(
+    const float & x, const float & y, const float & z,
+    const uint8_t & return_type, const uint16_t & ring, const uint16_t & azimuth,
+    const float & distance, const float & intensity,
+    const double & time_stamp) override;
+
+  virtual void addPoints(const velodyne_rawdata::PointBatch & batch) override;
+
+  virtual bool beginSlices(size_t points) override;
+  virtual void writeSlice(
+    velodyne_rawdata::PointSlice & slice, const velodyne_rawdata::PointBatch & batch) override;
+  virtual void endSlices(const std::vector<velodyne_rawdata::PointSlice> & slices) override;
+
+  /** \brief Trim the messages to the points kept and stamp them.
+   *
+   *  The stamp is the time of the first point added, in or out of
+   *  range, or fallback_stamp if there was none.
+   */
+  void finish(
+    const std_msgs::msg::Header & header, const builtin_interfaces::msg::Time & fallback_stamp);
+
+private:
+  void reserve(size_t points);
+  size_t setPoints(size_t index, const velodyne_rawdata::PointBatch & batch, size_t count);
+
+  double min_range_;
+  double max_range_;
+  size_t points_added_;   ///< including those out of range
+  size_t points_kept_;
+  double first_time_stamp_;
+};
+}  // namespace velodyne_pointcloud
+#endif
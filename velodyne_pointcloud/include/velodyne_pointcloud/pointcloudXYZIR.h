@@ -36,6 +36,8 @@ public:
     const uint8_t & return_type, const uint16_t & ring, const uint16_t & azimuth,
     const float & distance, const float & intensity,
     const double & time_stamp) override;
+
+  virtual void addPoints(const velodyne_rawdata::PointBatch & batch) override;
 };
 }  // namespace velodyne_pointcloud
 #endif  //__POINTCLOUDXYZIR_H
@@ -36,6 +36,16 @@ public:
     const uint8_t & return_type, const uint16_t & ring, const uint16_t & azimuth,
     const float & distance, const float & intensity,
     const double & time_stamp) override;
+
+  virtual void addPoints(const velodyne_rawdata::PointBatch & batch) override;
+
+  virtual bool beginSlices(size_t points) override;
+  virtual void writeSlice(
+    velodyne_rawdata::PointSlice & slice, const velodyne_rawdata::PointBatch & batch) override;
+  virtual void endSlices(const std::vector<velodyne_rawdata::PointSlice> & slices) override;
+
+private:
+  size_t slice_base_ = 0;  ///< points before the first slice
 };
 }  // namespace velodyne_pointcloud
 #endif
@@ -47,8 +47,11 @@
 
 #include <rclcpp/rclcpp.hpp>
 #include <velodyne_msgs/msg/velodyne_packet.hpp>
+#include <velodyne_msgs/msg/velodyne_scan.hpp>
 
+#include <velodyne_pointcloud/block_kernels.h>
 #include <velodyne_pointcloud/calibration.h>
+#include <velodyne_pointcloud/decode_pool.h>
 #include <velodyne_pointcloud/point_types.h>
 
 #include <velodyne_pointcloud/datacontainerbase.h>
@@ -79,15 +82,23 @@ static const uint16_t RETURN_MODE_STRONGEST = 55;
 static const uint16_t RETURN_MODE_LAST = 56;
 static const uint16_t RETURN_MODE_DUAL = 57;
 
+/** Sensor models, reported in the last byte of each packet **/
+static const uint8_t SENSOR_MODEL_HDL32E = 0x21;
+static const uint8_t SENSOR_MODEL_VLP16 = 0x22;
+static const uint8_t SENSOR_MODEL_PUCK_HIRES = 0x24;
+static const uint8_t SENSOR_MODEL_VLP32C = 0x28;
+static const uint8_t SENSOR_MODEL_VLS128 = 0xa1;
+static const uint8_t SENSOR_MODEL_VLS128_ALT = 0x63;
+
 /** Special Defines for VLP16 support **/
 static const int VLP16_FIRINGS_PER_BLOCK = 2;
 static const int VLP16_SCANS_PER_FIRING = 16;
-static const float VLP16_BLOCK_TDURATION = 110.592f;  // [µs]
-static const float VLP16_DSR_TOFFSET = 2.304f;        // [µs]
-static const float VLP16_FIRING_TOFFSET = 55.296f;    // [µs]
+static constexpr float VLP16_BLOCK_TDURATION = 110.592f;  // [µs]
+static constexpr float VLP16_DSR_TOFFSET = 2.304f;        // [µs]
+static constexpr float VLP16_FIRING_TOFFSET = 55.296f;    // [µs]
 
 /** Special Definitions for VLS128 support **/
-static const float VLP128_DISTANCE_RESOLUTION   =    0.004f;  // [m]
+static constexpr float VLP128_DISTANCE_RESOLUTION   =    0.004f;  // [m]
 
 /** Special Definitions for VLS128 support **/
 // These are used to detect which bank of 32 lasers is in this block
@@ -96,8 +107,8 @@ static const uint16_t VLS128_BANK_2 = 0xddff;
 static const uint16_t VLS128_BANK_3 = 0xccff;
 static const uint16_t VLS128_BANK_4 = 0xbbff;
 
-static const float  VLS128_CHANNEL_TDURATION  =  2.665f;  // [µs] Channels corresponds to one laser firing
-static const float  VLS128_SEQ_TDURATION      =  53.3f;   // [µs] Sequence is a set of laser firings including recharging
+static constexpr float VLS128_CHANNEL_TDURATION  =  2.665f;  // [µs] Channels corresponds to one laser firing
+static constexpr float VLS128_SEQ_TDURATION      =  53.3f;   // [µs] Sequence is a set of laser firings including recharging
 
 /** \brief Raw Velodyne data block.
  *
@@ -192,7 +203,43 @@ public:
    */
   int setupOffline(std::string calibration_file, double max_range_, double min_range_);
 
-  void unpack(const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data);
+  void unpack(
+    const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data,
+    int first_block = 0, int end_block = BLOCKS_PER_PACKET);
+
+  /** \brief Convert the data blocks of a scan.
+   *
+   *  @param scan packets of the scan
+   *  @param data container the points are added to
+   *  @param pool threads decoding the packets in parallel, NULL to
+   *              decode them one after another
+   */
+  void unpackScan(
+    const velodyne_msgs::msg::VelodyneScan & scan, DataContainerBase & data,
+    DecodePool * pool = NULL);
+
+  /** \brief Choose the decoder for the packets of a scan, after which
+   *  they may be unpacked concurrently.
+   *
+   *  @returns false if the packets differ in return mode or model,
+   *           when they must be unpacked one after another
+   */
+  bool prepareScan(const velodyne_msgs::msg::VelodyneScan & scan);
+
+  /** \brief Data blocks of a packet that belong to a scan.
+   *
+   *  The driver cuts the scan at the data block past scan_phase, so
+   *  the first and last packets may be shared with the neighbouring
+   *  scans; only this scan's blocks of them are converted.
+   */
+  static void scanBlocks(
+    const velodyne_msgs::msg::VelodyneScan & scan, size_t packet,
+    int & first_block, int & end_block)
+  {
+    first_block = (packet == 0) ? scan.first_block : 0;
+    end_block = (packet == scan.packets.size() - 1 && scan.end_block != 0) ?
+      scan.end_block : BLOCKS_PER_PACKET;
+  }
 
   void setParameters(double min_range, double max_range, double view_direction, double view_width);
 
@@ -226,14 +273,35 @@ private:
   float sin_rot_table_[ROTATION_MAX_UNITS];
   float cos_rot_table_[ROTATION_MAX_UNITS];
 
-  // Caches the azimuth percent offset for the VLS-128 laser firings
-  float vls_128_laser_azimuth_cache[16];
-
-  /** add private function to handle the VLP16 **/
-  void unpack_vlp16(const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data);
-
-  /** add private function to handle the VLS128 **/
-  void unpack_vls128(const velodyne_msgs::msg::VelodynePacket &pkt, DataContainerBase &data);
+  /** converts the returns of a VLP-16 or VLS-128 block together */
+  BlockKernel block_kernel_;
+  /** corrections of each return in a block, per VLS-128 bank */
+  BlockLanes block_lanes_[4];
+  template<typename Traits>
+  void setupBlockLanes();
+
+  /** decoder for the return mode and model of the packets */
+  typedef void (RawData::* UnpackFn)(
+    const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data,
+    int first_block, int end_block);
+  UnpackFn unpack_fn_;
+  uint8_t bound_return_mode_;   ///< return mode unpack_fn_ was chosen for
+  uint8_t bound_sensor_model_;  ///< sensor model unpack_fn_ was chosen for
+
+  bool needsBind(uint8_t return_mode, uint8_t sensor_model) const;
+  void bindDecoder(uint8_t return_mode, uint8_t sensor_model);
+
+  /** HDL-32E, HDL-64E and VLP-32C packets, see sensor_traits.h **/
+  template<typename Traits>
+  void unpack_hdl(
+    const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data,
+    int first_block, int end_block);
+
+  /** VLP-16 and VLS-128 packets, converted a block at a time **/
+  template<typename Traits, bool dual_return>
+  void unpack_blocks(
+    const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data,
+    int first_block, int end_block);
 
   /** in-line test whether a point is in range */
   bool pointInRange(float range)
@@ -0,0 +1,137 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Compile-time description of each Velodyne sensor family.
+ *
+ *  RawData instantiates one decoder per family and return mode from
+ *  these, so the decoding loops hold no model checks.  Supporting a
+ *  new model means adding a traits struct and selecting it in
+ *  RawData::bindDecoder().
+ *
+ *  Every family provides:
+ *
+ *    - name(): model name for the log
+ *    - LASERS: lasers in the calibration
+ *    - bank(header): laser bank of a block header, -1 if invalid
+ *    - laser(bank, lane): laser of each of the 32 returns in a block
+ *    - firingTime(block, lane): time of a return after the packet
+ *      stamp [s]
+ *
+ *  The families converted by the block kernels also provide:
+ *
+ *    - DUAL_BLANK_BLOCKS: empty blocks at the end of dual return packets
+ *    - azimuthFraction(bank, lane): share of the rotation to the next
+ *      block made before the return's laser fires
+ *    - distanceResolution(calibration): meters per distance unit
+ */
+
+#ifndef __VELODYNE_SENSOR_TRAITS_H
+#define __VELODYNE_SENSOR_TRAITS_H
+
+#include <stdint.h>
+
+#include <velodyne_pointcloud/calibration.h>
+#include <velodyne_pointcloud/rawdata.h>
+
+namespace velodyne_rawdata
+{
+/** \brief VLP-16 and Puck Hi-Res: two firings of 16 lasers per block */
+struct VLP16Traits
+{
+  static constexpr const char * name() {return "VLP-16";}
+  static constexpr int LASERS = 16;
+  static constexpr int DUAL_BLANK_BLOCKS = 0;
+
+  static constexpr int bank(uint16_t header) {return header == UPPER_BANK ? 0 : -1;}
+  static constexpr int laser(int /* bank */, int lane) {return lane % VLP16_SCANS_PER_FIRING;}
+
+  static constexpr float azimuthFraction(int /* bank */, int lane)
+  {
+    return ((lane % VLP16_SCANS_PER_FIRING) * VLP16_DSR_TOFFSET +
+           (lane / VLP16_SCANS_PER_FIRING) * VLP16_FIRING_TOFFSET) / VLP16_BLOCK_TDURATION;
+  }
+  static constexpr double firingTime(int block, int lane)
+  {
+    return (block * 2 + lane / VLP16_SCANS_PER_FIRING) * 55.296 / 1000.0 / 1000.0 +
+           (lane % VLP16_SCANS_PER_FIRING) * 2.304 / 1000.0 / 1000.0;
+  }
+  static float distanceResolution(const velodyne_pointcloud::Calibration & calibration)
+  {
+    return calibration.distance_resolution_m;
+  }
+};
+
+/** \brief VLS-128: four banks of 32 lasers, fired 8 at a time */
+struct VLS128Traits
+{
+  static constexpr const char * name() {return "VLS-128";}
+  static constexpr int LASERS = 128;
+  static constexpr int DUAL_BLANK_BLOCKS = 4;
+
+  static constexpr int bank(uint16_t header)
+  {
+    return header == VLS128_BANK_1 ? 0 :
+           header == VLS128_BANK_2 ? 1 :
+           header == VLS128_BANK_3 ? 2 :
+           header == VLS128_BANK_4 ? 3 : -1;
+  }
+  static constexpr int laser(int bank, int lane) {return bank * SCANS_PER_BLOCK + lane;}
+
+  static constexpr float azimuthFraction(int bank, int lane)
+  {
+    // firing groups of 8, with a recharge after every 8 groups
+    return (VLS128_CHANNEL_TDURATION / VLS128_SEQ_TDURATION) *
+           (laser(bank, lane) / 8 + laser(bank, lane) / 64);
+  }
+  static constexpr double firingTime(int block, int lane)
+  {
+    return block * 55.3 / 1000.0 / 1000.0 + lane * 2.665 / 1000.0 / 1000.0;
+  }
+  static float distanceResolution(const velodyne_pointcloud::Calibration & /* calibration */)
+  {
+    return VLP128_DISTANCE_RESOLUTION;
+  }
+};
+
+/** \brief HDL-64E: upper and lower banks of 32 lasers */
+struct HDL64ETraits
+{
+  static constexpr const char * name() {return "HDL-64E";}
+  static constexpr int LASERS = 64;
+
+  static constexpr int bank(uint16_t header) {return header == LOWER_BANK ? 1 : 0;}
+  static constexpr int laser(int bank, int lane) {return bank * SCANS_PER_BLOCK + lane;}
+  static constexpr double firingTime(int block, int lane)
+  {
+    return block * 55.296 / 1000.0 / 1000.0 + lane * 2.304 / 1000.0 / 1000.0;
+  }
+};
+
+/** \brief HDL-32E: 32 lasers in every block */
+struct HDL32ETraits
+{
+  static constexpr const char * name() {return "HDL-32E";}
+  static constexpr int LASERS = 32;
+
+  static constexpr int bank(uint16_t /* header */) {return 0;}
+  static constexpr int laser(int /* bank */, int lane) {return lane;}
+  static constexpr double firingTime(int block, int lane)
+  {
+    return block * 55.296 / 1000.0 / 1000.0 + lane * 2.304 / 1000.0 / 1000.0;
+  }
+};
+
+/** \brief VLP-32C: laid out as the HDL-32E */
+struct VLP32CTraits : HDL32ETraits
+{
+  static constexpr const char * name() {return "VLP-32C";}
+};
+
+}  // namespace velodyne_rawdata
+
+#endif  // __VELODYNE_SENSOR_TRAITS_H
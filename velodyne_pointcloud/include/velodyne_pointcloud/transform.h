@@ -18,6 +18,12 @@
 #ifndef _VELODYNE_POINTCLOUD_TRANSFORM_H_
 #define _VELODYNE_POINTCLOUD_TRANSFORM_H_ 1
 
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <rclcpp/rclcpp.hpp>
 #include <sensor_msgs/msg/point_cloud2.hpp>
 #include <velodyne_msgs/msg/velodyne_scan.hpp>
@@ -25,6 +31,7 @@
 #include <tf2_ros/message_filter.h>
 #include <tf2_ros/transform_listener.h>
 
+#include <velodyne_driver/realtime.h>
 #include <velodyne_pointcloud/pointcloudXYZIR.h>
 #include <velodyne_pointcloud/rawdata.h>
 
@@ -46,6 +53,17 @@ public:
 
 private:
   void processScan(const velodyne_msgs::msg::VelodyneScan::ConstSharedPtr & scanMsg);
+  void applyCallbackPolicy();
+
+  /** \brief Points of one packet, before and after the transform. */
+  struct PacketClouds
+  {
+    PointcloudXYZIR inPc;                ///< input packet point cloud
+    velodyne_rawdata::VPointCloud tfPc;  ///< transformed packet point cloud
+    std::string error;                   ///< why the transform failed, empty if it did not
+  };
+  void transformPacket(
+    const velodyne_msgs::msg::VelodyneScan & scan, size_t packet, PacketClouds & clouds);
 
   /// Pointer to dynamic reconfigure service srv_
   rclcpp::node_interfaces::OnSetParametersCallbackHandle::SharedPtr set_param_res_;
@@ -69,11 +87,19 @@ private:
   } Config;
   Config config_;
 
-  // Point cloud buffers for collecting points within a packet.  The
-  // inPc_ and tfPc_ are class members only to avoid reallocation on
-  // every message.
-  PointcloudXYZIR inPc_;                ///< input packet point cloud
-  velodyne_rawdata::VPointCloud tfPc_;  ///< transformed packet point cloud
+  // Point cloud buffers for collecting the points of each packet of a
+  // scan, which the packets may be transformed into concurrently.  They
+  // are class members only to avoid reallocation on every message.
+  std::vector<PacketClouds> packet_clouds_;
+
+  /// threads transforming the packets of a scan, NULL to transform them serially
+  std::unique_ptr<velodyne_rawdata::DecodePool> decode_pool_;
+
+  // scheduling of the executor threads running processScan; it stays
+  // with the thread, for the callbacks of other nodes it runs as well
+  velodyne_driver::ThreadPolicy callback_policy_;
+  std::mutex policy_mutex_;
+  std::set<std::thread::id> policy_threads_;  ///< threads already set up by this node
 };
 
 }  // namespace velodyne_pointcloud
@@ -15,7 +15,10 @@
 
 #include <velodyne_pointcloud/convert.h>
 
+#include <algorithm>
+
 #include <pcl_conversions/pcl_conversions.h>
+#include <velodyne_pointcloud/pointcloud2XYZIRADT.h>
 #include <velodyne_pointcloud/pointcloudXYZIRADT.h>
 
 #include <yaml-cpp/yaml.h>
@@ -109,15 +112,27 @@ Convert::Convert(const rclcpp::NodeOptions & options)
   num_points_threshold_desc.integer_range.push_back(num_points_threshold_range);
   num_points_threshold_ = this->declare_parameter("num_points_threshold", 300, num_points_threshold_desc);
 
-  rcl_interfaces::msg::ParameterDescriptor scan_phase_desc;
-  scan_phase_desc.name = "scan_phase";
-  scan_phase_desc.type = rcl_interfaces::msg::ParameterType::PARAMETER_DOUBLE;
-  scan_phase_desc.description = "start/end phase for the scan (in degrees)";
-  rcl_interfaces::msg::FloatingPointRange scan_phase_range;
-  scan_phase_range.from_value = 0.0;
-  scan_phase_range.to_value = 359.0;
-  scan_phase_desc.floating_point_range.push_back(scan_phase_range);
-  config_.scan_phase = this->declare_parameter("scan_phase", 0.0, scan_phase_desc);
+  callback_policy_ = velodyne_driver::declareThreadPolicy(this, "callback");
+  if (this->declare_parameter("lock_memory", false)) {
+    velodyne_driver::lockMemory(this->get_logger());
+  }
+
+  // packets of a scan decoded in parallel, by the executor thread and
+  // decode_threads - 1 workers, which run as the executor threads do
+  rcl_interfaces::msg::ParameterDescriptor decode_threads_desc;
+  decode_threads_desc.name = "decode_threads";
+  decode_threads_desc.type = rcl_interfaces::msg::ParameterType::PARAMETER_INTEGER;
+  decode_threads_desc.description = "threads decoding the packets of a scan, 1 to decode them serially";
+  decode_threads_desc.read_only = true;
+  rcl_interfaces::msg::IntegerRange decode_threads_range;
+  decode_threads_range.from_value = 1;
+  decode_threads_range.to_value = 64;
+  decode_threads_desc.integer_range.push_back(decode_threads_range);
+  const int decode_threads = this->declare_parameter("decode_threads", 1, decode_threads_desc);
+  if (decode_threads > 1) {
+    decode_pool_ = std::make_unique<velodyne_rawdata::DecodePool>(
+      decode_threads, [this]() {applyCallbackPolicy();});
+  }
 
   RCLCPP_INFO(this->get_logger(), "correction angles: %s", calibration_file.c_str());
 
@@ -167,7 +182,6 @@ rcl_interfaces::msg::SetParametersResult Convert::paramCallback(const std::vecto
   }
 
   get_param(p, "num_points_threshold", num_points_threshold_);
-  get_param(p, "scan_phase", config_.scan_phase);
 
   std::vector<double> invalid_intensity_double;
   auto it = std::find_if(p.cbegin(), p.cend(), [](const rclcpp::Parameter & parameter) {
@@ -197,62 +211,61 @@ rcl_interfaces::msg::SetParametersResult Convert::paramCallback(const std::vecto
   return result;
 }
 
+/** @brief Pin the calling executor thread and raise its priority.
+ *
+ *  The executor owns its threads, so each one is set up on its first
+ *  callback of this node.  The policy applies to the whole thread,
+ *  including the callbacks of other nodes sharing the executor.
+ */
+void Convert::applyCallbackPolicy()
+{
+  if (callback_policy_.cpus.empty() && callback_policy_.priority <= 0) {
+    return;                     // leave the executor threads alone
+  }
+  {
+    std::lock_guard<std::mutex> lock(policy_mutex_);
+    if (!policy_threads_.insert(std::this_thread::get_id()).second) {
+      return;
+    }
+  }
+  velodyne_driver::applyThreadPolicy(callback_policy_, "velodyne_convert", this->get_logger());
+}
+
 /** @brief Callback for raw scan messages. */
 void Convert::processScan(const velodyne_msgs::msg::VelodyneScan::SharedPtr scanMsg)
 {
-  velodyne_pointcloud::PointcloudXYZIRADT scan_points_xyziradt;
-  if (
-    velodyne_points_pub_->get_subscription_count() > 0 ||
-    velodyne_points_ex_pub_->get_subscription_count() > 0 ||
-    velodyne_points_invalid_near_pub_->get_subscription_count() > 0 ||
-    velodyne_points_combined_ex_pub_->get_subscription_count() > 0) {
-    scan_points_xyziradt.pc->points.reserve(scanMsg->packets.size() * data_->scansPerPacket() + _overflow_buffer.pc->points.size());
-
-    // Add the overflow buffer points
-    for (size_t i = 0; i < _overflow_buffer.pc->points.size(); ++i) {
-      scan_points_xyziradt.pc->points.push_back(_overflow_buffer.pc->points[i]);
+  applyCallbackPolicy();
+
+  const bool want_points = velodyne_points_pub_->get_subscription_count() > 0;
+  const bool want_points_ex = velodyne_points_ex_pub_->get_subscription_count() > 0;
+  const bool want_invalid_near = velodyne_points_invalid_near_pub_->get_subscription_count() > 0;
+  const bool want_combined_ex = velodyne_points_combined_ex_pub_->get_subscription_count() > 0;
+
+  // Without the invalid points topics only the points in range are
+  // published, which are then decoded straight into the messages.
+  if ((want_points || want_points_ex) && !want_invalid_near && !want_combined_ex) {
+    Pointcloud2XYZIRADT scan_points_msgs(
+      scanMsg->packets.size() * data_->scansPerPacket(), data_->getMinRange(),
+      data_->getMaxRange(), want_points_ex, want_points);
+    data_->unpackScan(*scanMsg, scan_points_msgs, decode_pool_.get());
+    scan_points_msgs.finish(scanMsg->header, scanMsg->packets[0].stamp);
+    if (want_points) {
+      velodyne_points_pub_->publish(std::move(scan_points_msgs.xyzir));
     }
-    // Reset overflow buffer
-    _overflow_buffer.pc->points.clear();
-    _overflow_buffer.pc->width = 0;
-    _overflow_buffer.pc->height = 1;
-
-    // Unpack up until the last packet, which contains points over-running the scan cut point
-    for (size_t i = 0; i < scanMsg->packets.size() - 1; ++i) {
-      data_->unpack(scanMsg->packets[i], scan_points_xyziradt);
+    if (want_points_ex) {
+      velodyne_points_ex_pub_->publish(std::move(scan_points_msgs.xyziradt));
     }
-
-    // Split the points of the last packet between pointcloud and overflow buffer
-    velodyne_pointcloud::PointcloudXYZIRADT last_packet_points;
-    last_packet_points.pc->points.reserve(data_->scansPerPacket());
-    data_->unpack(scanMsg->packets.back(), last_packet_points);
-
-    // If it's a partial scan, put all points in the main pointcloud
-    int phase = (uint16_t)round(config_.scan_phase*100);
-    bool keep_all = false;
-    uint16_t last_packet_last_phase = (36000 + (uint16_t)last_packet_points.pc->points.back().azimuth - phase) % 36000;
-    uint16_t body_packets_last_phase = (36000 + (uint16_t)scan_points_xyziradt.pc->points.back().azimuth - phase) % 36000;
-
-    if (body_packets_last_phase < last_packet_last_phase) {
-      keep_all = true;
+    if (marker_array_pub_->get_subscription_count() > 0) {
+      const auto velodyne_model_marker = createVelodyneModelMakerMsg(scanMsg->header);
+      marker_array_pub_->publish(velodyne_model_marker);
     }
+    return;
+  }
 
-    // If it's a split packet, distribute to overflow buffer or main pointcloud based on azimuth
-    for (size_t i = 0; i < last_packet_points.pc->points.size(); ++i) {
-      uint16_t current_azimuth = (uint16_t)last_packet_points.pc->points[i].azimuth;
-      uint16_t phase_diff = (36000 + current_azimuth - phase) % 36000;
-      if ((phase_diff > 18000) || keep_all) {
-        scan_points_xyziradt.pc->points.push_back(last_packet_points.pc->points[i]);
-      }
-      else {
-        _overflow_buffer.pc->points.push_back(last_packet_points.pc->points[i]);
-      }
-    }
-    last_packet_points.pc->points.clear();
-    last_packet_points.pc->width = 0;
-    last_packet_points.pc->height = 1;
-    _overflow_buffer.pc->width = _overflow_buffer.pc->points.size();
-    _overflow_buffer.pc->height = 1;
+  velodyne_pointcloud::PointcloudXYZIRADT scan_points_xyziradt;
+  if (want_points || want_points_ex || want_invalid_near || want_combined_ex) {
+    scan_points_xyziradt.pc->points.reserve(scanMsg->packets.size() * data_->scansPerPacket());
+    data_->unpackScan(*scanMsg, scan_points_xyziradt, decode_pool_.get());
 
     scan_points_xyziradt.pc->header = pcl_conversions::toPCL(scanMsg->header);
 
@@ -272,19 +285,16 @@ void Convert::processScan(const velodyne_msgs::msg::VelodyneScan::SharedPtr scan
 
   pcl::PointCloud<velodyne_pointcloud::PointXYZIRADT>::Ptr valid_points_xyziradt(
     new pcl::PointCloud<velodyne_pointcloud::PointXYZIRADT>);
-  if (
-    velodyne_points_pub_->get_subscription_count() > 0 ||
-    velodyne_points_ex_pub_->get_subscription_count() > 0 ||
-    velodyne_points_combined_ex_pub_->get_subscription_count() > 0) {
+  if (want_points || want_points_ex || want_combined_ex) {
     valid_points_xyziradt =
       extractValidPoints(scan_points_xyziradt.pc, data_->getMinRange(), data_->getMaxRange());
-    if (velodyne_points_pub_->get_subscription_count() > 0) {
+    if (want_points) {
       const auto valid_points_xyzir = convert(valid_points_xyziradt);
       auto ros_pc_msg_ptr = std::make_unique<sensor_msgs::msg::PointCloud2>();
       pcl::toROSMsg(*valid_points_xyzir, *ros_pc_msg_ptr);
       velodyne_points_pub_->publish(std::move(ros_pc_msg_ptr));
     }
-    if (velodyne_points_ex_pub_->get_subscription_count() > 0) {
+    if (want_points_ex) {
       auto ros_pc_msg_ptr = std::make_unique<sensor_msgs::msg::PointCloud2>();
       pcl::toROSMsg(*valid_points_xyziradt, *ros_pc_msg_ptr);
       velodyne_points_ex_pub_->publish(std::move(ros_pc_msg_ptr));
@@ -293,14 +303,12 @@ void Convert::processScan(const velodyne_msgs::msg::VelodyneScan::SharedPtr scan
 
   pcl::PointCloud<velodyne_pointcloud::PointXYZIRADT>::Ptr invalid_near_points_filtered_xyziradt(
     new pcl::PointCloud<velodyne_pointcloud::PointXYZIRADT>);
-  if (
-    velodyne_points_invalid_near_pub_->get_subscription_count() > 0 ||
-    velodyne_points_combined_ex_pub_->get_subscription_count() > 0) {
+  if (want_invalid_near || want_combined_ex) {
     const size_t num_lasers = data_->getNumLasers();
     const auto sorted_invalid_points_xyziradt = sortZeroIndex(scan_points_xyziradt.pc, num_lasers);
     invalid_near_points_filtered_xyziradt = extractInvalidNearPointsFiltered(
       sorted_invalid_points_xyziradt, invalid_intensity_array_, num_lasers, num_points_threshold_);
-    if (velodyne_points_invalid_near_pub_->get_subscription_count() > 0) {
+    if (want_invalid_near) {
       const auto invalid_near_points_filtered_xyzir =
         convert(invalid_near_points_filtered_xyziradt);
       auto ros_pc_msg_ptr = std::make_unique<sensor_msgs::msg::PointCloud2>();
@@ -311,7 +319,7 @@ void Convert::processScan(const velodyne_msgs::msg::VelodyneScan::SharedPtr scan
 
   pcl::PointCloud<velodyne_pointcloud::PointXYZIRADT>::Ptr combined_points_xyziradt(
     new pcl::PointCloud<velodyne_pointcloud::PointXYZIRADT>);
-  if (velodyne_points_combined_ex_pub_->get_subscription_count() > 0) {
+  if (want_combined_ex) {
     combined_points_xyziradt->points.reserve(
       valid_points_xyziradt->points.size() + invalid_near_points_filtered_xyziradt->points.size());
     combined_points_xyziradt->points.insert(
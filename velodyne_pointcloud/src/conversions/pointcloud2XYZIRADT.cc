@@ -0,0 +1,247 @@
+/*
+ * Copyright 2015-2019 Autoware Foundation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <velodyne_pointcloud/pointcloud2XYZIRADT.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <rclcpp/time.hpp>
+
+namespace velodyne_pointcloud
+{
+// Field offsets of PointXYZIRADT and PointXYZIR, whose x, y, z are
+// padded to 16 bytes by PCL_ADD_POINT4D, and whose size is rounded up
+// to 16 bytes by EIGEN_ALIGN16.
+static const uint32_t XYZIRADT_POINT_STEP = 48;
+static const uint32_t XYZIR_POINT_STEP = 32;
+static const size_t X_OFFSET = 0;
+static const size_t Y_OFFSET = 4;
+static const size_t Z_OFFSET = 8;
+static const size_t INTENSITY_OFFSET = 16;
+static const size_t RING_OFFSET = 20;
+static const size_t AZIMUTH_OFFSET = 24;
+static const size_t DISTANCE_OFFSET = 28;
+static const size_t RETURN_TYPE_OFFSET = 32;
+static const size_t TIME_STAMP_OFFSET = 40;
+
+static sensor_msgs::msg::PointField makeField(
+  const std::string & name, uint32_t offset, uint8_t datatype)
+{
+  sensor_msgs::msg::PointField field;
+  field.name = name;
+  field.offset = offset;
+  field.datatype = datatype;
+  field.count = 1;
+  return field;
+}
+
+static sensor_msgs::msg::PointCloud2::UniquePtr makeCloud(
+  bool xyziradt, size_t max_points)
+{
+  typedef sensor_msgs::msg::PointField PointField;
+  auto cloud = std::make_unique<sensor_msgs::msg::PointCloud2>();
+  cloud->fields.push_back(makeField("x", X_OFFSET, PointField::FLOAT32));
+  cloud->fields.push_back(makeField("y", Y_OFFSET, PointField::FLOAT32));
+  cloud->fields.push_back(makeField("z", Z_OFFSET, PointField::FLOAT32));
+  cloud->fields.push_back(makeField("intensity", INTENSITY_OFFSET, PointField::FLOAT32));
+  cloud->fields.push_back(makeField("ring", RING_OFFSET, PointField::UINT16));
+  if (xyziradt) {
+    cloud->fields.push_back(makeField("azimuth", AZIMUTH_OFFSET, PointField::FLOAT32));
+    cloud->fields.push_back(makeField("distance", DISTANCE_OFFSET, PointField::FLOAT32));
+    cloud->fields.push_back(makeField("return_type", RETURN_TYPE_OFFSET, PointField::UINT8));
+    cloud->fields.push_back(makeField("time_stamp", TIME_STAMP_OFFSET, PointField::FLOAT64));
+  }
+  cloud->height = 1;
+  cloud->width = 0;
+  cloud->is_bigendian = false;
+  cloud->point_step = xyziradt ? XYZIRADT_POINT_STEP : XYZIR_POINT_STEP;
+  cloud->is_dense = true;
+  // allocated, and the padding zeroed, once per scan
+  cloud->data.resize(max_points * cloud->point_step);
+  return cloud;
+}
+
+/** @brief Convert nanoseconds to a stamp, at the microsecond resolution
+ *  of the PCL header the PCL containers pass it through. */
+static builtin_interfaces::msg::Time toStamp(int64_t nanoseconds)
+{
+  return rclcpp::Time(nanoseconds / 1000 * 1000);
+}
+
+Pointcloud2XYZIRADT::Pointcloud2XYZIRADT(
+  size_t max_points, double min_range, double max_range,
+  bool want_xyziradt, bool want_xyzir)
+: min_range_(min_range),
+  max_range_(max_range),
+  points_added_(0),
+  points_kept_(0),
+  first_time_stamp_(0.0)
+{
+  if (want_xyziradt) {
+    xyziradt = makeCloud(true, max_points);
+  }
+  if (want_xyzir) {
+    xyzir = makeCloud(false, max_points);
+  }
+}
+
+void Pointcloud2XYZIRADT::addPoint(
+  const float & x, const float & y, const float & z,
+  const uint8_t & return_type, const uint16_t & ring, const uint16_t & azimuth,
+  const float & distance, const float & intensity, const double & time_stamp)
+{
+  velodyne_rawdata::PointBatch batch;
+  batch.size = 1;
+  batch.x = &x;
+  batch.y = &y;
+  batch.z = &z;
+  batch.return_type = &return_type;
+  batch.ring = &ring;
+  batch.azimuth = &azimuth;
+  batch.distance = &distance;
+  batch.intensity = &intensity;
+  batch.time_stamp = &time_stamp;
+  addPoints(batch);
+}
+
+/** @brief Make room for points, if max_points was too small. */
+void Pointcloud2XYZIRADT::reserve(size_t points)
+{
+  for (sensor_msgs::msg::PointCloud2 * cloud : {xyziradt.get(), xyzir.get()}) {
+    if (cloud && cloud->data.size() < points * cloud->point_step) {
+      cloud->data.resize(points * cloud->point_step);
+    }
+  }
+}
+
+/** @brief Write the points of a batch within range from a point index on.
+ *
+ *  @returns number of points written
+ */
+size_t Pointcloud2XYZIRADT::setPoints(
+  size_t index, const velodyne_rawdata::PointBatch & batch, size_t count)
+{
+  uint8_t * out_xyziradt = xyziradt ? &xyziradt->data[index * XYZIRADT_POINT_STEP] : NULL;
+  uint8_t * out_xyzir = xyzir ? &xyzir->data[index * XYZIR_POINT_STEP] : NULL;
+  size_t written = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!(batch.distance[i] >= min_range_ && batch.distance[i] <= max_range_)) {
+      continue;
+    }
+    if (out_xyziradt) {
+      const float azimuth = batch.azimuth[i];
+      memcpy(out_xyziradt + X_OFFSET, &batch.x[i], sizeof(float));
+      memcpy(out_xyziradt + Y_OFFSET, &batch.y[i], sizeof(float));
+      memcpy(out_xyziradt + Z_OFFSET, &batch.z[i], sizeof(float));
+      memcpy(out_xyziradt + INTENSITY_OFFSET, &batch.intensity[i], sizeof(float));
+      memcpy(out_xyziradt + RING_OFFSET, &batch.ring[i], sizeof(uint16_t));
+      memcpy(out_xyziradt + AZIMUTH_OFFSET, &azimuth, sizeof(float));
+      memcpy(out_xyziradt + DISTANCE_OFFSET, &batch.distance[i], sizeof(float));
+      out_xyziradt[RETURN_TYPE_OFFSET] = batch.return_type[i];
+      memcpy(out_xyziradt + TIME_STAMP_OFFSET, &batch.time_stamp[i], sizeof(double));
+      out_xyziradt += XYZIRADT_POINT_STEP;
+    }
+    if (out_xyzir) {
+      memcpy(out_xyzir + X_OFFSET, &batch.x[i], sizeof(float));
+      memcpy(out_xyzir + Y_OFFSET, &batch.y[i], sizeof(float));
+      memcpy(out_xyzir + Z_OFFSET, &batch.z[i], sizeof(float));
+      memcpy(out_xyzir + INTENSITY_OFFSET, &batch.intensity[i], sizeof(float));
+      memcpy(out_xyzir + RING_OFFSET, &batch.ring[i], sizeof(uint16_t));
+      out_xyzir += XYZIR_POINT_STEP;
+    }
+    ++written;
+  }
+  return written;
+}
+
+void Pointcloud2XYZIRADT::addPoints(const velodyne_rawdata::PointBatch & batch)
+{
+  if (batch.size == 0) {
+    return;
+  }
+  if (points_added_ == 0) {
+    first_time_stamp_ = batch.time_stamp[0];
+  }
+  points_added_ += batch.size;
+  reserve(points_kept_ + batch.size);
+  points_kept_ += setPoints(points_kept_, batch, batch.size);
+}
+
+bool Pointcloud2XYZIRADT::beginSlices(size_t points)
+{
+  reserve(points_kept_ + points);
+  return true;
+}
+
+void Pointcloud2XYZIRADT::writeSlice(
+  velodyne_rawdata::PointSlice & slice, const velodyne_rawdata::PointBatch & batch)
+{
+  const size_t count = std::min(batch.size, slice.capacity - slice.size);
+  if (count == 0) {
+    return;
+  }
+  slice.size += setPoints(points_kept_ + slice.first + slice.size, batch, count);
+}
+
+void Pointcloud2XYZIRADT::endSlices(const std::vector<velodyne_rawdata::PointSlice> & slices)
+{
+  size_t end = points_kept_;
+  for (const velodyne_rawdata::PointSlice & slice : slices) {
+    if (slice.added > 0 && points_added_ == 0) {
+      first_time_stamp_ = slice.first_time_stamp;
+    }
+    points_added_ += slice.added;
+    for (sensor_msgs::msg::PointCloud2 * cloud : {xyziradt.get(), xyzir.get()}) {
+      if (cloud && slice.size > 0) {
+        memmove(
+          &cloud->data[end * cloud->point_step],
+          &cloud->data[(points_kept_ + slice.first) * cloud->point_step],
+          slice.size * cloud->point_step);
+      }
+    }
+    end += slice.size;
+  }
+  points_kept_ = end;
+}
+
+void Pointcloud2XYZIRADT::finish(
+  const std_msgs::msg::Header & header, const builtin_interfaces::msg::Time & fallback_stamp)
+{
+  std_msgs::msg::Header stamped = header;
+  if (points_added_ > 0) {
+    stamped.stamp = toStamp(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<double>(first_time_stamp_)).count());
+  } else {
+    stamped.stamp = toStamp(rclcpp::Time(fallback_stamp).nanoseconds());
+  }
+
+  for (sensor_msgs::msg::PointCloud2 * cloud : {xyziradt.get(), xyzir.get()}) {
+    if (!cloud) {
+      continue;
+    }
+    cloud->header = stamped;
+    cloud->width = points_kept_;
+    cloud->row_step = cloud->point_step * cloud->width;
+    cloud->data.resize(cloud->row_step);
+  }
+}
+}  // namespace velodyne_pointcloud
@@ -38,4 +38,19 @@ void PointcloudXYZIR::addPoint(
   pc->points.push_back(point);
   ++pc->width;
 }
+
+void PointcloudXYZIR::addPoints(const velodyne_rawdata::PointBatch & batch)
+{
+  const size_t first = pc->points.size();
+  pc->points.resize(first + batch.size);
+  velodyne_pointcloud::PointXYZIR * points = &pc->points[first];
+  for (size_t i = 0; i < batch.size; ++i) {
+    points[i].x = batch.x[i];
+    points[i].y = batch.y[i];
+    points[i].z = batch.z[i];
+    points[i].intensity = batch.intensity[i];
+    points[i].ring = batch.ring[i];
+  }
+  pc->width += batch.size;
+}
 }  // namespace velodyne_pointcloud
@@ -16,6 +16,9 @@
 
 #include <velodyne_pointcloud/pointcloudXYZIRADT.h>
 
+#include <algorithm>
+#include <vector>
+
 namespace velodyne_pointcloud
 {
 void PointcloudXYZIRADT::addPoint(
@@ -37,4 +40,58 @@ void PointcloudXYZIRADT::addPoint(
   pc->points.push_back(point);
   ++pc->width;
 }
+
+static void setPoints(
+  velodyne_pointcloud::PointXYZIRADT * points, const velodyne_rawdata::PointBatch & batch,
+  size_t count)
+{
+  for (size_t i = 0; i < count; ++i) {
+    points[i].x = batch.x[i];
+    points[i].y = batch.y[i];
+    points[i].z = batch.z[i];
+    points[i].intensity = batch.intensity[i];
+    points[i].return_type = batch.return_type[i];
+    points[i].ring = batch.ring[i];
+    points[i].azimuth = batch.azimuth[i];
+    points[i].distance = batch.distance[i];
+    points[i].time_stamp = batch.time_stamp[i];
+  }
+}
+
+void PointcloudXYZIRADT::addPoints(const velodyne_rawdata::PointBatch & batch)
+{
+  const size_t first = pc->points.size();
+  pc->points.resize(first + batch.size);
+  setPoints(&pc->points[first], batch, batch.size);
+  pc->width += batch.size;
+}
+
+bool PointcloudXYZIRADT::beginSlices(size_t points)
+{
+  slice_base_ = pc->points.size();
+  pc->points.resize(slice_base_ + points);
+  return true;
+}
+
+void PointcloudXYZIRADT::writeSlice(
+  velodyne_rawdata::PointSlice & slice, const velodyne_rawdata::PointBatch & batch)
+{
+  const size_t count = std::min(batch.size, slice.capacity - slice.size);
+  if (count == 0) {
+    return;
+  }
+  setPoints(&pc->points[slice_base_ + slice.first + slice.size], batch, count);
+  slice.size += count;
+}
+
+void PointcloudXYZIRADT::endSlices(const std::vector<velodyne_rawdata::PointSlice> & slices)
+{
+  auto end = pc->points.begin() + slice_base_;
+  for (const velodyne_rawdata::PointSlice & slice : slices) {
+    auto first = pc->points.begin() + slice_base_ + slice.first;
+    end = std::move(first, first + slice.size, end);
+  }
+  pc->width += (end - pc->points.begin()) - slice_base_;
+  pc->points.erase(end, pc->points.end());
+}
 }  // namespace velodyne_pointcloud
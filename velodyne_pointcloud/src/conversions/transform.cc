@@ -88,6 +88,25 @@ Transform::Transform(const rclcpp::NodeOptions & options)
 
   config_.frame_id = this->declare_parameter("frame_id", "odom");
 
+  callback_policy_ = velodyne_driver::declareThreadPolicy(this, "callback");
+
+  // packets of a scan transformed in parallel, by the executor thread
+  // and decode_threads - 1 workers, which run as the executor threads do
+  rcl_interfaces::msg::ParameterDescriptor decode_threads_desc;
+  decode_threads_desc.name = "decode_threads";
+  decode_threads_desc.type = rcl_interfaces::msg::ParameterType::PARAMETER_INTEGER;
+  decode_threads_desc.description = "threads decoding the packets of a scan, 1 to decode them serially";
+  decode_threads_desc.read_only = true;
+  rcl_interfaces::msg::IntegerRange decode_threads_range;
+  decode_threads_range.from_value = 1;
+  decode_threads_range.to_value = 64;
+  decode_threads_desc.integer_range.push_back(decode_threads_range);
+  const int decode_threads = this->declare_parameter("decode_threads", 1, decode_threads_desc);
+  if (decode_threads > 1) {
+    decode_pool_ = std::make_unique<velodyne_rawdata::DecodePool>(
+      decode_threads, [this]() {applyCallbackPolicy();});
+  }
+
   this->declare_parameter("calibration", "");
 
   // Read calibration.
@@ -133,6 +152,74 @@ rcl_interfaces::msg::SetParametersResult Transform::paramCallback(const std::vec
   return result;
 }
 
+/** @brief Unpack a packet of a scan and transform it into the target frame.
+ *
+ *  Runs concurrently for the packets of a scan, each with its own
+ *  clouds.
+ */
+void Transform::transformPacket(
+  const velodyne_msgs::msg::VelodyneScan & scan, size_t packet, PacketClouds & clouds)
+{
+  // clear input point cloud to handle this packet
+  clouds.inPc.pc->points.clear();
+  clouds.inPc.pc->width = 0;
+  clouds.inPc.pc->height = 1;
+  std_msgs::msg::Header header;
+  header.stamp = scan.packets[packet].stamp;
+  header.frame_id = scan.header.frame_id;
+  pcl_conversions::toPCL(header, clouds.inPc.pc->header);
+
+  // unpack the raw data, skipping the blocks of packets shared
+  // with the neighbouring scans that belong to them
+  int first_block;
+  int end_block;
+  velodyne_rawdata::RawData::scanBlocks(scan, packet, first_block, end_block);
+  data_->unpack(scan.packets[packet], clouds.inPc, first_block, end_block);
+
+  // clear transform point cloud for this packet
+  clouds.tfPc.points.clear();  // is this needed?
+  clouds.tfPc.width = 0;
+  clouds.tfPc.height = 1;
+  header.stamp = scan.packets[packet].stamp;
+  pcl_conversions::toPCL(header, clouds.tfPc.header);
+  clouds.tfPc.header.frame_id = config_.frame_id;
+  clouds.error.clear();
+
+  // transform the packet point cloud into the target frame
+  try {
+    RCLCPP_DEBUG_STREAM(this->get_logger(), 
+      "transforming from " << clouds.inPc.pc->header.frame_id << " to " << config_.frame_id);
+    pcl_ros::transformPointCloud(config_.frame_id, *(clouds.inPc.pc), clouds.tfPc, tf_buffer_);
+#if 0  // use the latest transform available, should usually work fine
+          pcl_ros::transformPointCloud(clouds.inPc.pc->header.frame_id,
+                                       ros::Time(0), *(clouds.inPc.pc),
+                                       config_.frame_id,
+                                       clouds.tfPc, tf_buffer_);
+#endif
+  } catch (tf2::TransformException & ex) {
+    clouds.error = ex.what();
+  }
+}
+
+/** @brief Pin the calling executor thread and raise its priority.
+ *
+ *  Set up on each thread's first callback of this node, as the
+ *  cloud node does.
+ */
+void Transform::applyCallbackPolicy()
+{
+  if (callback_policy_.cpus.empty() && callback_policy_.priority <= 0) {
+    return;                     // leave the executor threads alone
+  }
+  {
+    std::lock_guard<std::mutex> lock(policy_mutex_);
+    if (!policy_threads_.insert(std::this_thread::get_id()).second) {
+      return;
+    }
+  }
+  velodyne_driver::applyThreadPolicy(callback_policy_, "velodyne_xform", this->get_logger());
+}
+
 /** @brief Callback for raw scan messages.
    *
    *  @pre TF message filter has already waited until the transform to
@@ -140,6 +227,8 @@ rcl_interfaces::msg::SetParametersResult Transform::paramCallback(const std::vec
    */
 void Transform::processScan(const velodyne_msgs::msg::VelodyneScan::ConstSharedPtr & scanMsg)
 {
+  applyCallbackPolicy();
+
   if (output_->get_subscription_count() == 0 &&
     output_->get_intra_process_subscription_count() == 0)    // no one listening?
   {
@@ -152,48 +241,34 @@ void Transform::processScan(const velodyne_msgs::msg::VelodyneScan::ConstSharedP
   outMsg->header.frame_id = config_.frame_id;
   outMsg->height = 1;
 
-  // process each packet provided by the driver
-  for (size_t next = 0; next < scanMsg->packets.size(); ++next) {
-    // clear input point cloud to handle this packet
-    inPc_.pc->points.clear();
-    inPc_.pc->width = 0;
-    inPc_.pc->height = 1;
-    std_msgs::msg::Header header;
-    header.stamp = scanMsg->packets[next].stamp;
-    header.frame_id = scanMsg->header.frame_id;
-    pcl_conversions::toPCL(header, inPc_.pc->header);
-
-    // unpack the raw data
-    data_->unpack(scanMsg->packets[next], inPc_);
-
-    // clear transform point cloud for this packet
-    tfPc_.points.clear();  // is this needed?
-    tfPc_.width = 0;
-    tfPc_.height = 1;
-    header.stamp = scanMsg->packets[next].stamp;
-    pcl_conversions::toPCL(header, tfPc_.header);
-    tfPc_.header.frame_id = config_.frame_id;
-
-    // transform the packet point cloud into the target frame
-    try {
-      RCLCPP_DEBUG_STREAM(this->get_logger(), 
-        "transforming from " << inPc_.pc->header.frame_id << " to " << config_.frame_id);
-      pcl_ros::transformPointCloud(config_.frame_id, *(inPc_.pc), tfPc_, tf_buffer_);
-#if 0  // use the latest transform available, should usually work fine
-            pcl_ros::transformPointCloud(inPc_.pc->header.frame_id,
-                                         ros::Time(0), *(inPc_.pc),
-                                         config_.frame_id,
-                                         tfPc_, tf_buffer_);
-#endif
-    } catch (tf2::TransformException & ex) {
+  // process each packet provided by the driver, in parallel if the
+  // decoder allows, collecting the transformed points in packet order
+  const size_t packets = scanMsg->packets.size();
+  if (packet_clouds_.size() < packets) {
+    packet_clouds_.resize(packets);
+  }
+  auto transform_packet = [&](size_t packet) {
+      transformPacket(*scanMsg, packet, packet_clouds_[packet]);
+    };
+  if (decode_pool_ && data_->prepareScan(*scanMsg)) {
+    decode_pool_->run(packets, transform_packet);
+  } else {
+    for (size_t next = 0; next < packets; ++next) {
+      transform_packet(next);
+    }
+  }
+
+  for (size_t next = 0; next < packets; ++next) {
+    const PacketClouds & clouds = packet_clouds_[next];
+    if (!clouds.error.empty()) {
       // only log tf error once every 100 times
-      RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 1000 /* ms */, "%s", ex.what());
+      RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 1000 /* ms */, "%s", clouds.error.c_str());
       continue;  // skip this packet
     }
 
     // append transformed packet data to end of output message
-    outMsg->points.insert(outMsg->points.end(), tfPc_.points.begin(), tfPc_.points.end());
-    outMsg->width += tfPc_.points.size();
+    outMsg->points.insert(outMsg->points.end(), clouds.tfPc.points.begin(), clouds.tfPc.points.end());
+    outMsg->width += clouds.tfPc.points.size();
   }
 
   // publish the accumulated cloud message
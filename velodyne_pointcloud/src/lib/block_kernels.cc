@@ -0,0 +1,83 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Scalar block kernel and run time kernel selection.
+ */
+
+#include <velodyne_pointcloud/block_kernels.h>
+
+namespace velodyne_rawdata
+{
+/** @brief reference kernel, and the one used without SIMD support
+ *
+ *  Every operation here is mirrored, in the same order, by the
+ *  vector kernels.
+ */
+  void convertBlockScalar(
+    const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+    const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+    BlockPoints & points)
+  {
+    for (int lane = 0; lane < BLOCK_LANES; ++lane, data += 3) {
+      // Correct for the laser rotation as a function of timing during the firings.
+      // The azimuth is positive, so truncating x + 0.5 rounds half away from zero.
+      const float azimuth_f = azimuth + azimuth_diff * lanes.azimuth_fraction[lane];
+      int32_t azimuth_corrected = static_cast<int32_t>(azimuth_f + 0.5f) & 0xffff;
+      if (azimuth_corrected >= 36000) {
+        azimuth_corrected -= 36000;
+      }
+
+      const int32_t raw_distance = data[0] | (data[1] << 8);
+      const float distance =
+        static_cast<float>(raw_distance) * distance_resolution + lanes.dist_correction[lane];
+
+      const float cos_table = cos_rot_table[azimuth_corrected];
+      const float sin_table = sin_rot_table[azimuth_corrected];
+      const float cos_rot_angle = cos_table * lanes.cos_rot[lane] + sin_table * lanes.sin_rot[lane];
+      const float sin_rot_angle = sin_table * lanes.cos_rot[lane] - cos_table * lanes.sin_rot[lane];
+
+      // Use standard ROS coordinate system (right-hand rule).
+      const float xy_distance = distance * lanes.cos_vert[lane];
+      points.x[lane] = xy_distance * cos_rot_angle;
+      points.y[lane] = -(xy_distance * sin_rot_angle);
+      points.z[lane] = distance * lanes.sin_vert[lane];
+      points.distance[lane] = distance;
+      points.intensity[lane] = data[2];
+      points.azimuth[lane] = azimuth_corrected;
+    }
+  }
+
+  BlockKernel scalarBlockKernel()
+  {
+    BlockKernel kernel = {&convertBlockScalar, "scalar"};
+    return kernel;
+  }
+
+  BlockKernel selectBlockKernel()
+  {
+#ifdef VELODYNE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      BlockKernel kernel = {&convertBlockAVX2, "AVX2"};
+      return kernel;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      BlockKernel kernel = {&convertBlockSSE41, "SSE4.1"};
+      return kernel;
+    }
+#endif
+#ifdef VELODYNE_SIMD_NEON
+    // NEON is part of every AArch64 CPU
+    BlockKernel kernel = {&convertBlockNEON, "NEON"};
+    return kernel;
+#endif
+    return scalarBlockKernel();
+  }
+
+} // namespace velodyne_rawdata
@@ -0,0 +1,82 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  AVX2 block kernel, 8 returns per instruction.  Only this file is
+ *  built with -mavx2, and it is only called when the CPU has AVX2.
+ */
+
+#include <immintrin.h>
+
+#include <velodyne_pointcloud/block_kernels.h>
+
+namespace velodyne_rawdata
+{
+  void convertBlockAVX2(
+    const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+    const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+    BlockPoints & points)
+  {
+    // The 24 bytes of 8 returns are loaded as bytes 0-15 and 8-23, so
+    // each 128 bit half holds 4 returns, then spread to 32 bit lanes.
+    const __m256i distance_shuffle = _mm256_setr_epi8(
+      0, 1, -1, -1, 3, 4, -1, -1, 6, 7, -1, -1, 9, 10, -1, -1,
+      4, 5, -1, -1, 7, 8, -1, -1, 10, 11, -1, -1, 13, 14, -1, -1);
+    const __m256i intensity_shuffle = _mm256_setr_epi8(
+      2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1,
+      6, -1, -1, -1, 9, -1, -1, -1, 12, -1, -1, -1, 15, -1, -1, -1);
+    const __m256 azimuth_v = _mm256_set1_ps(azimuth);
+    const __m256 azimuth_diff_v = _mm256_set1_ps(azimuth_diff);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256i low_16_bits = _mm256_set1_epi32(0xffff);
+    const __m256i rotation_max = _mm256_set1_epi32(36000);
+    const __m256i rotation_last = _mm256_set1_epi32(35999);
+    const __m256 resolution = _mm256_set1_ps(distance_resolution);
+    const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+
+    for (int lane = 0; lane < BLOCK_LANES; lane += 8, data += 24) {
+      const __m256i bytes = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 8)), 1);
+
+      const __m256 azimuth_f = _mm256_add_ps(
+        azimuth_v, _mm256_mul_ps(azimuth_diff_v, _mm256_loadu_ps(&lanes.azimuth_fraction[lane])));
+      __m256i azimuth_corrected = _mm256_and_si256(
+        _mm256_cvttps_epi32(_mm256_add_ps(azimuth_f, half)), low_16_bits);
+      azimuth_corrected = _mm256_sub_epi32(
+        azimuth_corrected,
+        _mm256_and_si256(_mm256_cmpgt_epi32(azimuth_corrected, rotation_last), rotation_max));
+
+      const __m256 raw_distance = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(bytes, distance_shuffle));
+      const __m256 distance = _mm256_add_ps(
+        _mm256_mul_ps(raw_distance, resolution), _mm256_loadu_ps(&lanes.dist_correction[lane]));
+
+      const __m256 cos_table = _mm256_i32gather_ps(cos_rot_table, azimuth_corrected, 4);
+      const __m256 sin_table = _mm256_i32gather_ps(sin_rot_table, azimuth_corrected, 4);
+      const __m256 cos_rot = _mm256_loadu_ps(&lanes.cos_rot[lane]);
+      const __m256 sin_rot = _mm256_loadu_ps(&lanes.sin_rot[lane]);
+      const __m256 cos_rot_angle =
+        _mm256_add_ps(_mm256_mul_ps(cos_table, cos_rot), _mm256_mul_ps(sin_table, sin_rot));
+      const __m256 sin_rot_angle =
+        _mm256_sub_ps(_mm256_mul_ps(sin_table, cos_rot), _mm256_mul_ps(cos_table, sin_rot));
+
+      const __m256 xy_distance = _mm256_mul_ps(distance, _mm256_loadu_ps(&lanes.cos_vert[lane]));
+      _mm256_storeu_ps(&points.x[lane], _mm256_mul_ps(xy_distance, cos_rot_angle));
+      _mm256_storeu_ps(
+        &points.y[lane], _mm256_xor_ps(_mm256_mul_ps(xy_distance, sin_rot_angle), sign_bit));
+      _mm256_storeu_ps(
+        &points.z[lane], _mm256_mul_ps(distance, _mm256_loadu_ps(&lanes.sin_vert[lane])));
+      _mm256_storeu_ps(&points.distance[lane], distance);
+      _mm256_storeu_ps(
+        &points.intensity[lane],
+        _mm256_cvtepi32_ps(_mm256_shuffle_epi8(bytes, intensity_shuffle)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(&points.azimuth[lane]), azimuth_corrected);
+    }
+  }
+
+} // namespace velodyne_rawdata
@@ -0,0 +1,86 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  AArch64 NEON block kernel, 4 returns per instruction.
+ */
+
+#include <arm_neon.h>
+
+#include <velodyne_pointcloud/block_kernels.h>
+
+namespace velodyne_rawdata
+{
+  void convertBlockNEON(
+    const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+    const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+    BlockPoints & points)
+  {
+    // as in the SSE4.1 kernel, every other load starts 4 bytes early
+    // so the last one ends at the last byte of the block; table
+    // indices past 15 give zero
+    static const uint8_t distance_index[2][16] = {
+      {0, 1, 255, 255, 3, 4, 255, 255, 6, 7, 255, 255, 9, 10, 255, 255},
+      {4, 5, 255, 255, 7, 8, 255, 255, 10, 11, 255, 255, 13, 14, 255, 255}};
+    static const uint8_t intensity_index[2][16] = {
+      {2, 255, 255, 255, 5, 255, 255, 255, 8, 255, 255, 255, 11, 255, 255, 255},
+      {6, 255, 255, 255, 9, 255, 255, 255, 12, 255, 255, 255, 15, 255, 255, 255}};
+    const float32x4_t azimuth_v = vdupq_n_f32(azimuth);
+    const float32x4_t azimuth_diff_v = vdupq_n_f32(azimuth_diff);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const uint32x4_t low_16_bits = vdupq_n_u32(0xffff);
+    const uint32x4_t rotation_max = vdupq_n_u32(36000);
+    const float32x4_t resolution = vdupq_n_f32(distance_resolution);
+
+    for (int lane = 0; lane < BLOCK_LANES; lane += 4) {
+      const int odd = (lane / 4) & 1;
+      const uint8x16_t bytes = vld1q_u8(data + lane * 3 - odd * 4);
+
+      const float32x4_t azimuth_f = vaddq_f32(
+        azimuth_v, vmulq_f32(azimuth_diff_v, vld1q_f32(&lanes.azimuth_fraction[lane])));
+      uint32x4_t azimuth_corrected =
+        vandq_u32(vcvtq_u32_f32(vaddq_f32(azimuth_f, half)), low_16_bits);
+      azimuth_corrected = vsubq_u32(
+        azimuth_corrected,
+        vandq_u32(vcgeq_u32(azimuth_corrected, rotation_max), rotation_max));
+
+      const float32x4_t raw_distance = vcvtq_f32_u32(
+        vreinterpretq_u32_u8(vqtbl1q_u8(bytes, vld1q_u8(distance_index[odd]))));
+      const float32x4_t distance = vaddq_f32(
+        vmulq_f32(raw_distance, resolution), vld1q_f32(&lanes.dist_correction[lane]));
+
+      uint32_t index[4];
+      vst1q_u32(index, azimuth_corrected);
+      const float cos_values[4] = {
+        cos_rot_table[index[0]], cos_rot_table[index[1]],
+        cos_rot_table[index[2]], cos_rot_table[index[3]]};
+      const float sin_values[4] = {
+        sin_rot_table[index[0]], sin_rot_table[index[1]],
+        sin_rot_table[index[2]], sin_rot_table[index[3]]};
+      const float32x4_t cos_table = vld1q_f32(cos_values);
+      const float32x4_t sin_table = vld1q_f32(sin_values);
+      const float32x4_t cos_rot = vld1q_f32(&lanes.cos_rot[lane]);
+      const float32x4_t sin_rot = vld1q_f32(&lanes.sin_rot[lane]);
+      const float32x4_t cos_rot_angle =
+        vaddq_f32(vmulq_f32(cos_table, cos_rot), vmulq_f32(sin_table, sin_rot));
+      const float32x4_t sin_rot_angle =
+        vsubq_f32(vmulq_f32(sin_table, cos_rot), vmulq_f32(cos_table, sin_rot));
+
+      const float32x4_t xy_distance = vmulq_f32(distance, vld1q_f32(&lanes.cos_vert[lane]));
+      vst1q_f32(&points.x[lane], vmulq_f32(xy_distance, cos_rot_angle));
+      vst1q_f32(&points.y[lane], vnegq_f32(vmulq_f32(xy_distance, sin_rot_angle)));
+      vst1q_f32(&points.z[lane], vmulq_f32(distance, vld1q_f32(&lanes.sin_vert[lane])));
+      vst1q_f32(&points.distance[lane], distance);
+      vst1q_f32(
+        &points.intensity[lane],
+        vcvtq_f32_u32(vreinterpretq_u32_u8(vqtbl1q_u8(bytes, vld1q_u8(intensity_index[odd])))));
+      vst1q_s32(&points.azimuth[lane], vreinterpretq_s32_u32(azimuth_corrected));
+    }
+  }
+
+} // namespace velodyne_rawdata
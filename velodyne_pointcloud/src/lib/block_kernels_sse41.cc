@@ -0,0 +1,88 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  SSE4.1 block kernel, 4 returns per instruction.  Only this file is
+ *  built with -msse4.1, and it is only called when the CPU has it.
+ */
+
+#include <smmintrin.h>
+
+#include <velodyne_pointcloud/block_kernels.h>
+
+namespace velodyne_rawdata
+{
+  void convertBlockSSE41(
+    const BlockLanes & lanes, const uint8_t * data, float azimuth, float azimuth_diff,
+    const float * cos_rot_table, const float * sin_rot_table, float distance_resolution,
+    BlockPoints & points)
+  {
+    // 4 returns are taken from bytes 0-11 of a load at their first
+    // byte, or bytes 4-15 of one 4 bytes earlier, so that the last
+    // load of the block ends at its last byte
+    const __m128i distance_shuffle[2] = {
+      _mm_setr_epi8(0, 1, -1, -1, 3, 4, -1, -1, 6, 7, -1, -1, 9, 10, -1, -1),
+      _mm_setr_epi8(4, 5, -1, -1, 7, 8, -1, -1, 10, 11, -1, -1, 13, 14, -1, -1)};
+    const __m128i intensity_shuffle[2] = {
+      _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1),
+      _mm_setr_epi8(6, -1, -1, -1, 9, -1, -1, -1, 12, -1, -1, -1, 15, -1, -1, -1)};
+    const __m128 azimuth_v = _mm_set1_ps(azimuth);
+    const __m128 azimuth_diff_v = _mm_set1_ps(azimuth_diff);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i low_16_bits = _mm_set1_epi32(0xffff);
+    const __m128i rotation_max = _mm_set1_epi32(36000);
+    const __m128i rotation_last = _mm_set1_epi32(35999);
+    const __m128 resolution = _mm_set1_ps(distance_resolution);
+    const __m128 sign_bit = _mm_set1_ps(-0.0f);
+
+    for (int lane = 0; lane < BLOCK_LANES; lane += 4) {
+      const int odd = (lane / 4) & 1;
+      const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + lane * 3 - odd * 4));
+
+      const __m128 azimuth_f = _mm_add_ps(
+        azimuth_v, _mm_mul_ps(azimuth_diff_v, _mm_loadu_ps(&lanes.azimuth_fraction[lane])));
+      __m128i azimuth_corrected = _mm_and_si128(
+        _mm_cvttps_epi32(_mm_add_ps(azimuth_f, half)), low_16_bits);
+      azimuth_corrected = _mm_sub_epi32(
+        azimuth_corrected,
+        _mm_and_si128(_mm_cmpgt_epi32(azimuth_corrected, rotation_last), rotation_max));
+
+      const __m128 raw_distance =
+        _mm_cvtepi32_ps(_mm_shuffle_epi8(bytes, distance_shuffle[odd]));
+      const __m128 distance = _mm_add_ps(
+        _mm_mul_ps(raw_distance, resolution), _mm_loadu_ps(&lanes.dist_correction[lane]));
+
+      // no gather before AVX2
+      const int a0 = _mm_extract_epi32(azimuth_corrected, 0);
+      const int a1 = _mm_extract_epi32(azimuth_corrected, 1);
+      const int a2 = _mm_extract_epi32(azimuth_corrected, 2);
+      const int a3 = _mm_extract_epi32(azimuth_corrected, 3);
+      const __m128 cos_table = _mm_setr_ps(
+        cos_rot_table[a0], cos_rot_table[a1], cos_rot_table[a2], cos_rot_table[a3]);
+      const __m128 sin_table = _mm_setr_ps(
+        sin_rot_table[a0], sin_rot_table[a1], sin_rot_table[a2], sin_rot_table[a3]);
+      const __m128 cos_rot = _mm_loadu_ps(&lanes.cos_rot[lane]);
+      const __m128 sin_rot = _mm_loadu_ps(&lanes.sin_rot[lane]);
+      const __m128 cos_rot_angle =
+        _mm_add_ps(_mm_mul_ps(cos_table, cos_rot), _mm_mul_ps(sin_table, sin_rot));
+      const __m128 sin_rot_angle =
+        _mm_sub_ps(_mm_mul_ps(sin_table, cos_rot), _mm_mul_ps(cos_table, sin_rot));
+
+      const __m128 xy_distance = _mm_mul_ps(distance, _mm_loadu_ps(&lanes.cos_vert[lane]));
+      _mm_storeu_ps(&points.x[lane], _mm_mul_ps(xy_distance, cos_rot_angle));
+      _mm_storeu_ps(&points.y[lane], _mm_xor_ps(_mm_mul_ps(xy_distance, sin_rot_angle), sign_bit));
+      _mm_storeu_ps(&points.z[lane], _mm_mul_ps(distance, _mm_loadu_ps(&lanes.sin_vert[lane])));
+      _mm_storeu_ps(&points.distance[lane], distance);
+      _mm_storeu_ps(
+        &points.intensity[lane], _mm_cvtepi32_ps(_mm_shuffle_epi8(bytes, intensity_shuffle[odd])));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(&points.azimuth[lane]), azimuth_corrected);
+    }
+  }
+
+} // namespace velodyne_rawdata
@@ -0,0 +1,111 @@
+/*
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/**
+ *  @file
+ *
+ *  Worker threads decoding the packets of a scan in parallel.
+ */
+
+#include <velodyne_pointcloud/decode_pool.h>
+
+namespace velodyne_rawdata
+{
+  DecodePool::DecodePool(size_t threads, const std::function<void()> & thread_init)
+  : generation_(0),
+    busy_workers_(0),
+    stopping_(false),
+    job_(NULL),
+    jobs_(0),
+    next_job_(0)
+  {
+    for (size_t i = 1; i < threads; ++i) {
+      workers_.emplace_back(&DecodePool::workerLoop, this, thread_init);
+    }
+  }
+
+  DecodePool::~DecodePool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for (std::thread & worker : workers_) {
+      worker.join();
+    }
+  }
+
+/** @brief Claim and run jobs until none are left. */
+  void DecodePool::runJobs()
+  {
+    for (;;) {
+      const size_t job = next_job_.fetch_add(1, std::memory_order_relaxed);
+      if (job >= jobs_) {
+        return;
+      }
+      (*job_)(job);
+    }
+  }
+
+  void DecodePool::run(size_t jobs, const std::function<void(size_t)> & job)
+  {
+    if (workers_.empty() || jobs < 2) {
+      for (size_t i = 0; i < jobs; ++i) {
+        job(i);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &job;
+      jobs_ = jobs;
+      next_job_.store(0, std::memory_order_relaxed);
+      busy_workers_ = workers_.size();
+      ++generation_;
+    }
+    start_cv_.notify_all();
+
+    runJobs();
+
+    // the job and its captures must outlive every worker's use of them
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] {return busy_workers_ == 0;});
+    job_ = NULL;
+  }
+
+  void DecodePool::workerLoop(std::function<void()> thread_init)
+  {
+    if (thread_init) {
+      thread_init();
+    }
+
+    uint64_t seen_generation = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_cv_.wait(lock, [&] {return stopping_ || generation_ != seen_generation;});
+        if (stopping_) {
+          return;
+        }
+        seen_generation = generation_;
+      }
+
+      runJobs();
+
+      bool last;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        last = (--busy_workers_ == 0);
+      }
+      if (last) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+} // namespace velodyne_rawdata
@@ -42,6 +42,7 @@
  */
 
 #include <math.h>
+#include <algorithm>
 #include <fstream>
 
 #include <angles/angles.h>
@@ -49,11 +50,107 @@
 #include <rclcpp/rclcpp.hpp>
 
 #include <velodyne_pointcloud/rawdata.h>
+#include <velodyne_pointcloud/sensor_traits.h>
 
 namespace velodyne_rawdata
 {
   inline float SQR(float val) {return val * val;}
 
+/** return type of the points of a single return packet */
+  inline uint8_t singleReturnType(uint8_t return_mode)
+  {
+    switch (return_mode) {
+      case RETURN_MODE_STRONGEST:
+        return RETURN_TYPE::SINGLE_STRONGEST;
+      case RETURN_MODE_LAST:
+        return RETURN_TYPE::SINGLE_LAST;
+      default:
+        return RETURN_TYPE::INVALID;
+    }
+  }
+
+/** points decoded from a packet, added to the container together */
+  class PacketPoints
+  {
+  public:
+    PacketPoints()
+    : size_(0) {}
+
+    void add(
+      float x, float y, float z, uint8_t return_type, uint16_t ring, uint16_t azimuth,
+      float distance, float intensity, double time_stamp)
+    {
+      x_[size_] = x;
+      y_[size_] = y;
+      z_[size_] = z;
+      return_type_[size_] = return_type;
+      ring_[size_] = ring;
+      azimuth_[size_] = azimuth;
+      distance_[size_] = distance;
+      intensity_[size_] = intensity;
+      time_stamp_[size_] = time_stamp;
+      ++size_;
+    }
+
+    void flush(DataContainerBase & data)
+    {
+      if (size_ == 0) {
+        return;
+      }
+      const PointBatch batch = {
+        size_, x_, y_, z_, return_type_, ring_, azimuth_, distance_, intensity_, time_stamp_};
+      data.addPoints(batch);
+      size_ = 0;
+    }
+
+  private:
+    static const int CAPACITY = BLOCKS_PER_PACKET * SCANS_PER_BLOCK;
+    size_t size_;
+    float x_[CAPACITY];
+    float y_[CAPACITY];
+    float z_[CAPACITY];
+    uint8_t return_type_[CAPACITY];
+    uint16_t ring_[CAPACITY];
+    uint16_t azimuth_[CAPACITY];
+    float distance_[CAPACITY];
+    float intensity_[CAPACITY];
+    double time_stamp_[CAPACITY];
+  };
+
+/** points of one packet, handed to its slice of the scan's container */
+  class SliceContainer : public DataContainerBase
+  {
+  public:
+    SliceContainer(DataContainerBase & data, PointSlice & slice)
+    : data_(data), slice_(slice) {}
+
+    void addPoint(
+      const float & x, const float & y, const float & z,
+      const uint8_t & return_type, const uint16_t & ring, const uint16_t & azimuth,
+      const float & distance, const float & intensity, const double & time_stamp) override
+    {
+      const PointBatch batch = {
+        1, &x, &y, &z, &return_type, &ring, &azimuth, &distance, &intensity, &time_stamp};
+      addPoints(batch);
+    }
+
+    void addPoints(const PointBatch & batch) override
+    {
+      if (batch.size == 0) {
+        return;
+      }
+      if (slice_.added == 0) {
+        slice_.first_time_stamp = batch.time_stamp[0];
+      }
+      slice_.added += batch.size;
+      data_.writeSlice(slice_, batch);
+    }
+
+  private:
+    DataContainerBase & data_;
+    PointSlice & slice_;
+  };
+
 ////////////////////////////////////////////////////////////////////////
 //
 // RawData base class implementation
@@ -61,7 +158,11 @@ namespace velodyne_rawdata
 ////////////////////////////////////////////////////////////////////////
 
   RawData::RawData(rclcpp::Node * node_ptr)
-  : node_ptr_(node_ptr)
+  : node_ptr_(node_ptr),
+    block_kernel_(selectBlockKernel()),
+    unpack_fn_(NULL),
+    bound_return_mode_(0),
+    bound_sensor_model_(0)
   {}
 
 /** Update parameters: conversions and update */
@@ -137,11 +238,6 @@ namespace velodyne_rawdata
       sin_rot_table_[rot_index] = sinf(rotation);
     }
 
-    for (uint8_t i = 0; i < 16; i++) {
-      vls_128_laser_azimuth_cache[i] = (VLS128_CHANNEL_TDURATION / VLS128_SEQ_TDURATION) *
-        (i + i / 8);
-    }
-
     return 0;
   }
 
@@ -172,53 +268,247 @@ namespace velodyne_rawdata
       sin_rot_table_[rot_index] = sinf(rotation);
     }
 
+    return 0;
+  }
 
-    for (uint8_t i = 0; i < 16; i++) {
-      vls_128_laser_azimuth_cache[i] = (VLS128_CHANNEL_TDURATION / VLS128_SEQ_TDURATION) *
-        (i + i / 8);
+/** @brief arrange the corrections of each return in a block
+ *
+ *  Lanes of the model's block layout, for each bank the model has.
+ */
+  template<typename Traits>
+  void RawData::setupBlockLanes()
+  {
+    RCLCPP_INFO(node_ptr_->get_logger(), "Converting blocks with the %s kernel", block_kernel_.name);
+
+    for (int bank = 0; bank * SCANS_PER_BLOCK < Traits::LASERS; ++bank) {
+      BlockLanes & lanes = block_lanes_[bank];
+      for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+        const velodyne_pointcloud::LaserCorrection & corrections =
+          calibration_.laser_corrections[Traits::laser(bank, lane)];
+        lanes.cos_vert[lane] = corrections.cos_vert_correction;
+        lanes.sin_vert[lane] = corrections.sin_vert_correction;
+        lanes.cos_rot[lane] = corrections.cos_rot_correction;
+        lanes.sin_rot[lane] = corrections.sin_rot_correction;
+        lanes.dist_correction[lane] = corrections.dist_correction;
+        lanes.azimuth_fraction[lane] = Traits::azimuthFraction(bank, lane);
+      }
     }
-    return 0;
   }
 
 /** @brief convert raw packet to point cloud
    *
    *  @param pkt raw packet to unpack
    *  @param pc shared pointer to point cloud (points are appended)
+   *  @param first_block first data block to convert
+   *  @param end_block data block to stop at, the rest of the packet
+   *                   belongs to the next scan
    */
-  void RawData::unpack(const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data)
+  void RawData::unpack(
+    const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data,
+    int first_block, int end_block)
   {
-    using velodyne_pointcloud::LaserCorrection;
     RCLCPP_DEBUG_STREAM(
       node_ptr_->get_logger(), "Received packet, time: " << rclcpp::Time(
         pkt.stamp).seconds());
 
-    /** special parsing for the VLP16 **/
-    if (calibration_.num_lasers == 16) {
-      unpack_vlp16(pkt, data);
+    const uint8_t return_mode = pkt.data[1204];
+    const uint8_t sensor_model = pkt.data[1205];
+    if (needsBind(return_mode, sensor_model)) {
+      bindDecoder(return_mode, sensor_model);
+    }
+    (this->*unpack_fn_)(pkt, data, first_block, end_block);
+  }
+
+/** @brief tell whether the decoder must be chosen again for a packet
+ *
+ *  The factory bytes only change when the sensor is reconfigured,
+ *  except on the HDL-64E, which sends a rotating status type and
+ *  value in them.  Its decoder does not depend on them, so it is
+ *  chosen once and they are ignored.
+ */
+  bool RawData::needsBind(uint8_t return_mode, uint8_t sensor_model) const
+  {
+    if (unpack_fn_ == NULL) {
+      return true;
+    }
+    if (calibration_.num_lasers == HDL64ETraits::LASERS) {
+      return false;
+    }
+    return return_mode != bound_return_mode_ || sensor_model != bound_sensor_model_;
+  }
+
+  bool RawData::prepareScan(const velodyne_msgs::msg::VelodyneScan & scan)
+  {
+    if (scan.packets.empty()) {
+      return false;
+    }
+    const uint8_t return_mode = scan.packets[0].data[1204];
+    const uint8_t sensor_model = scan.packets[0].data[1205];
+    if (needsBind(return_mode, sensor_model)) {
+      bindDecoder(return_mode, sensor_model);
+    }
+    if (calibration_.num_lasers == HDL64ETraits::LASERS) {
+      return true;                      // status bytes, see needsBind()
+    }
+    for (const velodyne_msgs::msg::VelodynePacket & pkt : scan.packets) {
+      if (pkt.data[1204] != return_mode || pkt.data[1205] != sensor_model) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+/** @brief convert the data blocks of a scan
+ *
+ *  In parallel, each packet is decoded into its own slice of the
+ *  container, with room for the most points a packet holds.  Joining
+ *  the slices in packet order gives the points of the serial decoding,
+ *  in the same order, whichever thread decoded which packet.
+ */
+  void RawData::unpackScan(
+    const velodyne_msgs::msg::VelodyneScan & scan, DataContainerBase & data,
+    DecodePool * pool)
+  {
+    const size_t packets = scan.packets.size();
+    int first_block;
+    int end_block;
+
+    if (pool == NULL || pool->threads() < 2 || packets < 2 || !prepareScan(scan) ||
+      !data.beginSlices(packets * SCANS_PER_PACKET))
+    {
+      for (size_t i = 0; i < packets; ++i) {
+        scanBlocks(scan, i, first_block, end_block);
+        unpack(scan.packets[i], data, first_block, end_block);
+      }
       return;
     }
 
+    std::vector<PointSlice> slices(packets);
+    for (size_t i = 0; i < packets; ++i) {
+      slices[i].first = i * SCANS_PER_PACKET;
+      slices[i].capacity = SCANS_PER_PACKET;
+      slices[i].size = 0;
+      slices[i].added = 0;
+      slices[i].first_time_stamp = 0.0;
+    }
+    pool->run(
+      packets, [&](size_t i) {
+        int first;
+        int end;
+        scanBlocks(scan, i, first, end);
+        SliceContainer slice(data, slices[i]);
+        (this->*unpack_fn_)(scan.packets[i], slice, first, end);
+      });
+    data.endSlices(slices);
+  }
+
+/** @brief select the decoder for a return mode and sensor model
+ *
+ *  The model reported by the sensor is checked against the
+ *  calibration, which decides when they disagree, since its laser
+ *  corrections are what the decoder indexes.
+ *
+ *  @param return_mode factory byte 1204 of the packets
+ *  @param sensor_model factory byte 1205 of the packets
+ */
+  void RawData::bindDecoder(uint8_t return_mode, uint8_t sensor_model)
+  {
+    const bool rebind = (unpack_fn_ != NULL);
+    int model_lasers = 0;
+    const char * model_name = "unknown";
+    switch (sensor_model) {
+      case SENSOR_MODEL_HDL32E:
+        model_lasers = 32;
+        model_name = "HDL-32E";
+        break;
+      case SENSOR_MODEL_VLP16:
+        model_lasers = 16;
+        model_name = "VLP-16";
+        break;
+      case SENSOR_MODEL_PUCK_HIRES:
+        model_lasers = 16;
+        model_name = "Puck Hi-Res";
+        break;
+      case SENSOR_MODEL_VLP32C:
+        model_lasers = 32;
+        model_name = "VLP-32C";
+        break;
+      case SENSOR_MODEL_VLS128:
+      case SENSOR_MODEL_VLS128_ALT:
+        model_lasers = 128;
+        model_name = "VLS-128";
+        break;
+      default:
+        // the HDL-64E does not report its model in these bytes
+        break;
+    }
+
+    int num_lasers = calibration_.num_lasers;
+    if (model_lasers != 0 && model_lasers != num_lasers && num_lasers != HDL64ETraits::LASERS) {
+      RCLCPP_WARN(
+        node_ptr_->get_logger(),
+        "Sensor reports a %s (model 0x%02x), but the calibration has %d lasers; "
+        "decoding for the calibration", model_name, sensor_model, num_lasers);
+    }
+
+    // one decoder instance per family and return mode, see sensor_traits.h
+    const bool dual_return = (return_mode == RETURN_MODE_DUAL);
+    if (num_lasers == VLP16Traits::LASERS) {
+      setupBlockLanes<VLP16Traits>();
+      unpack_fn_ = dual_return ?
+        &RawData::unpack_blocks<VLP16Traits, true> : &RawData::unpack_blocks<VLP16Traits, false>;
+    } else if (num_lasers == VLS128Traits::LASERS) {
+      setupBlockLanes<VLS128Traits>();
+      unpack_fn_ = dual_return ?
+        &RawData::unpack_blocks<VLS128Traits, true> : &RawData::unpack_blocks<VLS128Traits, false>;
+    } else if (num_lasers == HDL64ETraits::LASERS) {
+      unpack_fn_ = &RawData::unpack_hdl<HDL64ETraits>;
+      RCLCPP_INFO(node_ptr_->get_logger(), "Decoding HDL-64E packets, ignoring their status bytes");
+      return;
+    } else if (sensor_model == SENSOR_MODEL_VLP32C) {
+      unpack_fn_ = &RawData::unpack_hdl<VLP32CTraits>;
+    } else {
+      unpack_fn_ = &RawData::unpack_hdl<HDL32ETraits>;
+    }
+    if (rebind) {
+      RCLCPP_INFO(
+        node_ptr_->get_logger(),
+        "Sensor reconfigured to return mode %u, model 0x%02x", return_mode, sensor_model);
+    } else {
+      RCLCPP_INFO(
+        node_ptr_->get_logger(), "Detected a %s (model 0x%02x), return mode %u",
+        model_name, sensor_model, return_mode);
+    }
+    bound_return_mode_ = return_mode;
+    bound_sensor_model_ = sensor_model;
+  }
+
+/** @brief convert raw HDL packet to point cloud
+ *
+ *  @param pkt raw packet to unpack
+ *  @param pc shared pointer to point cloud (points are appended)
+ */
+  template<typename Traits>
+  void RawData::unpack_hdl(
+    const velodyne_msgs::msg::VelodynePacket & pkt, DataContainerBase & data,
+    int first_block, int end_block)
+  {
+    using velodyne_pointcloud::LaserCorrection;
     const raw_packet_t * raw = (const raw_packet_t *)&pkt.data[0];
+    // dual return packets are not told apart here yet
+    const uint8_t return_type = singleReturnType(pkt.data[1204]);
+    const double packet_time = rclcpp::Time(pkt.stamp).seconds();
+    PacketPoints points;
 
-    for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
-      // upper bank lasers are numbered [0..31]
+    for (int i = first_block; i < end_block; i++) {
+      // upper bank lasers are numbered [0..31], lower bank ones [32..63]
       // NOTE: this is a change from the old velodyne_common implementation
-
-      int bank_origin = 0;
-      if (raw->blocks[i].header == LOWER_BANK) {
-        // lower bank lasers are [32..63]
-        bank_origin = 32;
-      }
-      /** special parsing for the VLS128 **/
-      else if (calibration_.num_lasers == 128) {
-        unpack_vls128(pkt, data);
-        return;
-      }
+      const int bank = Traits::bank(raw->blocks[i].header);
 
       for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
         float x, y, z;
         float intensity;
-        const uint8_t laser_number = j + bank_origin;
+        const int laser_number = Traits::laser(bank, j);
 
         const LaserCorrection & corrections = calibration_.laser_corrections[laser_number];
 
@@ -344,80 +634,73 @@ namespace velodyne_rawdata
           intensity = (intensity < min_intensity) ? min_intensity : intensity;
           intensity = (intensity > max_intensity) ? max_intensity : intensity;
 
-          double time_stamp =
-            i * 55.296 / 1000.0 / 1000.0 + j * 2.304 / 1000.0 / 1000.0 +
-            rclcpp::Time(pkt.stamp).seconds();
-          // Temporary to stop compile error - fix to give VLP32 support
-          uint8_t return_mode = pkt.data[1204];
-          uint8_t return_type;
-          switch (return_mode) {
-            case RETURN_MODE_DUAL:
-              return_type = RETURN_TYPE::INVALID;
-              break;
-            case RETURN_MODE_STRONGEST:
-              return_type = RETURN_TYPE::SINGLE_STRONGEST;
-              break;
-            case RETURN_MODE_LAST:
-              return_type = RETURN_TYPE::SINGLE_LAST;
-              break;
-            default:
-              return_type = RETURN_TYPE::INVALID;
-          }
-          if (is_invalid_distance) {
-            data.addPoint(
-              x_coord, y_coord, z_coord, return_type, corrections.laser_ring,
-              raw->blocks[i].rotation, 0,
-              intensity, time_stamp);
-          } else {
-            data.addPoint(
-              x_coord, y_coord, z_coord, return_type, corrections.laser_ring,
-              raw->blocks[i].rotation, distance,
-              intensity, time_stamp);
-          }
+          double time_stamp = Traits::firingTime(i, j) + packet_time;
+          points.add(
+            x_coord, y_coord, z_coord, return_type, corrections.laser_ring,
+            raw->blocks[i].rotation, is_invalid_distance ? 0 : distance,
+            intensity, time_stamp);
         }
       }
     }
+    points.flush(data);
   }
 
-/** @brief convert raw VLP16 packet to point cloud
+/** @brief convert raw VLP16 or VLS128 packet to point cloud
  *
  *  @param pkt raw packet to unpack
  *  @param pc shared pointer to point cloud (points are appended)
  */
-  void RawData::unpack_vlp16(
+  template<typename Traits, bool dual_return>
+  void RawData::unpack_blocks(
     const velodyne_msgs::msg::VelodynePacket & pkt,
-    DataContainerBase & data)
+    DataContainerBase & data, int first_block, int end_block)
   {
     const raw_packet_t * raw = (const raw_packet_t *) &pkt.data[0];
     float last_azimuth_diff = 0;
-    uint16_t azimuth_next;
-    const uint8_t return_mode = pkt.data[1204];
-    const bool dual_return = (return_mode == RETURN_MODE_DUAL);
+    // only read before being set when a dual return scan starts at the
+    // last pair of blocks, whose rotations are the same
+    uint16_t azimuth_next = raw->blocks[BLOCKS_PER_PACKET - 1].rotation;
+    const uint8_t single_return_type = singleReturnType(pkt.data[1204]);
+    const double packet_time = rclcpp::Time(pkt.stamp).seconds();
+    const float distance_resolution = Traits::distanceResolution(calibration_);
+    BlockPoints points;
+    PacketPoints packet_points;
+
+    // rotation between the blocks before first_block, used for the last blocks
+    if (first_block >= 1 + dual_return) {
+      last_azimuth_diff = static_cast < float > ((36000 + raw->blocks[first_block].rotation -
+        raw->blocks[first_block - (1 + dual_return)].rotation) % 36000);
+    }
 
-    for (uint block = 0; block < BLOCKS_PER_PACKET; block++) {
+    // some models leave the last blocks of dual return packets empty
+    const int filled_blocks = BLOCKS_PER_PACKET - Traits::DUAL_BLANK_BLOCKS * dual_return;
+    const int blocks = std::min(end_block, filled_blocks);
+    for (int block = first_block; block < blocks; block++) {
       // Cache block for use.
       const raw_block_t & current_block = raw->blocks[block];
-      if (UPPER_BANK != raw->blocks[block].header) {
+
+      const int bank = Traits::bank(current_block.header);
+      if (bank < 0) {
         // Do not flood the log with messages, only issue at most one
         // of these warnings per minute.
         RCLCPP_WARN_STREAM_THROTTLE(
           node_ptr_->get_logger(), *node_ptr_->get_clock(),
-          60000 /* ms */, "skipping invalid VLS-128 packet: block " <<
+          60000 /* ms */, "skipping invalid " << Traits::name() << " packet: block " <<
             block << " header value is " <<
-            raw->blocks[block].header);
-        return; // bad packet: skip the rest
+            current_block.header);
+        break; // bad packet: skip the rest
       }
 
       float azimuth_diff;
       uint16_t azimuth;
 
       // Calculate difference between current and next block's azimuth angle.
-      if (block == 0) {
+      if (block == first_block) {
         azimuth = current_block.rotation;
       } else {
         azimuth = azimuth_next;
       }
-      if (block < static_cast < uint > (BLOCKS_PER_PACKET - (1 + dual_return))) {
+      if (block < BLOCKS_PER_PACKET - (1 + dual_return)) {
         // Get the next block rotation to calculate how far we rotate between blocks.
         azimuth_next = raw->blocks[block + (1 + dual_return)].rotation;
 
@@ -430,8 +713,7 @@ namespace velodyne_rawdata
         // This makes the assumption the difference between the last block and the next packet is the
         // same as the last to the second to last.
         // Assumes RPM doesn't change much between blocks.
-        azimuth_diff = (block == static_cast < uint > (
-            BLOCKS_PER_PACKET - dual_return - 1) ? 0 : last_azimuth_diff);
+        azimuth_diff = (block == filled_blocks - dual_return - 1) ? 0 : last_azimuth_diff;
       }
 
       // Condition added to avoid calculating points which are not in the interesting defined area
@@ -439,216 +721,15 @@ namespace velodyne_rawdata
       if ((config_.min_angle < config_.max_angle && azimuth >= config_.min_angle &&
         azimuth <= config_.max_angle) || (config_.min_angle > config_.max_angle))
       {
-        for (int firing = 0, k = 0; firing < VLP16_FIRINGS_PER_BLOCK; ++firing) {
-          for (int dsr = 0; dsr < VLP16_SCANS_PER_FIRING; dsr++, k += RAW_SCAN_SIZE) {
-            union two_bytes current_return;
-            union two_bytes other_return;
-            // Distance extraction.
-            current_return.bytes[0] = current_block.data[k];
-            current_return.bytes[1] = current_block.data[k + 1];
-
-            if (dual_return) {
-              other_return.bytes[0] = block %
-                2 ? raw->blocks[block - 1].data[k] : raw->blocks[block + 1].data[k];
-              other_return.bytes[1] = block %
-                2 ? raw->blocks[block - 1].data[k + 1] : raw->blocks[block + 1].data[k + 1];
-            }
-            // Do not process if there is no return, or in dual return mode and the first and last echos are the same.
-            if ((current_return.bytes[0] == 0 && current_return.bytes[1] == 0) ||
-              (dual_return && block % 2 && other_return.bytes[0] == current_return.bytes[0] &&
-              other_return.bytes[1] == current_return.bytes[1]))
-            {
-              continue;
-            }
-            {
-              velodyne_pointcloud::LaserCorrection & corrections =
-                calibration_.laser_corrections[dsr];
-              float distance = current_return.uint * calibration_.distance_resolution_m;
-              bool is_invalid_distance = false;
-              if (distance < 1e-6) {
-                is_invalid_distance = true;
-                distance = 0.3;
-              } else {
-                distance += corrections.dist_correction;
-              }
-
-              // Correct for the laser rotation as a function of timing during the firings.
-              const float azimuth_corrected_f = azimuth +
-                (azimuth_diff * ((dsr * VLP16_DSR_TOFFSET) + (firing * VLP16_FIRING_TOFFSET)) /
-                VLP16_BLOCK_TDURATION);
-              const uint16_t azimuth_corrected =
-                (static_cast < uint16_t > (round(azimuth_corrected_f))) % 36000;
-
-              // Condition added to avoid calculating points which are not in the interesting defined area
-              // (min_angle < area < max_angle).
-              if ((azimuth_corrected >= config_.min_angle &&
-                azimuth_corrected <= config_.max_angle &&
-                config_.min_angle < config_.max_angle) ||
-                (config_.min_angle > config_.max_angle &&
-                (azimuth_corrected <= config_.max_angle ||
-                azimuth_corrected >= config_.min_angle)))
-              {
+        // returns without an echo are converted too, and skipped below
+        block_kernel_.convert(
+          block_lanes_[bank], current_block.data, azimuth, azimuth_diff,
+          cos_rot_table_, sin_rot_table_, distance_resolution, points);
 
-                // Convert polar coordinates to Euclidean XYZ.
-                const float cos_vert_angle = corrections.cos_vert_correction;
-                const float sin_vert_angle = corrections.sin_vert_correction;
-                const float cos_rot_correction = corrections.cos_rot_correction;
-                const float sin_rot_correction = corrections.sin_rot_correction;
-
-                const float cos_rot_angle =
-                  cos_rot_table_[azimuth_corrected] * cos_rot_correction +
-                  sin_rot_table_[azimuth_corrected] * sin_rot_correction;
-                const float sin_rot_angle =
-                  sin_rot_table_[azimuth_corrected] * cos_rot_correction -
-                  cos_rot_table_[azimuth_corrected] * sin_rot_correction;
-
-                // Compute the distance in the xy plane (w/o accounting for rotation).
-                const float xy_distance = distance * cos_vert_angle;
-
-                // Use standard ROS coordinate system (right-hand rule).
-                const float x_coord = xy_distance * cos_rot_angle;  // velodyne y
-                const float y_coord = -(xy_distance * sin_rot_angle); // velodyne x
-                const float z_coord = distance * sin_vert_angle;    // velodyne z
-                const float intensity = current_block.data[k + 2];
-
-                const double time_stamp = (block * 2 + firing) * 55.296 / 1000.0 / 1000.0 +
-                  dsr * 2.304 / 1000.0 / 1000.0 + rclcpp::Time(pkt.stamp).seconds();
-
-                // Determine return type.
-                uint8_t return_type;
-                switch (return_mode) {
-                  case RETURN_MODE_DUAL:
-                    if ((other_return.bytes[0] == 0 && other_return.bytes[1] == 0) ||
-                      (other_return.bytes[0] == current_return.bytes[0] &&
-                      other_return.bytes[1] == current_return.bytes[1]))
-                    {
-                      return_type = RETURN_TYPE::DUAL_ONLY;
-                    } else {
-                      const float other_intensity = block %
-                        2 ? raw->blocks[block - 1].data[k + 2] : raw->blocks[block + 1].data[k + 2];
-                      bool first = other_return.uint < current_return.uint ? 0 : 1;
-                      bool strongest = other_intensity < intensity ? 1 : 0;
-                      if (other_intensity == intensity) {
-                        strongest = first ? 0 : 1;
-                      }
-                      if (first && strongest) {
-                        return_type = RETURN_TYPE::DUAL_STRONGEST_FIRST;
-                      } else if (!first && strongest) {
-                        return_type = RETURN_TYPE::DUAL_STRONGEST_LAST;
-                      } else if (first && !strongest) {
-                        return_type = RETURN_TYPE::DUAL_WEAK_FIRST;
-                      } else if (!first && !strongest) {
-                        return_type = RETURN_TYPE::DUAL_WEAK_LAST;
-                      } else {
-                        return_type = RETURN_TYPE::INVALID;
-                      }
-                    }
-                    break;
-                  case RETURN_MODE_STRONGEST:
-                    return_type = RETURN_TYPE::SINGLE_STRONGEST;
-                    break;
-                  case RETURN_MODE_LAST:
-                    return_type = RETURN_TYPE::SINGLE_LAST;
-                    break;
-                  default:
-                    return_type = RETURN_TYPE::INVALID;
-                }
-                if (is_invalid_distance) {
-                  data.addPoint(
-                    x_coord, y_coord, z_coord, return_type, corrections.laser_ring,
-                    azimuth_corrected, 0, intensity, time_stamp);
-                } else {
-                  data.addPoint(
-                    x_coord, y_coord, z_coord, return_type, corrections.laser_ring,
-                    azimuth_corrected, distance, intensity, time_stamp);
-                }
-              }
-            }
-          }
-        }
-      }
-    }
-  }
+        // the block holding the other return of a dual return pair
+        const raw_block_t & other_block = raw->blocks[block % 2 ? block - 1 : block + 1];
 
-/** @brief convert raw VLS128 packet to point cloud
- *
- *  @param pkt raw packet to unpack
- *  @param pc shared pointer to point cloud (points are appended)
- */
-  void RawData::unpack_vls128(
-    const velodyne_msgs::msg::VelodynePacket & pkt,
-    DataContainerBase & data)
-  {
-    const raw_packet_t * raw = (const raw_packet_t *) &pkt.data[0];
-    float last_azimuth_diff = 0;
-    uint16_t azimuth_next;
-    const uint8_t return_mode = pkt.data[1204];
-    const bool dual_return = (return_mode == RETURN_MODE_DUAL);
-
-    for (uint block = 0; block < static_cast < uint > (BLOCKS_PER_PACKET - (4 * dual_return));
-      block++)
-    {
-      // Cache block for use.
-      const raw_block_t & current_block = raw->blocks[block];
-
-      uint bank_origin = 0;
-      // Used to detect which bank of 32 lasers is in this block.
-      switch (current_block.header) {
-        case VLS128_BANK_1:
-          bank_origin = 0;
-          break;
-        case VLS128_BANK_2:
-          bank_origin = 32;
-          break;
-        case VLS128_BANK_3:
-          bank_origin = 64;
-          break;
-        case VLS128_BANK_4:
-          bank_origin = 96;
-          break;
-        default:
-          // Do not flood the log with messages, only issue at most one
-          // of these warnings per minute.
-          RCLCPP_WARN_STREAM_THROTTLE(
-            node_ptr_->get_logger(), *node_ptr_->get_clock(),
-            60000 /* ms */, "skipping invalid VLS-128 packet: block " <<
-              block << " header value is " <<
-              raw->blocks[block].header);
-          return; // bad packet: skip the rest
-      }
-
-      float azimuth_diff;
-      uint16_t azimuth;
-
-      // Calculate difference between current and next block's azimuth angle.
-      if (block == 0) {
-        azimuth = current_block.rotation;
-      } else {
-        azimuth = azimuth_next;
-      }
-      if (block < static_cast < uint > (BLOCKS_PER_PACKET - (1 + dual_return))) {
-        // Get the next block rotation to calculate how far we rotate between blocks
-        azimuth_next = raw->blocks[block + (1 + dual_return)].rotation;
-
-        // Finds the difference between two sucessive blocks
-        azimuth_diff = static_cast < float > ((36000 + azimuth_next - azimuth) % 36000);
-
-        // This is used when the last block is next to predict rotation amount
-        last_azimuth_diff = azimuth_diff;
-      } else {
-        // This makes the assumption the difference between the last block and the next packet is the
-        // same as the last to the second to last.
-        // Assumes RPM doesn't change much between blocks.
-        azimuth_diff = (block == static_cast < uint > (BLOCKS_PER_PACKET - (4 * dual_return) - 1)) ?
-          0 : last_azimuth_diff;
-      }
-
-      // Condition added to avoid calculating points which are not in the interesting defined area
-      // (min_angle < area < max_angle).
-      if ((config_.min_angle < config_.max_angle && azimuth >= config_.min_angle &&
-        azimuth <= config_.max_angle) || (config_.min_angle > config_.max_angle))
-      {
-        for (uint j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
+        for (int lane = 0, k = 0; lane < SCANS_PER_BLOCK; lane++, k += RAW_SCAN_SIZE) {
           union two_bytes current_return;
           union two_bytes other_return;
           // Distance extraction.
@@ -656,10 +737,8 @@ namespace velodyne_rawdata
           current_return.bytes[1] = current_block.data[k + 1];
 
           if (dual_return) {
-            other_return.bytes[0] = block %
-              2 ? raw->blocks[block - 1].data[k] : raw->blocks[block + 1].data[k];
-            other_return.bytes[1] = block %
-              2 ? raw->blocks[block - 1].data[k + 1] : raw->blocks[block + 1].data[k + 1];
+            other_return.bytes[0] = other_block.data[k];
+            other_return.bytes[1] = other_block.data[k + 1];
           }
           // Do not process if there is no return, or in dual return mode and the first and last echos are the same.
           if ((current_return.bytes[0] == 0 && current_return.bytes[1] == 0) ||
@@ -668,115 +747,56 @@ namespace velodyne_rawdata
           {
             continue;
           }
+
+          const uint16_t azimuth_corrected = points.azimuth[lane];
+
+          // Condition added to avoid calculating points which are not in the interesting defined area
+          // (min_angle < area < max_angle).
+          if ((azimuth_corrected >= config_.min_angle &&
+            azimuth_corrected <= config_.max_angle &&
+            config_.min_angle < config_.max_angle) ||
+            (config_.min_angle > config_.max_angle &&
+            (azimuth_corrected <= config_.max_angle ||
+            azimuth_corrected >= config_.min_angle)))
           {
-            const uint laser_number = j + bank_origin; // offset the laser in this block by which block it's in
-            const uint firing_order = laser_number / 8; // VLS-128 fires 8 lasers at a time
-
-            velodyne_pointcloud::LaserCorrection & corrections =
-              calibration_.laser_corrections[laser_number];
-
-            float distance = current_return.uint * VLP128_DISTANCE_RESOLUTION;
-            bool is_invalid_distance = false;
-            if (distance < 1e-6) {
-              is_invalid_distance = true;
-              distance = 0.3;
-            } else {
-              distance += corrections.dist_correction;
-            }
+            const float intensity = points.intensity[lane];
+            const double time_stamp = Traits::firingTime(block, lane) + packet_time;
 
-            // Correct for the laser rotation as a function of timing during the firings.
-            const float azimuth_corrected_f = azimuth +
-              (azimuth_diff * vls_128_laser_azimuth_cache[firing_order]);
-            const uint16_t azimuth_corrected = ((uint16_t) round(azimuth_corrected_f)) % 36000;
-
-            // Condition added to avoid calculating points which are not in the interesting defined area
-            // (min_angle < area < max_angle).
-            if ((azimuth_corrected >= config_.min_angle &&
-              azimuth_corrected <= config_.max_angle &&
-              config_.min_angle < config_.max_angle) ||
-              (config_.min_angle > config_.max_angle &&
-              (azimuth_corrected <= config_.max_angle ||
-              azimuth_corrected >= config_.min_angle)))
-            {
-
-              // convert polar coordinates to Euclidean XYZ.
-              const float cos_vert_angle = corrections.cos_vert_correction;
-              const float sin_vert_angle = corrections.sin_vert_correction;
-              const float cos_rot_correction = corrections.cos_rot_correction;
-              const float sin_rot_correction = corrections.sin_rot_correction;
-
-              const float cos_rot_angle =
-                cos_rot_table_[azimuth_corrected] * cos_rot_correction +
-                sin_rot_table_[azimuth_corrected] * sin_rot_correction;
-              const float sin_rot_angle =
-                sin_rot_table_[azimuth_corrected] * cos_rot_correction -
-                cos_rot_table_[azimuth_corrected] * sin_rot_correction;
-
-              // Compute the distance in the xy plane (w/o accounting for rotation).
-              const float xy_distance = distance * cos_vert_angle;
-
-              // Use standard ROS coordinate system (right-hand rule).
-              const float x_coord = xy_distance * cos_rot_angle;  // velodyne y
-              const float y_coord = -(xy_distance * sin_rot_angle); // velodyne x
-              const float z_coord = distance * sin_vert_angle;    // velodyne z
-              const float intensity = current_block.data[k + 2];
-
-              const double time_stamp = block * 55.3 / 1000.0 / 1000.0 + j * 2.665 / 1000.0 /
-                1000.0 + rclcpp::Time(pkt.stamp).seconds();
-
-              // Determine return type.
-              uint8_t return_type;
-              switch (return_mode) {
-                case RETURN_MODE_DUAL:
-                  if ((other_return.bytes[0] == 0 && other_return.bytes[1] == 0) ||
-                    (other_return.bytes[0] == current_return.bytes[0] &&
-                    other_return.bytes[1] == current_return.bytes[1]))
-                  {
-                    return_type = RETURN_TYPE::DUAL_ONLY;
-                  } else {
-                    const float other_intensity = block %
-                      2 ? raw->blocks[block - 1].data[k + 2] : raw->blocks[block + 1].data[k + 2];
-                    bool first = other_return.uint < current_return.uint ? 0 : 1;
-                    bool strongest = other_intensity < intensity ? 1 : 0;
-                    if (other_intensity == intensity) {
-                      strongest = first ? 0 : 1;
-                    }
-                    if (first && strongest) {
-                      return_type = RETURN_TYPE::DUAL_STRONGEST_FIRST;
-                    } else if (!first && strongest) {
-                      return_type = RETURN_TYPE::DUAL_STRONGEST_LAST;
-                    } else if (first && !strongest) {
-                      return_type = RETURN_TYPE::DUAL_WEAK_FIRST;
-                    } else if (!first && !strongest) {
-                      return_type = RETURN_TYPE::DUAL_WEAK_LAST;
-                    } else {
-                      return_type = RETURN_TYPE::INVALID;
-                    }
-                  }
-                  break;
-                case RETURN_MODE_STRONGEST:
-                  return_type = RETURN_TYPE::SINGLE_STRONGEST;
-                  break;
-                case RETURN_MODE_LAST:
-                  return_type = RETURN_TYPE::SINGLE_LAST;
-                  break;
-                default:
-                  return_type = RETURN_TYPE::INVALID;
-              }
-              if (is_invalid_distance) {
-                data.addPoint(
-                  x_coord, y_coord, z_coord, return_type, corrections.laser_ring,
-                  azimuth_corrected, 0, intensity, time_stamp);
+            // Determine return type.
+            uint8_t return_type = single_return_type;
+            if (dual_return) {
+              if ((other_return.bytes[0] == 0 && other_return.bytes[1] == 0) ||
+                (other_return.bytes[0] == current_return.bytes[0] &&
+                other_return.bytes[1] == current_return.bytes[1]))
+              {
+                return_type = RETURN_TYPE::DUAL_ONLY;
               } else {
-                data.addPoint(
-                  x_coord, y_coord, z_coord, return_type, corrections.laser_ring,
-                  azimuth_corrected, distance, intensity, time_stamp);
+                const float other_intensity = other_block.data[k + 2];
+                bool first = other_return.uint < current_return.uint ? 0 : 1;
+                bool strongest = other_intensity < intensity ? 1 : 0;
+                if (other_intensity == intensity) {
+                  strongest = first ? 0 : 1;
+                }
+                if (first && strongest) {
+                  return_type = RETURN_TYPE::DUAL_STRONGEST_FIRST;
+                } else if (!first && strongest) {
+                  return_type = RETURN_TYPE::DUAL_STRONGEST_LAST;
+                } else if (first && !strongest) {
+                  return_type = RETURN_TYPE::DUAL_WEAK_FIRST;
+                } else {
+                  return_type = RETURN_TYPE::DUAL_WEAK_LAST;
+                }
               }
             }
+            packet_points.add(
+              points.x[lane], points.y[lane], points.z[lane], return_type,
+              calibration_.laser_corrections[Traits::laser(bank, lane)].laser_ring,
+              azimuth_corrected, points.distance[lane], intensity, time_stamp);
           }
         }
       }
     }
+    packet_points.flush(data);
   }
 
 } // namespace velodyne_rawdata
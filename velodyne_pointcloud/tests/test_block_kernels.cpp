@@ -0,0 +1,255 @@
+//
+//  License: Modified BSD Software License Agreement
+//
+
+//
+// C++ unit tests for the block conversion kernels: every kernel the
+// CPU runs must convert blocks as the scalar reference does.
+//
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+#include <velodyne_pointcloud/block_kernels.h>
+using namespace velodyne_rawdata;
+
+static const int ROTATION_MAX_UNITS = 36000;
+static const int BLOCK_DATA_SIZE = 96;
+
+struct BlockInput
+{
+  BlockLanes lanes;
+  uint8_t data[BLOCK_DATA_SIZE];
+  float azimuth;
+  float azimuth_diff;
+  float distance_resolution;
+};
+
+class BlockKernels : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    cos_rot_table_.resize(ROTATION_MAX_UNITS);
+    sin_rot_table_.resize(ROTATION_MAX_UNITS);
+    for (int i = 0; i < ROTATION_MAX_UNITS; ++i) {
+      const float rotation = i * 0.01f * M_PI / 180;
+      cos_rot_table_[i] = cosf(rotation);
+      sin_rot_table_[i] = sinf(rotation);
+    }
+  }
+
+  /** @returns the kernels this CPU runs, besides the scalar one */
+  static std::vector<BlockKernel> supportedKernels()
+  {
+    std::vector<BlockKernel> kernels;
+#ifdef VELODYNE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+      kernels.push_back(BlockKernel{&convertBlockSSE41, "SSE4.1"});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      kernels.push_back(BlockKernel{&convertBlockAVX2, "AVX2"});
+    }
+#endif
+#ifdef VELODYNE_SIMD_NEON
+    kernels.push_back(BlockKernel{&convertBlockNEON, "NEON"});
+#endif
+    return kernels;
+  }
+
+  /** corrections in the ranges of the calibration files, random returns */
+  static void randomInput(std::mt19937 & rng, BlockInput & input)
+  {
+    std::uniform_real_distribution<float> vert(-0.45f, 0.45f);
+    std::uniform_real_distribution<float> rot(-0.15f, 0.15f);
+    std::uniform_real_distribution<float> dist(-0.1f, 1.5f);
+    std::uniform_real_distribution<float> fraction(0.0f, 1.0f);
+    for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+      const float vert_correction = vert(rng);
+      const float rot_correction = rot(rng);
+      input.lanes.cos_vert[lane] = cosf(vert_correction);
+      input.lanes.sin_vert[lane] = sinf(vert_correction);
+      input.lanes.cos_rot[lane] = cosf(rot_correction);
+      input.lanes.sin_rot[lane] = sinf(rot_correction);
+      input.lanes.dist_correction[lane] = dist(rng);
+      input.lanes.azimuth_fraction[lane] = fraction(rng);
+    }
+    for (int i = 0; i < BLOCK_DATA_SIZE; ++i) {
+      input.data[i] = rng();
+    }
+    // blank and farthest returns
+    input.data[0] = input.data[1] = 0;
+    input.data[3] = input.data[4] = 0xff;
+
+    // up to the last unit, so the corrected azimuths wrap around
+    input.azimuth = rng() % ROTATION_MAX_UNITS;
+    input.azimuth_diff = rng() % 60;
+    input.distance_resolution = (rng() % 2) ? 0.002f : 0.004f;
+  }
+
+  void convert(const BlockKernel & kernel, const BlockInput & input, BlockPoints & points) const
+  {
+    kernel.convert(
+      input.lanes, input.data, input.azimuth, input.azimuth_diff,
+      cos_rot_table_.data(), sin_rot_table_.data(), input.distance_resolution, points);
+  }
+
+  std::vector<float> cos_rot_table_;
+  std::vector<float> sin_rot_table_;
+};
+
+// the x86 kernels round as the scalar one does, other targets may differ
+// in the last bits
+#ifdef VELODYNE_SIMD_X86
+#define EXPECT_KERNEL_FLOAT_EQ EXPECT_EQ
+#else
+#define EXPECT_KERNEL_FLOAT_EQ EXPECT_FLOAT_EQ
+#endif
+
+static void expectSamePoints(
+  const BlockPoints & expected, const BlockPoints & actual, const char * kernel)
+{
+  for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+    EXPECT_KERNEL_FLOAT_EQ(expected.x[lane], actual.x[lane]) << kernel << " lane " << lane;
+    EXPECT_KERNEL_FLOAT_EQ(expected.y[lane], actual.y[lane]) << kernel << " lane " << lane;
+    EXPECT_KERNEL_FLOAT_EQ(expected.z[lane], actual.z[lane]) << kernel << " lane " << lane;
+    EXPECT_KERNEL_FLOAT_EQ(expected.distance[lane], actual.distance[lane])
+      << kernel << " lane " << lane;
+    EXPECT_EQ(expected.intensity[lane], actual.intensity[lane]) << kernel << " lane " << lane;
+    EXPECT_EQ(expected.azimuth[lane], actual.azimuth[lane]) << kernel << " lane " << lane;
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST_F(BlockKernels, same_as_scalar)
+{
+  const BlockKernel scalar = scalarBlockKernel();
+  std::mt19937 rng(42);
+  BlockInput input;
+  BlockPoints expected;
+  BlockPoints actual;
+  for (const BlockKernel & kernel : supportedKernels()) {
+    for (int i = 0; i < 2000 && !HasFailure(); ++i) {
+      randomInput(rng, input);
+      convert(scalar, input, expected);
+      convert(kernel, input, actual);
+      expectSamePoints(expected, actual, kernel.name);
+    }
+  }
+}
+
+TEST_F(BlockKernels, selected_same_as_scalar)
+{
+  const BlockKernel scalar = scalarBlockKernel();
+  const BlockKernel selected = selectBlockKernel();
+  std::mt19937 rng(7);
+  BlockInput input;
+  BlockPoints expected;
+  BlockPoints actual;
+  for (int i = 0; i < 2000 && !HasFailure(); ++i) {
+    randomInput(rng, input);
+    convert(scalar, input, expected);
+    convert(selected, input, actual);
+    expectSamePoints(expected, actual, selected.name);
+  }
+}
+
+// a level laser with no corrections, by hand
+TEST_F(BlockKernels, scalar_converts_level_return)
+{
+  BlockInput input;
+  for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+    input.lanes.cos_vert[lane] = 1.0f;
+    input.lanes.sin_vert[lane] = 0.0f;
+    input.lanes.cos_rot[lane] = 1.0f;
+    input.lanes.sin_rot[lane] = 0.0f;
+    input.lanes.dist_correction[lane] = 0.0f;
+    input.lanes.azimuth_fraction[lane] = 0.0f;
+    input.data[lane * 3] = 500 & 0xff;
+    input.data[lane * 3 + 1] = 500 >> 8;
+    input.data[lane * 3 + 2] = lane;
+  }
+  input.azimuth = 9000;           // 90 degrees, to the right
+  input.azimuth_diff = 20;
+  input.distance_resolution = 0.002f;
+
+  BlockPoints points;
+  convert(scalarBlockKernel(), input, points);
+  for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+    EXPECT_FLOAT_EQ(points.distance[lane], 1.0f) << "lane " << lane;
+    EXPECT_NEAR(points.x[lane], 0.0f, 1e-6f) << "lane " << lane;
+    EXPECT_FLOAT_EQ(points.y[lane], -1.0f) << "lane " << lane;
+    EXPECT_EQ(points.z[lane], 0.0f) << "lane " << lane;
+    EXPECT_EQ(points.intensity[lane], lane) << "lane " << lane;
+    EXPECT_EQ(points.azimuth[lane], 9000) << "lane " << lane;
+  }
+}
+
+// corrected azimuths past the last unit start over at zero
+TEST_F(BlockKernels, azimuth_wraps_around)
+{
+  const BlockKernel scalar = scalarBlockKernel();
+  std::vector<BlockKernel> kernels = supportedKernels();
+  kernels.push_back(scalar);
+  std::mt19937 rng(11);
+  BlockInput input;
+  BlockPoints expected;
+  BlockPoints actual;
+  randomInput(rng, input);
+  for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+    input.lanes.azimuth_fraction[lane] = lane / float(BLOCK_LANES - 1);
+  }
+  input.azimuth = ROTATION_MAX_UNITS - 1;
+  input.azimuth_diff = 40;
+  convert(scalar, input, expected);
+  EXPECT_EQ(expected.azimuth[0], ROTATION_MAX_UNITS - 1);
+  EXPECT_EQ(expected.azimuth[BLOCK_LANES - 1], 39);
+  for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+    EXPECT_GE(expected.azimuth[lane], 0) << "lane " << lane;
+    EXPECT_LT(expected.azimuth[lane], ROTATION_MAX_UNITS) << "lane " << lane;
+  }
+  for (const BlockKernel & kernel : kernels) {
+    convert(kernel, input, actual);
+    expectSamePoints(expected, actual, kernel.name);
+  }
+}
+
+// no returns and the farthest ones, at both distance resolutions
+TEST_F(BlockKernels, extreme_distances)
+{
+  const BlockKernel scalar = scalarBlockKernel();
+  std::mt19937 rng(3);
+  BlockInput input;
+  BlockPoints expected;
+  BlockPoints actual;
+  for (const BlockKernel & kernel : supportedKernels()) {
+    for (uint8_t raw : {0x00, 0xff}) {
+      for (float resolution : {0.002f, 0.004f}) {
+        randomInput(rng, input);
+        for (int lane = 0; lane < BLOCK_LANES; ++lane) {
+          input.data[lane * 3] = input.data[lane * 3 + 1] = raw;
+        }
+        input.distance_resolution = resolution;
+        convert(scalar, input, expected);
+        convert(kernel, input, actual);
+        expectSamePoints(expected, actual, kernel.name);
+      }
+    }
+  }
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
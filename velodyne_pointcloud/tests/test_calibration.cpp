@@ -36,15 +36,11 @@
 
 #include <gtest/gtest.h>
 
-#include <ros/package.h>
 #include <velodyne_pointcloud/calibration.h>
 using namespace velodyne_pointcloud;
 
-// global test data
-std::string g_package_name("velodyne_pointcloud");
-std::string g_package_path;
-
-void init_global_data(void) { g_package_path = ros::package::getPath(g_package_name); }
+// global test data, read from the source tree
+std::string g_package_path(PACKAGE_SOURCE_DIR);
 
 ///////////////////////////////////////////////////////////////
 // Test cases
@@ -184,6 +180,5 @@ TEST(Calibration, hdl64e_s2_float_intensities)
 int main(int argc, char ** argv)
 {
   testing::InitGoogleTest(&argc, argv);
-  init_global_data();
   return RUN_ALL_TESTS();
 }
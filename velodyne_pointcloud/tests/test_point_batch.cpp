@@ -0,0 +1,261 @@
+//
+//  License: Modified BSD Software License Agreement
+//
+
+//
+// C++ unit tests for the batch container interface: points added a
+// packet at a time, or in slices written out of order, must end up as
+// if they were added one by one.
+//
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include <velodyne_pointcloud/pointcloud2XYZIRADT.h>
+#include <velodyne_pointcloud/pointcloudXYZIRADT.h>
+using namespace velodyne_rawdata;
+
+static const double MIN_RANGE = 0.9;
+static const double MAX_RANGE = 130.0;
+
+/** fields of a batch of random points, some out of range */
+struct BatchData
+{
+  std::vector<float> x, y, z, distance, intensity;
+  std::vector<uint8_t> return_type;
+  std::vector<uint16_t> ring, azimuth;
+  std::vector<double> time_stamp;
+
+  BatchData(std::mt19937 & rng, size_t size, double first_time)
+  {
+    std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> range(0.0f, 150.0f);
+    for (size_t i = 0; i < size; ++i) {
+      x.push_back(coordinate(rng));
+      y.push_back(coordinate(rng));
+      z.push_back(coordinate(rng));
+      distance.push_back(range(rng));
+      intensity.push_back(rng() % 256);
+      return_type.push_back(rng() % 7);
+      ring.push_back(rng() % 128);
+      azimuth.push_back(rng() % 36000);
+      time_stamp.push_back(first_time + i * 2.304e-6);
+    }
+  }
+
+  /** @returns the first size points */
+  PointBatch batch(size_t size) const
+  {
+    PointBatch batch;
+    batch.size = size;
+    batch.x = x.data();
+    batch.y = y.data();
+    batch.z = z.data();
+    batch.return_type = return_type.data();
+    batch.ring = ring.data();
+    batch.azimuth = azimuth.data();
+    batch.distance = distance.data();
+    batch.intensity = intensity.data();
+    batch.time_stamp = time_stamp.data();
+    return batch;
+  }
+
+  PointBatch batch() const {return batch(x.size());}
+};
+
+/** container of an older kind, with addPoint only */
+class PointRecorder : public DataContainerBase
+{
+public:
+  virtual void addPoint(
+    const float & x, const float & y, const float & z,
+    const uint8_t & return_type, const uint16_t & ring,
+    const uint16_t & azimuth, const float & distance, const float & intensity,
+    const double & time_stamp) override
+  {
+    velodyne_pointcloud::PointXYZIRADT point;
+    point.x = x;
+    point.y = y;
+    point.z = z;
+    point.intensity = intensity;
+    point.return_type = return_type;
+    point.ring = ring;
+    point.azimuth = azimuth;
+    point.distance = distance;
+    point.time_stamp = time_stamp;
+    points.push_back(point);
+  }
+
+  std::vector<velodyne_pointcloud::PointXYZIRADT> points;
+};
+
+static void expectSamePoint(
+  const velodyne_pointcloud::PointXYZIRADT & expected,
+  const velodyne_pointcloud::PointXYZIRADT & actual, size_t index)
+{
+  EXPECT_EQ(expected.x, actual.x) << "point " << index;
+  EXPECT_EQ(expected.y, actual.y) << "point " << index;
+  EXPECT_EQ(expected.z, actual.z) << "point " << index;
+  EXPECT_EQ(expected.intensity, actual.intensity) << "point " << index;
+  EXPECT_EQ(expected.return_type, actual.return_type) << "point " << index;
+  EXPECT_EQ(expected.ring, actual.ring) << "point " << index;
+  EXPECT_EQ(expected.azimuth, actual.azimuth) << "point " << index;
+  EXPECT_EQ(expected.distance, actual.distance) << "point " << index;
+  EXPECT_EQ(expected.time_stamp, actual.time_stamp) << "point " << index;
+}
+
+static void addOneByOne(DataContainerBase & container, const PointBatch & batch)
+{
+  for (size_t i = 0; i < batch.size; ++i) {
+    container.addPoint(
+      batch.x[i], batch.y[i], batch.z[i], batch.return_type[i], batch.ring[i],
+      batch.azimuth[i], batch.distance[i], batch.intensity[i], batch.time_stamp[i]);
+  }
+}
+
+/** @brief Add batches in slices, writing the last slice first.
+ *
+ *  The slices get room for capacity[i] points each, as the decode
+ *  pool lays them out.
+ */
+static void addInSlices(
+  DataContainerBase & container, const std::vector<BatchData> & batches,
+  const std::vector<size_t> & capacity)
+{
+  std::vector<PointSlice> slices(batches.size());
+  size_t total = 0;
+  for (size_t i = 0; i < slices.size(); ++i) {
+    slices[i].first = total;
+    slices[i].capacity = capacity[i];
+    slices[i].size = 0;
+    slices[i].added = 0;
+    slices[i].first_time_stamp = 0.0;
+    total += capacity[i];
+  }
+  ASSERT_TRUE(container.beginSlices(total));
+  for (size_t i = slices.size(); i-- > 0; ) {
+    const PointBatch batch = batches[i].batch();
+    if (batch.size > 0 && slices[i].added == 0) {
+      slices[i].first_time_stamp = batch.time_stamp[0];
+    }
+    slices[i].added += batch.size;
+    container.writeSlice(slices[i], batch);
+  }
+  container.endSlices(slices);
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+// containers without addPoints still get every point, in order
+TEST(PointBatch, default_hands_points_to_addPoint)
+{
+  std::mt19937 rng(1);
+  BatchData data(rng, 384, 10.0);
+  PointRecorder recorder;
+  recorder.addPoints(data.batch());
+  ASSERT_EQ(recorder.points.size(), data.x.size());
+
+  PointRecorder expected;
+  addOneByOne(expected, data.batch());
+  for (size_t i = 0; i < recorder.points.size(); ++i) {
+    expectSamePoint(expected.points[i], recorder.points[i], i);
+  }
+
+  // and are filled serially
+  EXPECT_FALSE(recorder.beginSlices(100));
+}
+
+TEST(PointcloudXYZIRADT, batch_same_as_points)
+{
+  std::mt19937 rng(2);
+  velodyne_pointcloud::PointcloudXYZIRADT serial;
+  velodyne_pointcloud::PointcloudXYZIRADT batched;
+  for (int packet = 0; packet < 5; ++packet) {
+    BatchData data(rng, rng() % 400, packet);
+    addOneByOne(serial, data.batch());
+    batched.addPoints(data.batch());
+  }
+  ASSERT_EQ(batched.pc->points.size(), serial.pc->points.size());
+  EXPECT_EQ(batched.pc->width, serial.pc->width);
+  for (size_t i = 0; i < serial.pc->points.size(); ++i) {
+    expectSamePoint(serial.pc->points[i], batched.pc->points[i], i);
+  }
+}
+
+// slices written out of order, one cut short, after points added serially
+TEST(PointcloudXYZIRADT, slices_in_slice_order)
+{
+  std::mt19937 rng(3);
+  BatchData head(rng, 50, 0.0);
+  std::vector<BatchData> batches;
+  std::vector<size_t> capacity;
+  for (int packet = 0; packet < 6; ++packet) {
+    batches.emplace_back(rng, 384, 1.0 + packet);
+    capacity.push_back(packet == 2 ? 100 : 384);
+  }
+
+  velodyne_pointcloud::PointcloudXYZIRADT serial;
+  serial.addPoints(head.batch());
+  for (size_t i = 0; i < batches.size(); ++i) {
+    serial.addPoints(batches[i].batch(capacity[i]));
+  }
+
+  velodyne_pointcloud::PointcloudXYZIRADT sliced;
+  sliced.addPoints(head.batch());
+  addInSlices(sliced, batches, capacity);
+
+  ASSERT_EQ(sliced.pc->points.size(), serial.pc->points.size());
+  EXPECT_EQ(sliced.pc->width, serial.pc->width);
+  for (size_t i = 0; i < serial.pc->points.size(); ++i) {
+    expectSamePoint(serial.pc->points[i], sliced.pc->points[i], i);
+  }
+}
+
+// the same for the messages, which also drop the points out of range
+TEST(Pointcloud2XYZIRADT, slices_in_slice_order)
+{
+  std::mt19937 rng(4);
+  std::vector<BatchData> batches;
+  std::vector<size_t> capacity;
+  for (int packet = 0; packet < 6; ++packet) {
+    batches.emplace_back(rng, 384, 1.0 + packet);
+    capacity.push_back(packet == 4 ? 10 : 384);
+  }
+  const size_t max_points = 6 * 384;
+  std_msgs::msg::Header header;
+  header.frame_id = "velodyne";
+  builtin_interfaces::msg::Time fallback;
+
+  velodyne_pointcloud::Pointcloud2XYZIRADT serial(max_points, MIN_RANGE, MAX_RANGE, true, true);
+  for (size_t i = 0; i < batches.size(); ++i) {
+    serial.addPoints(batches[i].batch(capacity[i]));
+  }
+  serial.finish(header, fallback);
+
+  velodyne_pointcloud::Pointcloud2XYZIRADT sliced(max_points, MIN_RANGE, MAX_RANGE, true, true);
+  addInSlices(sliced, batches, capacity);
+  sliced.finish(header, fallback);
+
+  ASSERT_LT(serial.xyziradt->width, max_points);   // some were out of range
+  for (const auto & pair : {std::make_pair(serial.xyziradt.get(), sliced.xyziradt.get()),
+      std::make_pair(serial.xyzir.get(), sliced.xyzir.get())})
+  {
+    EXPECT_EQ(pair.second->width, pair.first->width);
+    EXPECT_EQ(pair.second->row_step, pair.first->row_step);
+    EXPECT_EQ(pair.second->header.stamp, pair.first->header.stamp);
+    EXPECT_TRUE(pair.second->data == pair.first->data);
+  }
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+//
+//  License: Modified BSD Software License Agreement
+//
+
+//
+// C++ unit tests for the sensor traits: the laser, bank and timing of
+// each return, as the decoders computed them before the traits.
+//
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <vector>
+
+#include <velodyne_pointcloud/sensor_traits.h>
+using namespace velodyne_rawdata;
+
+// the decoders select their instances at compile time
+static_assert(VLP16Traits::bank(UPPER_BANK) == 0, "VLP-16 blocks are all upper bank");
+static_assert(VLP16Traits::bank(LOWER_BANK) < 0, "VLP-16 has no lower bank");
+static_assert(VLS128Traits::bank(VLS128_BANK_4) == 3, "VLS-128 has four banks");
+static_assert(HDL64ETraits::bank(LOWER_BANK) == 1, "HDL-64E lower bank is lasers 32-63");
+static_assert(VLP32CTraits::LASERS == HDL32ETraits::LASERS, "VLP-32C is laid out as HDL-32E");
+
+/** headers of the blocks each family sends */
+template<class Traits>
+std::vector<uint16_t> bankHeaders();
+template<>
+std::vector<uint16_t> bankHeaders<VLP16Traits>() {return {UPPER_BANK};}
+template<>
+std::vector<uint16_t> bankHeaders<VLS128Traits>()
+{
+  return {VLS128_BANK_1, VLS128_BANK_2, VLS128_BANK_3, VLS128_BANK_4};
+}
+template<>
+std::vector<uint16_t> bankHeaders<HDL64ETraits>() {return {UPPER_BANK, LOWER_BANK};}
+template<>
+std::vector<uint16_t> bankHeaders<HDL32ETraits>() {return {UPPER_BANK};}
+template<>
+std::vector<uint16_t> bankHeaders<VLP32CTraits>() {return {UPPER_BANK};}
+
+template<class Traits>
+class SensorTraits : public ::testing::Test {};
+
+typedef ::testing::Types<VLP16Traits, VLS128Traits, HDL64ETraits, HDL32ETraits, VLP32CTraits>
+  AllTraits;
+TYPED_TEST_SUITE(SensorTraits, AllTraits);
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+// the banks of a family reach every laser of its calibration
+TYPED_TEST(SensorTraits, banks_cover_all_lasers)
+{
+  std::set<int> lasers;
+  for (uint16_t header : bankHeaders<TypeParam>()) {
+    const int bank = TypeParam::bank(header);
+    ASSERT_GE(bank, 0) << std::hex << header;
+    for (int lane = 0; lane < SCANS_PER_BLOCK; ++lane) {
+      const int laser = TypeParam::laser(bank, lane);
+      EXPECT_GE(laser, 0) << "bank " << bank << " lane " << lane;
+      EXPECT_LT(laser, TypeParam::LASERS) << "bank " << bank << " lane " << lane;
+      lasers.insert(laser);
+    }
+  }
+  EXPECT_EQ(lasers.size(), static_cast<size_t>(TypeParam::LASERS));
+}
+
+// returns fire in lane order, and each block after the one before
+TYPED_TEST(SensorTraits, firing_times_increase)
+{
+  double block_start = -1.0;
+  for (int block = 0; block < BLOCKS_PER_PACKET; ++block) {
+    EXPECT_GT(TypeParam::firingTime(block, 0), block_start) << "block " << block;
+    block_start = TypeParam::firingTime(block, 0);
+    for (int lane = 1; lane < SCANS_PER_BLOCK; ++lane) {
+      EXPECT_GT(TypeParam::firingTime(block, lane), TypeParam::firingTime(block, lane - 1))
+        << "block " << block << " lane " << lane;
+    }
+  }
+  // within the longest packet period, the VLP-16's 1.33 ms
+  EXPECT_LT(TypeParam::firingTime(BLOCKS_PER_PACKET - 1, SCANS_PER_BLOCK - 1), 1.33e-3);
+}
+
+TEST(VLP16Traits, two_firings_per_block)
+{
+  for (int lane = 0; lane < SCANS_PER_BLOCK; ++lane) {
+    const int firing = lane / VLP16_SCANS_PER_FIRING;
+    const int dsr = lane % VLP16_SCANS_PER_FIRING;
+    EXPECT_EQ(VLP16Traits::laser(0, lane), dsr);
+    EXPECT_FLOAT_EQ(
+      VLP16Traits::azimuthFraction(0, lane),
+      ((dsr * VLP16_DSR_TOFFSET) + (firing * VLP16_FIRING_TOFFSET)) / VLP16_BLOCK_TDURATION);
+    EXPECT_DOUBLE_EQ(
+      VLP16Traits::firingTime(3, lane),
+      (3 * 2 + firing) * 55.296 / 1000.0 / 1000.0 + dsr * 2.304 / 1000.0 / 1000.0);
+    EXPECT_GE(VLP16Traits::azimuthFraction(0, lane), 0.0f);
+    EXPECT_LT(VLP16Traits::azimuthFraction(0, lane), 1.0f);
+  }
+}
+
+TEST(VLS128Traits, eight_lasers_per_firing_group)
+{
+  for (int bank = 0; bank < 4; ++bank) {
+    for (int lane = 0; lane < SCANS_PER_BLOCK; ++lane) {
+      const int laser = bank * SCANS_PER_BLOCK + lane;
+      const int group = laser / 8;
+      EXPECT_EQ(VLS128Traits::laser(bank, lane), laser);
+      EXPECT_FLOAT_EQ(
+        VLS128Traits::azimuthFraction(bank, lane),
+        (VLS128_CHANNEL_TDURATION / VLS128_SEQ_TDURATION) * (group + group / 8));
+    }
+  }
+  EXPECT_LT(VLS128Traits::bank(UPPER_BANK + 1), 0);
+}
+
+TEST(HDLTraits, unknown_headers)
+{
+  // anything but the lower bank is the upper one, as before the traits
+  EXPECT_EQ(HDL64ETraits::bank(0x1234), 0);
+  // 32-laser sensors have no lower bank to index
+  EXPECT_EQ(HDL32ETraits::bank(LOWER_BANK), 0);
+  EXPECT_EQ(VLP32CTraits::bank(LOWER_BANK), 0);
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,323 @@
+//
+//  License: Modified BSD Software License Agreement
+//
+
+//
+// C++ unit tests for decoding scans in parallel: a DecodePool must
+// give the points, and their order, of decoding the packets serially.
+//
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <pcl_conversions/pcl_conversions.h>
+#include <rclcpp/rclcpp.hpp>
+#include <velodyne_msgs/msg/velodyne_scan.hpp>
+#include <velodyne_pointcloud/decode_pool.h>
+#include <velodyne_pointcloud/func.h>
+#include <velodyne_pointcloud/pointcloud2XYZIRADT.h>
+#include <velodyne_pointcloud/pointcloudXYZIRADT.h>
+#include <velodyne_pointcloud/rawdata.h>
+using namespace velodyne_rawdata;
+
+// global test data
+std::string g_package_path(PACKAGE_SOURCE_DIR);
+
+static const double MIN_RANGE = 0.9;
+static const double MAX_RANGE = 130.0;
+static const int SCANS_PER_CASE = 10;
+
+struct ScanCase
+{
+  const char * calibration;             ///< file in params/
+  uint8_t sensor_model;
+  uint8_t return_mode;
+};
+
+static void PrintTo(const ScanCase & scan_case, std::ostream * os)
+{
+  *os << scan_case.calibration << " mode " << static_cast<int>(scan_case.return_mode);
+}
+
+class UnpackScan : public ::testing::TestWithParam<ScanCase>
+{
+protected:
+  void SetUp() override
+  {
+    node_ = std::make_shared<rclcpp::Node>("test_unpack_scan", rclcpp::NodeOptions());
+    data_.reset(new RawData(node_.get()));
+    ASSERT_EQ(
+      data_->setupOffline(
+        g_package_path + "/params/" + GetParam().calibration, MAX_RANGE, MIN_RANGE), 0);
+    data_->setParameters(MIN_RANGE, MAX_RANGE, 0.0, 2 * M_PI);
+  }
+
+  /** @returns block header of the model, as its bank layout has it */
+  uint16_t blockHeader(int block) const
+  {
+    const ScanCase & scan_case = GetParam();
+    const bool dual = (scan_case.return_mode == RETURN_MODE_DUAL);
+    if (data_->getNumLasers() == 128) {
+      static const uint16_t BANKS[4] = {VLS128_BANK_1, VLS128_BANK_2, VLS128_BANK_3, VLS128_BANK_4};
+      return BANKS[(dual ? block / 2 : block) % 4];
+    }
+    if (data_->getNumLasers() == 64) {
+      return (block % 2) ? LOWER_BANK : UPPER_BANK;
+    }
+    return UPPER_BANK;
+  }
+
+  /** a scan of random returns, cut at random blocks of its end packets */
+  void randomScan(std::mt19937 & rng, velodyne_msgs::msg::VelodyneScan & scan) const
+  {
+    const ScanCase & scan_case = GetParam();
+    const bool dual = (scan_case.return_mode == RETURN_MODE_DUAL);
+    const size_t packets = 2 + rng() % 200;
+    uint16_t azimuth = rng() % 36000;
+    scan.packets.resize(packets);
+    for (size_t n = 0; n < packets; ++n) {
+      velodyne_msgs::msg::VelodynePacket & packet = scan.packets[n];
+      for (int block = 0; block < BLOCKS_PER_PACKET; ++block) {
+        uint8_t * data = &packet.data[block * SIZE_BLOCK];
+        const uint16_t header = blockHeader(block);
+        const uint16_t rotation = (azimuth + (dual ? block / 2 : block) * 20) % 36000;
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + 2, &rotation, sizeof(rotation));
+        for (int i = 4; i < SIZE_BLOCK; ++i) {
+          data[i] = rng();
+        }
+        if (rng() % 4 == 0) {
+          data[4] = data[5] = 0;        // a blank return
+        }
+        if (dual && (block % 2) && rng() % 3 == 0) {
+          // the same return twice
+          memcpy(data + 4, data - SIZE_BLOCK + 4, 30);
+        }
+      }
+      azimuth = (azimuth + (dual ? 6 : 12) * 20) % 36000;
+      if (data_->getNumLasers() == 64) {
+        // the HDL-64E sends rotating status bytes instead
+        packet.data[1204] = rng();
+        packet.data[1205] = rng();
+      } else {
+        packet.data[1204] = scan_case.return_mode;
+        packet.data[1205] = scan_case.sensor_model;
+      }
+      packet.stamp.sec = 1000 + n;
+      packet.stamp.nanosec = n * 1000;
+    }
+    scan.first_block = rng() % BLOCKS_PER_PACKET;
+    scan.end_block = rng() % BLOCKS_PER_PACKET;
+  }
+
+  size_t maxPoints(const velodyne_msgs::msg::VelodyneScan & scan) const
+  {
+    return scan.packets.size() * data_->scansPerPacket();
+  }
+
+  std::shared_ptr<rclcpp::Node> node_;
+  std::unique_ptr<RawData> data_;
+};
+
+/** @returns bytes of a PointField datatype */
+static size_t fieldSize(uint8_t datatype)
+{
+  typedef sensor_msgs::msg::PointField PointField;
+  switch (datatype) {
+    case PointField::INT8:
+    case PointField::UINT8:
+      return 1;
+    case PointField::INT16:
+    case PointField::UINT16:
+      return 2;
+    case PointField::FLOAT64:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
+/** @brief Expect a message as pcl::toROSMsg makes it.
+ *
+ *  pcl::toROSMsg copies the points padding and all, and the PCL
+ *  containers leave their padding uninitialized, so the data is
+ *  compared byte for byte where the fields are, and the padding of
+ *  the message decoded straight into must be zero.
+ */
+static void expectSameCloud(
+  const sensor_msgs::msg::PointCloud2 & expected, const sensor_msgs::msg::PointCloud2 & actual)
+{
+  EXPECT_TRUE(expected.header.stamp == actual.header.stamp);
+  EXPECT_EQ(expected.header.frame_id, actual.header.frame_id);
+  EXPECT_EQ(expected.height, actual.height);
+  EXPECT_EQ(expected.width, actual.width);
+  EXPECT_EQ(expected.is_bigendian, actual.is_bigendian);
+  EXPECT_EQ(expected.point_step, actual.point_step);
+  EXPECT_EQ(expected.row_step, actual.row_step);
+  EXPECT_EQ(expected.is_dense, actual.is_dense);
+  ASSERT_EQ(expected.fields.size(), actual.fields.size());
+  std::vector<bool> in_field(actual.point_step, false);
+  for (size_t f = 0; f < expected.fields.size(); ++f) {
+    EXPECT_EQ(expected.fields[f].name, actual.fields[f].name) << "field " << f;
+    EXPECT_EQ(expected.fields[f].offset, actual.fields[f].offset) << "field " << f;
+    EXPECT_EQ(expected.fields[f].datatype, actual.fields[f].datatype) << "field " << f;
+    EXPECT_EQ(expected.fields[f].count, actual.fields[f].count) << "field " << f;
+    const size_t end = actual.fields[f].offset + fieldSize(actual.fields[f].datatype);
+    ASSERT_LE(end, actual.point_step);
+    for (size_t b = actual.fields[f].offset; b < end; ++b) {
+      in_field[b] = true;
+    }
+  }
+  ASSERT_EQ(expected.data.size(), actual.data.size());
+  for (size_t i = 0; i < actual.data.size(); ++i) {
+    if (in_field[i % actual.point_step]) {
+      ASSERT_EQ(expected.data[i], actual.data[i])
+        << "point " << i / actual.point_step << " byte " << i % actual.point_step;
+    } else {
+      ASSERT_EQ(actual.data[i], 0)
+        << "point " << i / actual.point_step << " byte " << i % actual.point_step;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////
+// Test cases
+///////////////////////////////////////////////////////////////
+
+TEST_P(UnpackScan, pcl_cloud_same_as_serial)
+{
+  DecodePool pool(4);
+  std::mt19937 rng(1);
+  for (int i = 0; i < SCANS_PER_CASE && !HasFailure(); ++i) {
+    velodyne_msgs::msg::VelodyneScan scan;
+    randomScan(rng, scan);
+    velodyne_pointcloud::PointcloudXYZIRADT serial;
+    velodyne_pointcloud::PointcloudXYZIRADT parallel;
+    data_->unpackScan(scan, serial, NULL);
+    data_->unpackScan(scan, parallel, &pool);
+
+    ASSERT_GT(serial.pc->points.size(), 0u);
+    ASSERT_EQ(serial.pc->points.size(), parallel.pc->points.size());
+    EXPECT_EQ(serial.pc->width, parallel.pc->width);
+    EXPECT_EQ(serial.pc->height, parallel.pc->height);
+    for (size_t p = 0; p < serial.pc->points.size(); ++p) {
+      const velodyne_pointcloud::PointXYZIRADT & expected = serial.pc->points[p];
+      const velodyne_pointcloud::PointXYZIRADT & actual = parallel.pc->points[p];
+      ASSERT_EQ(expected.x, actual.x) << "point " << p;
+      ASSERT_EQ(expected.y, actual.y) << "point " << p;
+      ASSERT_EQ(expected.z, actual.z) << "point " << p;
+      ASSERT_EQ(expected.intensity, actual.intensity) << "point " << p;
+      ASSERT_EQ(expected.ring, actual.ring) << "point " << p;
+      ASSERT_EQ(expected.azimuth, actual.azimuth) << "point " << p;
+      ASSERT_EQ(expected.distance, actual.distance) << "point " << p;
+      ASSERT_EQ(expected.return_type, actual.return_type) << "point " << p;
+      ASSERT_EQ(expected.time_stamp, actual.time_stamp) << "point " << p;
+    }
+  }
+}
+
+TEST_P(UnpackScan, point_cloud2_same_as_serial)
+{
+  DecodePool pool(4);
+  std::mt19937 rng(2);
+  for (int i = 0; i < SCANS_PER_CASE && !HasFailure(); ++i) {
+    velodyne_msgs::msg::VelodyneScan scan;
+    randomScan(rng, scan);
+    velodyne_pointcloud::Pointcloud2XYZIRADT serial(
+      maxPoints(scan), MIN_RANGE, MAX_RANGE, true, true);
+    velodyne_pointcloud::Pointcloud2XYZIRADT parallel(
+      maxPoints(scan), MIN_RANGE, MAX_RANGE, true, true);
+    data_->unpackScan(scan, serial, NULL);
+    data_->unpackScan(scan, parallel, &pool);
+
+    std_msgs::msg::Header header;
+    serial.finish(header, scan.packets[0].stamp);
+    parallel.finish(header, scan.packets[0].stamp);
+    ASSERT_GT(serial.xyziradt->width, 0u);
+    EXPECT_EQ(serial.xyziradt->width, parallel.xyziradt->width);
+    EXPECT_TRUE(serial.xyziradt->data == parallel.xyziradt->data);
+    EXPECT_TRUE(serial.xyziradt->header.stamp == parallel.xyziradt->header.stamp);
+    EXPECT_EQ(serial.xyzir->width, parallel.xyzir->width);
+    EXPECT_TRUE(serial.xyzir->data == parallel.xyzir->data);
+  }
+}
+
+// the messages decoded straight into are those Convert made before,
+// from the PCL container with pcl::toROSMsg
+TEST_P(UnpackScan, point_cloud2_same_as_pcl_conversion)
+{
+  std::mt19937 rng(4);
+  for (int i = 0; i < SCANS_PER_CASE && !HasFailure(); ++i) {
+    velodyne_msgs::msg::VelodyneScan scan;
+    randomScan(rng, scan);
+    scan.header.frame_id = "velodyne";
+    scan.header.stamp = scan.packets.back().stamp;
+
+    velodyne_pointcloud::Pointcloud2XYZIRADT direct(
+      maxPoints(scan), MIN_RANGE, MAX_RANGE, true, true);
+    data_->unpackScan(scan, direct, NULL);
+    direct.finish(scan.header, scan.packets[0].stamp);
+
+    velodyne_pointcloud::PointcloudXYZIRADT container;
+    data_->unpackScan(scan, container, NULL);
+    container.pc->header = pcl_conversions::toPCL(scan.header);
+    ASSERT_GT(container.pc->points.size(), 0u);
+    container.pc->header.stamp = pcl_conversions::toPCL(
+      rclcpp::Time(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::duration<double>(container.pc->points.front().time_stamp)).count()));
+    container.pc->height = 1;
+    container.pc->width = container.pc->points.size();
+    const auto valid_points_xyziradt =
+      velodyne_pointcloud::extractValidPoints(container.pc, MIN_RANGE, MAX_RANGE);
+    ASSERT_GT(valid_points_xyziradt->points.size(), 0u);
+
+    sensor_msgs::msg::PointCloud2 expected_xyziradt;
+    pcl::toROSMsg(*valid_points_xyziradt, expected_xyziradt);
+    expectSameCloud(expected_xyziradt, *direct.xyziradt);
+
+    sensor_msgs::msg::PointCloud2 expected_xyzir;
+    pcl::toROSMsg(*velodyne_pointcloud::convert(valid_points_xyziradt), expected_xyzir);
+    expectSameCloud(expected_xyzir, *direct.xyzir);
+  }
+}
+
+TEST_P(UnpackScan, parallel_unless_modes_differ)
+{
+  std::mt19937 rng(3);
+  velodyne_msgs::msg::VelodyneScan scan;
+  randomScan(rng, scan);
+  EXPECT_TRUE(data_->prepareScan(scan));
+
+  // a reconfiguration within the scan, which the HDL-64E cannot report
+  scan.packets.back().data[1204] ^= 1;
+  EXPECT_EQ(data_->prepareScan(scan), data_->getNumLasers() == 64);
+}
+
+INSTANTIATE_TEST_CASE_P(
+  Models, UnpackScan,
+  ::testing::Values(
+    ScanCase{"VLP16db.yaml", SENSOR_MODEL_VLP16, RETURN_MODE_STRONGEST},
+    ScanCase{"VLP16db.yaml", SENSOR_MODEL_VLP16, RETURN_MODE_DUAL},
+    ScanCase{"VLS-128_FS1.yaml", SENSOR_MODEL_VLS128, RETURN_MODE_STRONGEST},
+    ScanCase{"VLS-128_FS1.yaml", SENSOR_MODEL_VLS128, RETURN_MODE_DUAL},
+    ScanCase{"VeloView-VLP-32C.yaml", SENSOR_MODEL_VLP32C, RETURN_MODE_STRONGEST},
+    ScanCase{"32db.yaml", SENSOR_MODEL_HDL32E, RETURN_MODE_LAST},
+    ScanCase{"64e_utexas.yaml", 0, RETURN_MODE_STRONGEST}));
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  rclcpp::init(argc, argv);
+  const int result = RUN_ALL_TESTS();
+  rclcpp::shutdown();
+  return result;
+}